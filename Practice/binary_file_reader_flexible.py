@@ -14,6 +14,8 @@ Features:
 - Memory-efficient processing
 - Character encoding fallback
 - File integrity verification
+- Self-describing files: the converter's "CBIN" header (record size, record
+  count and schema) is detected and used automatically
 
 Author: Enhanced Flexible Version
 Date: 2025-12-26
@@ -28,7 +30,7 @@ from typing import List, Dict, Optional, Tuple, Any, Union, Callable
 from enum import Enum
 from dataclasses import dataclass, field
 from pathlib import Path
-from datetime import datetime
+from datetime import datetime, timedelta
 
 
 class ErrorHandlingMode(Enum):
@@ -165,6 +167,291 @@ class RecordSchema:
         return None
 
 
+# Header written by customer_convert_v2.c (BinaryFileHeader, 512 bytes)
+BINARY_MAGIC = b'CBIN'
+ARROW_MAGIC = b'ARROW1'                  # --arrow output is an Arrow IPC file instead
+BINARY_HEADER_FORMAT = '<4sHHIIqq16s224s240s'
+BINARY_HEADER_SIZE = struct.calcsize(BINARY_HEADER_FORMAT)
+BINARY_FORMAT_VERSION = 1
+BINARY_COUNT_UNKNOWN = -1
+
+# Header flags (BINARY_FLAG_* in the converter)
+BINARY_FLAG_BLOCKS = 0x0001     # Records in CRC32C blocks with a footer index
+BINARY_FLAG_COLUMNAR = 0x0002   # Blocks are column-major row groups
+BINARY_FLAG_COMPACT = 0x0004    # Blocks hold varint-length rows
+BINARY_FLAG_DICTIONARY = 0x0008 # Row groups may dictionary-code text columns
+BINARY_FLAG_PACKED = 0x0010     # Customer phone/zip/date/state stored as numbers
+BINARY_FLAG_COMPRESSED = 0x0020 # Block payloads are LZ4 compressed
+BINARY_FLAGS_KNOWN = (BINARY_FLAG_BLOCKS | BINARY_FLAG_COLUMNAR | BINARY_FLAG_COMPACT |
+                      BINARY_FLAG_DICTIONARY | BINARY_FLAG_PACKED | BINARY_FLAG_COMPRESSED)
+
+# Block layout: [header][payload] per block, then the index and the trailer
+BLOCK_HEADER_FORMAT = '<IIII'           # record_count, stored_size, raw_size, crc32c
+BLOCK_INDEX_ENTRY_FORMAT = '<qqIIII'    # offset, first_record, + the header fields
+BLOCK_TRAILER_FORMAT = '<qII4sI'        # index_offset, block_count, index_crc32c, magic, block_size
+BLOCK_INDEX_MAGIC = b'CIDX'
+COLUMN_DIRECTORY_ENTRY_FORMAT = '<II'   # offset (from payload start), size
+COMPACT_OFFSET_STRIDE = 16              # Rows per compact offset table entry
+COLUMN_HEADER_FORMAT = '<BBH'           # encoding, reserved, entry_count
+COLUMN_PLAIN, COLUMN_CODES8, COLUMN_CODES16 = 0, 1, 2
+
+# Packed customers: empty-field sentinels and the state ordinal table
+# (PACKED_*_EMPTY and STATE_CODES in the converter)
+PACKED_PHONE_EMPTY = 0xFFFFFFFFFFFFFFFF
+PACKED_ZIP_EMPTY = 0xFFFFFFFF
+PACKED_DATE_EMPTY = -2**31
+STATE_CODES = (
+    "",
+    "AL", "AK", "AZ", "AR", "CA", "CO", "CT", "DE", "FL", "GA",
+    "HI", "ID", "IL", "IN", "IA", "KS", "KY", "LA", "ME", "MD",
+    "MA", "MI", "MN", "MS", "MO", "MT", "NE", "NV", "NH", "NJ",
+    "NM", "NY", "NC", "ND", "OH", "OK", "OR", "PA", "RI", "SC",
+    "SD", "TN", "TX", "UT", "VT", "VA", "WA", "WV", "WI", "WY",
+    "DC",
+    "AS", "GU", "MP", "PR", "VI",
+    "FM", "MH", "PW",
+    "AA", "AE", "AP"
+)
+_EPOCH = datetime(1970, 1, 1)
+
+
+def unpack_customer_record(record: Dict[str, Any]) -> Dict[str, Any]:
+    """
+    Converts a record read from a --packed customer file back to the text
+    the converter was given (phone XXX-XXX-XXXX, 5-digit ZIP, YYYY-MM-DD
+    date, two-letter state).
+    """
+    text = dict(record)
+    phone = record['phone']
+    text['phone'] = ('' if phone == PACKED_PHONE_EMPTY else
+                     f"{phone // 10**7:03d}-{phone // 10**4 % 1000:03d}-{phone % 10**4:04d}")
+    zip_code = record['zip_code']
+    text['zip_code'] = '' if zip_code == PACKED_ZIP_EMPTY else f"{zip_code:05d}"
+    days = record['registration_date']
+    text['registration_date'] = ('' if days == PACKED_DATE_EMPTY else
+                                 (_EPOCH + timedelta(days=days)).strftime('%Y-%m-%d'))
+    state = record['state']
+    text['state'] = STATE_CODES[state] if state < len(STATE_CODES) else ''
+    return text
+
+
+# Columns the converter may dictionary-code (FIELD_CATEGORY)
+DICTIONARY_FIELDS = {'first_name', 'last_name', 'city', 'state', 'payment_method'}
+
+
+def _make_crc32c_table() -> List[int]:
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+_CRC32C_TABLE = _make_crc32c_table()
+
+
+def crc32c(data: bytes, crc: int = 0) -> int:
+    """CRC32C (Castagnoli), matching the converter's block checksums."""
+    crc ^= 0xFFFFFFFF
+    table = _CRC32C_TABLE
+    for byte in data:
+        crc = (crc >> 8) ^ table[(crc ^ byte) & 0xFF]
+    return crc ^ 0xFFFFFFFF
+
+
+def lz4_block_decompress(src: bytes, size: int) -> bytes:
+    """Expands an LZ4 block (the format the converter's --compress writes)."""
+    out = bytearray()
+    pos = 0
+    while pos < len(src):
+        token = src[pos]
+        pos += 1
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                byte = src[pos]
+                pos += 1
+                literals += byte
+                if byte != 255:
+                    break
+        out += src[pos:pos + literals]
+        pos += literals
+        if pos >= len(src):
+            break
+        offset = src[pos] | (src[pos + 1] << 8)
+        pos += 2
+        match_len = token & 15
+        if match_len == 15:
+            while True:
+                byte = src[pos]
+                pos += 1
+                match_len += byte
+                if byte != 255:
+                    break
+        match_len += 4
+        if offset == 0 or offset > len(out):
+            raise IOError("LZ4 block is malformed")
+        start = len(out) - offset
+        if match_len <= offset:
+            out += out[start:start + match_len]
+        else:
+            for i in range(match_len):
+                out.append(out[start + i])
+    if len(out) != size:
+        raise IOError(f"LZ4 block expanded to {len(out)} bytes, expected {size}")
+    return bytes(out)
+
+
+def block_payload(header: 'BinaryFileHeader', stored: bytes) -> bytes:
+    """
+    Layout payload of a block as stored (after its checksum is checked):
+    compressed blocks are [uint32 size][LZ4 block], or [uint32 size][payload]
+    when compression did not make them smaller.
+    """
+    if not header.compressed:
+        return stored
+    size, = struct.unpack_from('<I', stored)
+    if size == len(stored) - 4:
+        return stored[4:]
+    return lz4_block_decompress(stored[4:], size)
+
+
+@dataclass
+class BlockIndexEntry:
+    """One entry of a block layout file's footer index."""
+    offset: int
+    first_record: int
+    record_count: int
+    stored_size: int
+    raw_size: int
+    crc32c: int
+
+
+def read_block_index(filepath: Union[str, Path]) -> List[BlockIndexEntry]:
+    """Reads the footer index of a block layout file."""
+    trailer_size = struct.calcsize(BLOCK_TRAILER_FORMAT)
+    entry_size = struct.calcsize(BLOCK_INDEX_ENTRY_FORMAT)
+    
+    with open(filepath, 'rb') as f:
+        f.seek(-trailer_size, os.SEEK_END)
+        index_offset, block_count, index_crc, magic, _ = struct.unpack(
+            BLOCK_TRAILER_FORMAT, f.read(trailer_size))
+        if magic != BLOCK_INDEX_MAGIC:
+            raise IOError(f"{filepath}: no block index (incomplete file?)")
+        f.seek(index_offset)
+        raw = f.read(block_count * entry_size)
+    
+    if len(raw) != block_count * entry_size or crc32c(raw) != index_crc:
+        raise IOError(f"{filepath}: block index is damaged")
+    
+    return [BlockIndexEntry(*struct.unpack_from(BLOCK_INDEX_ENTRY_FORMAT, raw, i * entry_size))
+            for i in range(block_count)]
+
+
+@dataclass
+class BinaryFileHeader:
+    """
+    Self-describing header at the start of a converter output file.
+    
+    Attributes:
+        version: Format version
+        header_size: Byte offset of the first record
+        record_size: Size of one record in bytes
+        flags: Reserved format flags
+        record_count: Records in the file (-1 if the writer did not finish)
+        created: Unix time the conversion started
+        record_type: 'customer' or 'transaction'
+        format_string: struct format of one record (e.g. '<i50s...')
+        field_names: Field names in record order
+        params: Creation parameters as key/value pairs
+    """
+    version: int
+    header_size: int
+    record_size: int
+    flags: int
+    record_count: int
+    created: int
+    record_type: str
+    format_string: str
+    field_names: List[str]
+    params: Dict[str, str]
+    
+    @classmethod
+    def read(cls, filepath: Union[str, Path]) -> Optional['BinaryFileHeader']:
+        """Returns the file's header, or None for a headerless (legacy) file."""
+        with open(filepath, 'rb') as f:
+            raw = f.read(BINARY_HEADER_SIZE)
+        
+        if raw[:len(ARROW_MAGIC)] == ARROW_MAGIC:
+            raise ValueError(f"{filepath} is an Arrow IPC file (--arrow); "
+                             f"read it with pyarrow.ipc.open_file or polars.read_ipc")
+        if len(raw) < BINARY_HEADER_SIZE or raw[:4] != BINARY_MAGIC:
+            return None
+        
+        (_, version, header_size, record_size, flags, record_count, created,
+         record_type, schema, params) = struct.unpack(BINARY_HEADER_FORMAT, raw)
+        
+        def text(raw_field: bytes) -> str:
+            return raw_field.split(b'\0', 1)[0].decode('ascii', errors='replace')
+        
+        format_string, _, names = text(schema).partition(';')
+        
+        return cls(
+            version=version,
+            header_size=header_size,
+            record_size=record_size,
+            flags=flags,
+            record_count=record_count,
+            created=created,
+            record_type=text(record_type),
+            format_string=format_string,
+            field_names=names.split(',') if names else [],
+            params=dict(item.split('=', 1) for item in text(params).split() if '=' in item)
+        )
+    
+    @property
+    def blocked(self) -> bool:
+        """True if records are stored in checksummed blocks."""
+        return bool(self.flags & BINARY_FLAG_BLOCKS)
+    
+    @property
+    def columnar(self) -> bool:
+        """True if each block is a column-major row group."""
+        return bool(self.flags & BINARY_FLAG_COLUMNAR)
+    
+    @property
+    def compact(self) -> bool:
+        """True if blocks store text as varint length + bytes."""
+        return bool(self.flags & BINARY_FLAG_COMPACT)
+    
+    @property
+    def packed(self) -> bool:
+        """True if customer records use the packed typed layout."""
+        return bool(self.flags & BINARY_FLAG_PACKED)
+    
+    @property
+    def compressed(self) -> bool:
+        """True if block payloads are LZ4 compressed."""
+        return bool(self.flags & BINARY_FLAG_COMPRESSED)
+    
+    @property
+    def dictionary(self) -> bool:
+        """True if row groups may store text columns as dictionary codes."""
+        return bool(self.flags & BINARY_FLAG_DICTIONARY)
+    
+    def to_schema(self) -> 'RecordSchema':
+        """Builds a RecordSchema from the header's schema descriptor."""
+        byte_order = self.format_string[0] if self.format_string[:1] in '<>=@!' else '<'
+        return create_schema_from_format_string(
+            format_string=self.format_string.lstrip('<>=@!'),
+            field_names=self.field_names,
+            byte_order=byte_order,
+            schema_name=f"{self.record_type} (v{self.version} header)"
+        )
+
+
 @dataclass
 class ValidationRules:
     """
@@ -381,10 +668,52 @@ class BinaryFileReader:
             return False, issues
         
         record_size = self.schema.record_size
+        header = BinaryFileHeader.read(filepath)
+        data_size = file_size
+        count_matches = True
         
-        if file_size % record_size != 0:
-            remainder = file_size % record_size
-            expected_size = (file_size // record_size) * record_size
+        if header is not None:
+            if header.version > BINARY_FORMAT_VERSION:
+                issues.append(f"Unsupported file format version {header.version}")
+                return False, issues
+            if header.flags & ~BINARY_FLAGS_KNOWN:
+                issues.append(f"Unsupported layout flags 0x{header.flags:x}")
+                return False, issues
+            if header.record_size != record_size:
+                issues.append(
+                    f"Header record size ({header.record_size} bytes) does not match "
+                    f"schema record size ({record_size} bytes)"
+                )
+                return False, issues
+            if header.format_string and header.format_string != self.schema.format_string:
+                issues.append(
+                    f"Header schema '{header.format_string}' differs from reader schema "
+                    f"'{self.schema.format_string}'"
+                )
+                self.warnings.append(issues[-1])
+            data_size = file_size - header.header_size
+            if header.blocked:
+                try:
+                    index = read_block_index(filepath)
+                except IOError as e:
+                    issues.append(str(e))
+                    return False, issues
+                # Only whole records are stored in blocks
+                data_size = sum(entry.record_count for entry in index) * record_size
+            if header.record_count == BINARY_COUNT_UNKNOWN:
+                issues.append("Header record count was never finalized (writer did not finish)")
+                self.warnings.append(issues[-1])
+            elif header.record_count * record_size != data_size:
+                issues.append(
+                    f"Header lists {header.record_count} records "
+                    f"({header.record_count * record_size} bytes) but the file holds "
+                    f"{data_size} bytes of records"
+                )
+                count_matches = False
+        
+        if data_size % record_size != 0:
+            remainder = data_size % record_size
+            expected_size = file_size - remainder
             issues.append(
                 f"File size ({file_size} bytes) is not a multiple of record size "
                 f"({record_size} bytes). {remainder} trailing bytes detected. "
@@ -392,7 +721,9 @@ class BinaryFileReader:
             )
             self.warnings.append(issues[-1])
         
-        return len(issues) == 0 or file_size % record_size != 0, issues
+        # A wrong header count means records were lost or never counted; the
+        # other issues above are warnings and the records can still be read
+        return count_matches, issues
     
     def _decode_string_field(
         self, 
@@ -693,6 +1024,276 @@ class BinaryFileReader:
                 raise
             return None
     
+    def _iter_record_bytes(self, f, filepath: Path, header: Optional[BinaryFileHeader],
+                           data_offset: int):
+        """
+        Yields (byte_offset, record_bytes) in file order. Block layout files
+        are read block by block; a block failing its checksum is reported and
+        skipped (raised in STRICT mode) so the other blocks are still read.
+        """
+        record_size = self.schema.record_size
+        
+        if header is None or not header.blocked:
+            f.seek(data_offset)
+            byte_offset = data_offset
+            while True:
+                binary_data = f.read(record_size)
+                if not binary_data:
+                    return
+                yield byte_offset, binary_data
+                byte_offset += record_size
+        
+        block_header_size = struct.calcsize(BLOCK_HEADER_FORMAT)
+        for block_num, entry in enumerate(read_block_index(filepath)):
+            f.seek(entry.offset + block_header_size)
+            payload = f.read(entry.stored_size)
+            
+            if len(payload) != entry.stored_size or crc32c(payload) != entry.crc32c:
+                error_info = {
+                    'block_num': block_num,
+                    'byte_offset': entry.offset,
+                    'error_type': 'block_checksum',
+                    'first_record': entry.first_record,
+                    'record_count': entry.record_count
+                }
+                self.errors.append(error_info)
+                self.logger.error(
+                    f"Block {block_num} at offset {entry.offset}: checksum mismatch, "
+                    f"skipping records {entry.first_record}-"
+                    f"{entry.first_record + entry.record_count - 1}"
+                )
+                if self.error_mode == ErrorHandlingMode.STRICT:
+                    raise IOError(f"Block {block_num} at offset {entry.offset} is corrupt")
+                continue
+            payload = block_payload(header, payload)
+            
+            if header.columnar:
+                # Rows are rebuilt from the columns; offsets point at the row group
+                for row in self._columnar_rows(payload, entry.record_count, header.dictionary):
+                    yield entry.offset, row
+                continue
+            
+            if header.compact:
+                for row in self._compact_rows(payload, entry.record_count):
+                    yield entry.offset, row
+                continue
+            
+            # Offsets of compressed rows can only name their block
+            payload_offset = entry.offset + block_header_size
+            for i in range(entry.record_count):
+                yield (entry.offset if header.compressed else payload_offset + i * record_size,
+                       payload[i * record_size:(i + 1) * record_size])
+    
+    def _column_directory(self, payload: bytes) -> List[Tuple[int, int]]:
+        """(offset, size) of each column in a row group payload, schema order."""
+        entry_size = struct.calcsize(COLUMN_DIRECTORY_ENTRY_FORMAT)
+        return [struct.unpack_from(COLUMN_DIRECTORY_ENTRY_FORMAT, payload, i * entry_size)
+                for i in range(len(self.schema.fields))]
+    
+    def _read_column_bytes(self, f, header: BinaryFileHeader, entry: BlockIndexEntry,
+                           column_num: int) -> bytes:
+        """
+        One column of a row group. Uncompressed files are read at the
+        column's offset; compressed row groups have to be expanded whole.
+        """
+        payload_offset = entry.offset + struct.calcsize(BLOCK_HEADER_FORMAT)
+        entry_size = struct.calcsize(COLUMN_DIRECTORY_ENTRY_FORMAT)
+        
+        if header.compressed:
+            f.seek(payload_offset)
+            payload = block_payload(header, f.read(entry.stored_size))
+            offset, size = struct.unpack_from(COLUMN_DIRECTORY_ENTRY_FORMAT, payload,
+                                              column_num * entry_size)
+            return payload[offset:offset + size]
+        
+        f.seek(payload_offset + column_num * entry_size)
+        offset, size = struct.unpack(COLUMN_DIRECTORY_ENTRY_FORMAT, f.read(entry_size))
+        f.seek(payload_offset + offset)
+        return f.read(size)
+    
+    def _column_codes(self, column: bytes, record_count: int
+                      ) -> Optional[Tuple[List[bytes], List[int]]]:
+        """
+        Splits a dictionary-eligible column into (dictionary, codes), or
+        returns None if the row group stored it plain.
+        """
+        header_size = struct.calcsize(COLUMN_HEADER_FORMAT)
+        encoding, _, entry_count = struct.unpack_from(COLUMN_HEADER_FORMAT, column)
+        if encoding == COLUMN_PLAIN:
+            return None
+        
+        pos = header_size
+        dictionary = []
+        for _ in range(entry_count):
+            length = column[pos]
+            dictionary.append(column[pos + 1:pos + 1 + length])
+            pos += 1 + length
+        code_format = '<%dB' if encoding == COLUMN_CODES8 else '<%dH'
+        codes = list(struct.unpack_from(code_format % record_count, column, pos))
+        return dictionary, codes
+    
+    def _column_values(self, field_def: FieldDefinition, column: bytes, record_count: int,
+                       dictionary: bool) -> List[bytes]:
+        """Fixed-width raw values of one row group column."""
+        width = field_def.get_size()
+        if dictionary and field_def.name in DICTIONARY_FIELDS:
+            coded = self._column_codes(column, record_count)
+            if coded is not None:
+                entries = [value.ljust(width, b'\0') for value in coded[0]]
+                return [entries[code] for code in coded[1]]
+            column = column[struct.calcsize(COLUMN_HEADER_FORMAT):]
+        return [column[i * width:(i + 1) * width] for i in range(record_count)]
+    
+    def _columnar_rows(self, payload: bytes, record_count: int,
+                       dictionary: bool = False) -> List[bytes]:
+        """Transposes a row group payload back into fixed-width rows."""
+        columns = []
+        for field_def, (offset, size) in zip(self.schema.fields, self._column_directory(payload)):
+            columns.append(self._column_values(field_def, payload[offset:offset + size],
+                                               record_count, dictionary))
+        return [b''.join(values) for values in zip(*columns)]
+    
+    def _compact_rows(self, payload: bytes, record_count: int, first_row: int = 0,
+                      limit: Optional[int] = None) -> List[bytes]:
+        """
+        Rebuilds fixed-width rows from a compact payload, starting at
+        first_row (located through the block's offset table).
+        """
+        anchors = (record_count + COMPACT_OFFSET_STRIDE - 1) // COMPACT_OFFSET_STRIDE
+        anchor = first_row // COMPACT_OFFSET_STRIDE
+        pos, = struct.unpack_from('<I', payload, anchor * 4) if anchors else (0,)
+        end = record_count if limit is None else min(record_count, first_row + limit)
+        rows = []
+        
+        for row_num in range(anchor * COMPACT_OFFSET_STRIDE, end):
+            parts = []
+            for field_def in self.schema.fields:
+                if field_def.field_type != FieldType.STRING:
+                    size = field_def.get_size()
+                    parts.append(payload[pos:pos + size])
+                    pos += size
+                    continue
+                length = shift = 0
+                while True:
+                    byte = payload[pos]
+                    pos += 1
+                    length |= (byte & 0x7F) << shift
+                    shift += 7
+                    if not byte & 0x80:
+                        break
+                parts.append(payload[pos:pos + length].ljust(field_def.string_length, b'\0'))
+                pos += length
+            if row_num >= first_row:
+                rows.append(b''.join(parts))
+        return rows
+    
+    def read_record(self, filepath: Union[str, Path], record_num: int) -> Optional[Dict[str, Any]]:
+        """
+        Reads one record (0-based) of a block layout file without scanning
+        the file: the footer index finds the block, and in compact files the
+        block's offset table skips to within COMPACT_OFFSET_STRIDE rows.
+        
+        Returns:
+            The processed record, or None if it is out of range or invalid
+        """
+        filepath = Path(filepath)
+        header = BinaryFileHeader.read(filepath)
+        if header is None or not header.blocked:
+            raise ValueError(f"{filepath} is not a block layout file")
+        
+        for entry in read_block_index(filepath):
+            if entry.first_record <= record_num < entry.first_record + entry.record_count:
+                break
+        else:
+            return None
+        
+        with open(filepath, 'rb') as f:
+            f.seek(entry.offset + struct.calcsize(BLOCK_HEADER_FORMAT))
+            payload = f.read(entry.stored_size)
+        if crc32c(payload) != entry.crc32c:
+            raise IOError(f"Block at offset {entry.offset} is corrupt")
+        payload = block_payload(header, payload)
+        
+        row_num = record_num - entry.first_record
+        if header.compact:
+            row = self._compact_rows(payload, entry.record_count, row_num, 1)[0]
+        elif header.columnar:
+            row = self._columnar_rows(payload, entry.record_count, header.dictionary)[row_num]
+        else:
+            size = self.schema.record_size
+            row = payload[row_num * size:(row_num + 1) * size]
+        return self._process_record(row, record_num + 1, entry.offset)
+    
+    def read_column(self, filepath: Union[str, Path], field_name: str) -> List[Any]:
+        """
+        Reads one field of every record from a columnar file, touching only
+        that column's bytes in each row group (block checksums cover whole
+        payloads, so they are not checked here; use read_file for that).
+        Compressed row groups are expanded whole first.
+        
+        Args:
+            filepath: Path to a file written with --columnar
+            field_name: Schema field to read
+            
+        Returns:
+            List of converted values in record order
+        """
+        filepath = Path(filepath)
+        header = BinaryFileHeader.read(filepath)
+        if header is None or not header.columnar:
+            raise ValueError(f"{filepath} is not a columnar file")
+        
+        field_def = self.schema.get_field(field_name)
+        if field_def is None:
+            raise ValueError(f"Unknown field: {field_name}")
+        column_num = self.schema.field_names.index(field_name)
+        value_format = f"{self.schema.byte_order}{field_def.get_struct_format()}"
+        
+        values = []
+        
+        with open(filepath, 'rb') as f:
+            for entry in read_block_index(filepath):
+                column = self._read_column_bytes(f, header, entry, column_num)
+                raw_values = self._column_values(field_def, column, entry.record_count,
+                                                 header.dictionary)
+                for i, raw in enumerate(raw_values):
+                    raw_value, = struct.unpack(value_format, raw)
+                    values.append(self._convert_field_value(
+                        raw_value, field_def, entry.first_record + i + 1))
+        
+        return values
+    
+    def read_column_codes(self, filepath: Union[str, Path], field_name: str):
+        """
+        Yields (dictionary, codes) per row group for a dictionary-coded
+        column, so group-bys can count integer codes and decode each
+        distinct value once. Row groups that stored the column plain get a
+        dictionary built here, so every row group yields codes.
+        
+        Args:
+            filepath: Path to a file written with --dictionary
+            field_name: One of DICTIONARY_FIELDS
+        """
+        filepath = Path(filepath)
+        header = BinaryFileHeader.read(filepath)
+        if header is None or not header.dictionary or field_name not in DICTIONARY_FIELDS:
+            raise ValueError(f"{field_name} is not dictionary coded in {filepath}")
+        
+        field_def = self.schema.get_field(field_name)
+        column_num = self.schema.field_names.index(field_name)
+        
+        with open(filepath, 'rb') as f:
+            for entry in read_block_index(filepath):
+                column = self._read_column_bytes(f, header, entry, column_num)
+                coded = self._column_codes(column, entry.record_count)
+                if coded is None:
+                    positions: Dict[bytes, int] = {}
+                    codes = [positions.setdefault(raw.split(b'\0', 1)[0], len(positions))
+                             for raw in self._column_values(field_def, column,
+                                                            entry.record_count, True)]
+                    coded = list(positions), codes
+                yield [value.decode('utf-8', errors='replace') for value in coded[0]], coded[1]
+    
     def read_file(
         self,
         filepath: Union[str, Path],
@@ -733,27 +1334,30 @@ class BinaryFileReader:
             for issue in issues:
                 self.logger.warning(issue)
         
-        # Get file statistics
+        # Get file statistics; a header gives the record count directly
         file_size = filepath.stat().st_size
-        expected_records = file_size // self.schema.record_size
+        header = BinaryFileHeader.read(filepath)
+        data_offset = header.header_size if header is not None else 0
+        if header is not None and header.record_count != BINARY_COUNT_UNKNOWN:
+            expected_records = header.record_count
+        else:
+            expected_records = (file_size - data_offset) // self.schema.record_size
         
         self.logger.info(f"File size: {file_size:,} bytes")
+        if header is not None:
+            self.logger.info(
+                f"File header: v{header.version} {header.record_type}, "
+                f"records at offset {data_offset}"
+            )
         self.logger.info(f"Expected records: {expected_records:,}")
         
         records = []
         record_num = 0
-        byte_offset = 0
         
         try:
             with open(filepath, 'rb') as f:
-                while True:
-                    # Read one record's worth of bytes
-                    binary_data = f.read(self.schema.record_size)
-                    
-                    # Check for end of file
-                    if not binary_data:
-                        break
-                    
+                for byte_offset, binary_data in self._iter_record_bytes(
+                        f, filepath, header, data_offset):
                     record_num += 1
                     
                     # Check for incomplete record
@@ -786,8 +1390,6 @@ class BinaryFileReader:
                     if record is not None:
                         records.append(record)
                     
-                    byte_offset += self.schema.record_size
-                    
                     # Log progress for large files
                     if progress_interval > 0 and record_num % progress_interval == 0:
                         self.logger.info(
@@ -4,15 +4,25 @@
  * Purpose: Converts customer data from CSV format to binary format
  *          Production-ready with validation, error handling, and high-volume support
  * 
- * Input:  CSV file (default: data_full\customers.csv)
+ * Input:  CSV file (default: data_full\customers.csv, or transactions.csv
+ *         with --transactions)
  *         Validation rules (optional: validation_rules.txt)
- * Output: Binary file (default: data\customers.binary)
- *         Error log (conversion_errors.log)
+ * Output: Binary file (default: data\customers.binary): a BINARY_HEADER_SIZE
+ *         header (magic "CBIN", version, record size and count, struct
+ *         schema, creation parameters) followed by fixed-size records
+ *         Error sidecar (conversion_errors.bin: line, byte offset, error
+ *         mask and parse code per bad record) and log (conversion_errors.log)
  *         Summary report (conversion_summary.txt)
  * 
  * Features:
  * - Configurable validation rules from external file
+ *   (check_zip_state=1 enables the ZIP prefix / state cross-field rule)
+ * - Phone numbers normalized to XXX-XXX-XXXX (accepts '(555) 123-4567',
+ *   '+1 555.123.4567', ...)
+ * - Emails lowercased; domain verdicts cached (optional domain ID column)
  * - Batch writing for high-volume datasets
+ * - Optional block layout with per-block CRC32C and a footer index, and
+ *   columnar (structure-of-arrays) row groups or compact varint-length rows
  * - Comprehensive error handling and logging
  * - Buffer overflow protection
  * - Memory safety
@@ -25,14 +35,81 @@
  * Platform: Windows
  * 
  * Compilation (Windows with MinGW/MSVC):
- *   gcc -O2 -Wall -Wextra customer_convert_v2.c -o customer_convert_v2.exe
+ *   gcc -O2 -Wall -Wextra customer_convert_v2.c -o customer_convert_v2.exe -lm
  *   cl /O2 /W4 customer_convert_v2.c
+ *   (add -mssse3 / /arch:AVX to enable the SIMD batch date parser)
  * 
  * Usage:
- *   customer_convert_v2.exe [input_csv] [output_binary] [validation_file]
+ *   customer_convert_v2.exe [options] [input_csv] [output_binary] [validation_file]
  *   customer_convert_v2.exe
  *   customer_convert_v2.exe data_full\customers.csv data\customers.binary
  *   customer_convert_v2.exe input.csv output.bin validation_rules.txt
+ *   customer_convert_v2.exe --dedup=keep-first input.csv output.bin
+ *
+ * Options:
+ *   --dedup=POLICY          Duplicate customer_id handling: reject, keep-first,
+ *                           keep-last or off (default: off; customer input only)
+ *   --transactions          Input is transactions.csv (Transaction records)
+ *   --customer-keys=FILE    Customer binary to check transaction customer_id against
+ *   --orphans=FILE          Reject CSV for orphan transactions
+ *                           (default: transaction_orphans.csv)
+ *   --validate-sample=1/N   Fully validate a deterministic 1-in-N sample plus
+ *                           records failing a cheap structural check
+ *   --sample-max-error=R    Sampled error rate that forces full validation
+ *                           (default: 0.01)
+ *   --rejects[=FILE]        Copy rows that were not converted, byte for byte and
+ *                           with the header, to FILE (default: conversion_rejects.csv)
+ *   --error-file=FILE       Binary error sidecar (default: conversion_errors.bin)
+ *   --text-error-log        Also write per-record details to conversion_errors.log
+ *   --decode-errors[=FILE]  Print an error sidecar as text and exit; give the
+ *                           input CSV to show each rejected line
+ *   --log-first=N           Log each error code in full N times (default: 1000)
+ *   --log-sample=1/M        ...then one occurrence in M (default: 1/10000);
+ *                           the error histogram and sidecar always count all
+ *   --no-header             Write bare records (pre-header layout)
+ *   --blocks[=SIZE]         Group records into SIZE blocks (default 1M; K/M
+ *                           suffix) with a CRC32C each and a footer index
+ *   --columnar              Store each block as a row group: every field's
+ *                           values contiguous, behind a column offset
+ *                           directory (implies --blocks)
+ *   --dictionary[=MAX]      In each row group, store name/city/state (and
+ *                           payment method) columns as a dictionary plus
+ *                           8/16-bit codes while they have at most MAX
+ *                           distinct values (default 256; implies --columnar)
+ *   --packed                Store phone, ZIP, registration date and state as
+ *                           uint64/uint32/epoch-day int32/uint8 ordinal
+ *                           (unpacks to the same text; records that would
+ *                           not round-trip are rejected)
+ *   --compact               Store block rows without padding: text as a
+ *                           varint length plus bytes, with a sparse row
+ *                           offset table per block (implies --blocks)
+ *   --compress[=LEVEL]      LZ4-compress each block payload (LEVEL 1..9,
+ *                           default 1: higher searches harder for matches;
+ *                           implies --blocks)
+ *   --compress-threads=N    Compression workers (0 = compress on the writing
+ *                           thread; default one per spare CPU, at most 8)
+ *   --arrow[=dictionary]    Write an Apache Arrow IPC file instead: one record
+ *                           batch per write batch, empty text as null; with
+ *                           =dictionary, name/city/state (payment method)
+ *                           columns are dictionary-encoded
+ *   --sort-by=customer_id   Write records in customer_id order (stable): runs
+ *                           are radix-sorted in memory, spilled beside the
+ *                           output as OUTPUT.sortNNNN and merged
+ *   --sort-memory=SIZE      Memory for sort runs and merge buffers (default
+ *                           256M, at least 1M; K/M/G suffix)
+ *   --shards=N              Partition the output into OUTPUT.shard00 ..
+ *                           OUTPUT.shardNN-1 (2..256 files, each with its
+ *                           own header and record count)
+ *   --shard-by=KEY          hash (default): (uint32)(customer_id * 2654435769)
+ *                           * N >> 32; state: FNV-1a of the state code mod N;
+ *                           range:B1,B2,...: ascending first IDs of shards
+ *                           1.. (N = bounds + 1)
+ *   --verify=FILE           Check a converter output file (header, record
+ *                           count, block checksums) and exit
+ *   --domain-ids            Also write OUTPUT.domain_ids (uint32 email domain
+ *                           ID per record) and OUTPUT.domains.csv (ID -> domain);
+ *                           0 = no valid domain, 4294967295 = valid domain
+ *                           left unassigned once the dictionary is full
  */
 
 #include <stdio.h>
@@ -43,12 +120,83 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
 
-/* Windows-specific includes */
+/* Windows-specific includes (MSVC and MinGW both use the Win32 thread API) */
 #ifdef _WIN32
     #include <direct.h>
     #include <io.h>
     #include <windows.h>
+    #define FSEEK64(f, off, whence) _fseeki64((f), (off), (whence))
+    #define FTELL64(f)              _ftelli64(f)
+    #define FTRUNCATE64(f, size)    _chsize_s(_fileno(f), (size))
+    typedef HANDLE ThreadHandle;
+    typedef DWORD (WINAPI *ThreadEntry)(void *);
+    #define THREAD_RETURN           DWORD WINAPI
+    #define THREAD_RESULT           0
+    #define sleep_ms(ms)            Sleep(ms)
+    typedef SRWLOCK ThreadLock;
+    typedef CONDITION_VARIABLE ThreadCond;
+    #define THREAD_LOCK_INIT        SRWLOCK_INIT
+    #define THREAD_COND_INIT        CONDITION_VARIABLE_INIT
+    #define thread_lock(l)          AcquireSRWLockExclusive(l)
+    #define thread_unlock(l)        ReleaseSRWLockExclusive(l)
+    #define thread_wait(c, l)       SleepConditionVariableSRW((c), (l), INFINITE, 0)
+    #define thread_wake_all(c)      WakeAllConditionVariable(c)
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+    #define FSEEK64(f, off, whence) fseeko((f), (off_t)(off), (whence))
+    #define FTELL64(f)              ((long long)ftello(f))
+    #define FTRUNCATE64(f, size)    ftruncate(fileno(f), (off_t)(size))
+    typedef pthread_t ThreadHandle;
+    typedef void *(*ThreadEntry)(void *);
+    #define THREAD_RETURN           void *
+    #define THREAD_RESULT           NULL
+    static void sleep_ms(int ms) {
+        struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    typedef pthread_mutex_t ThreadLock;
+    typedef pthread_cond_t ThreadCond;
+    #define THREAD_LOCK_INIT        PTHREAD_MUTEX_INITIALIZER
+    #define THREAD_COND_INIT        PTHREAD_COND_INITIALIZER
+    #define thread_lock(l)          pthread_mutex_lock(l)
+    #define thread_unlock(l)        pthread_mutex_unlock(l)
+    #define thread_wait(c, l)       pthread_cond_wait((c), (l))
+    #define thread_wake_all(c)      pthread_cond_broadcast(c)
+#endif
+
+/* 64-bit atomics (MSVC Interlocked, otherwise GCC/Clang builtins incl. MinGW) */
+#ifdef _MSC_VER
+    #define ATOMIC_LOAD(p)          InterlockedOr64((volatile LONG64 *)(p), 0)
+    #define ATOMIC_STORE(p, v)      InterlockedExchange64((volatile LONG64 *)(p), (v))
+    #define ATOMIC_ADD(p, v)        InterlockedExchangeAdd64((volatile LONG64 *)(p), (v))
+    #define ATOMIC_CAS(p, expected, desired) \
+        (InterlockedCompareExchange64((volatile LONG64 *)(p), (desired), (expected)) == (expected))
+#else
+    #define ATOMIC_LOAD(p)          __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define ATOMIC_STORE(p, v)      __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+    #define ATOMIC_ADD(p, v)        __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+    #define ATOMIC_CAS(p, expected, desired) \
+        __atomic_compare_exchange_n((p), &(long long){ (expected) }, (desired), 0, \
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#endif
+
+/* SIMD date kernel (SSSE3: MinGW -mssse3 or -march=native, MSVC /arch:AVX) */
+#if defined(__SSSE3__) || defined(__AVX__)
+    #include <tmmintrin.h>
+#endif
+
+/* Hardware CRC32C for block checksums (SSE4.2: -msse4.2, MSVC /arch:AVX) */
+#if defined(__SSE4_2__) || defined(__AVX__)
+    #include <nmmintrin.h>
+    #define HAVE_HW_CRC32C 1
+    #define CRC32C_IMPL "SSE4.2"
+#else
+    #define CRC32C_IMPL "software"
 #endif
 
 /* Version information */
@@ -64,6 +212,7 @@
 #define MAX_STATE 3
 #define MAX_ZIP_CODE 10
 #define MAX_DATE 11
+#define MAX_PAYMENT_METHOD 20
 #define MAX_LINE 2048
 #define MAX_PATH_LEN 512
 
@@ -73,6 +222,48 @@
 #define CHECKPOINT_INTERVAL 5000
 #define FLUSH_INTERVAL 10000
 
+/* Duplicate detection tuning */
+#define IDSET_DENSE_MIN_BITS    (1u << 24)  /* Always use a bitmap up to 2 MB */
+#define IDSET_DENSE_BITS_PER_ID 64          /* Switch to hashing beyond this */
+#define IDSET_HASH_INITIAL      1024
+#define IDSET_GROW_WORDS        1024        /* Bitmap grows in 8 KB steps... */
+#define IDSET_GROW_SHIFT        3           /* ...or by 1/8, whichever is more */
+
+/* Validation cache tuning (direct-mapped, fixed size) */
+#define VCACHE_SLOTS            1024        /* Power of two */
+#define VCACHE_KEY_MAX          64          /* Longer values bypass the cache */
+
+/* Email domain dictionary (--domain-ids) */
+#define DOMAIN_DICT_INITIAL     1024        /* Slots, power of two */
+#define DOMAIN_DICT_MAX         65536       /* Distinct domains remembered */
+#define DOMAIN_ID_UNASSIGNED    0xFFFFFFFFu /* Valid domain the dictionary could not hold */
+
+/* Sampled validation */
+#define SAMPLE_MIN_RECORDS      100         /* Sample size before fallback can trigger */
+#define SAMPLE_DEFAULT_MAX_ERROR 0.01       /* Fall back above a 1% error rate */
+#define SAMPLE_Z_95             1.96
+
+/* Records parsed ahead so their dates can be decoded together */
+#define DATE_BATCH              8
+
+/*
+ * Phone character classes: one table load per input byte. Digits map to
+ * their value + 1 so that 0 can mean "not allowed in a phone number".
+ */
+#define PHONE_CLASS_INVALID     0
+#define PHONE_CLASS_SEPARATOR   11
+#define PHONE_CLASS_PLUS        12
+#define PHONE_DIGITS            10          /* NANP: area code + 7 digits */
+#define PHONE_COUNTRY_CODE      1
+
+static const unsigned char PHONE_CHAR_CLASS[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    [' '] = PHONE_CLASS_SEPARATOR, ['-'] = PHONE_CLASS_SEPARATOR,
+    ['.'] = PHONE_CLASS_SEPARATOR, ['('] = PHONE_CLASS_SEPARATOR,
+    [')'] = PHONE_CLASS_SEPARATOR, ['+'] = PHONE_CLASS_PLUS
+};
+
 /* Validation error codes */
 #define VAL_OK                  0x0000
 #define VAL_ERR_INVALID_ID      0x0001
@@ -83,6 +274,233 @@
 #define VAL_ERR_INVALID_ZIP     0x0020
 #define VAL_ERR_EMPTY_FIELD     0x0040
 #define VAL_ERR_FIELD_TOO_LONG  0x0080
+#define VAL_ERR_ZIP_STATE       0x0100
+#define VAL_ERR_BITS            9
+
+static const char *const VAL_ERROR_TEXT[VAL_ERR_BITS] = {
+    "Invalid customer ID format",
+    "Invalid email format",
+    "Invalid phone format",
+    "Invalid date format",
+    "Invalid state code",
+    "Invalid zip code",
+    "Empty required field",
+    "Field exceeds maximum length",
+    "ZIP code does not belong to state"
+};
+
+/* Parse / rejection reasons (error sidecar) */
+#define PARSE_OK                    0
+#define PARSE_ERR_INVALID_ID        1
+#define PARSE_ERR_MISSING_FIELDS    2
+#define PARSE_ERR_INVALID_NUMBER    3
+#define PARSE_ERR_DUPLICATE_ID      4
+#define PARSE_ERR_ORPHAN_KEY        5
+#define PARSE_ERR_COUNT             6
+
+/* customers.csv columns, for messages that refer to a field by index */
+static const char *const CSV_FIELD_NAMES[9] = {
+    "Customer ID", "First name", "Last name", "Email", "Phone", 
+    "City name", "State", "Zip code", "Registration date"
+};
+
+static const char *const PARSE_ERROR_TEXT[PARSE_ERR_COUNT] = {
+    "",
+    "Invalid customer ID",
+    "Incomplete record - missing fields",
+    "Invalid numeric field",
+    "Duplicate customer ID",
+    "Customer ID not found in customer keys"
+};
+
+/* Output file header: records start at BINARY_HEADER_SIZE */
+#define BINARY_MAGIC            "CBIN"
+#define BINARY_FORMAT_VERSION   1
+#define BINARY_HEADER_SIZE      512
+#define BINARY_COUNT_UNKNOWN    (-1LL)      /* Header not finalized (crash) */
+#define CUSTOMER_SCHEMA         "<i50s50s100s20s50s3s10s11s;customer_id,first_name," \
+                                "last_name,email,phone,city,state,zip_code,registration_date"
+#define TRANSACTION_SCHEMA      "<iiii11sidd20s;transaction_id,customer_id,product_id," \
+                                "location_id,transaction_date,quantity,unit_price," \
+                                "total_amount,payment_method"
+#define PACKED_CUSTOMER_SCHEMA  "<i50s50s100s50sQIiB;customer_id,first_name,last_name," \
+                                "email,city,phone,zip_code,registration_date,state"
+
+/* Header flags; readers must refuse flags they do not know */
+#define BINARY_FLAG_BLOCKS      0x0001      /* Records in CRC32C blocks + footer index */
+#define BINARY_FLAG_COLUMNAR    0x0002      /* Blocks are column-major row groups */
+#define BINARY_FLAG_COMPACT     0x0004      /* Blocks hold varint-length rows */
+#define BINARY_FLAG_DICTIONARY  0x0008      /* Row groups may dictionary-code text */
+#define BINARY_FLAG_PACKED      0x0010      /* Records are PackedCustomer */
+#define BINARY_FLAG_COMPRESSED  0x0020      /* Block payloads are LZ4 compressed */
+#define BINARY_FLAGS_KNOWN      (BINARY_FLAG_BLOCKS | BINARY_FLAG_COLUMNAR | \
+                                 BINARY_FLAG_COMPACT | BINARY_FLAG_DICTIONARY | \
+                                 BINARY_FLAG_PACKED | BINARY_FLAG_COMPRESSED)
+#define BINARY_FLAGS_VARIABLE   (BINARY_FLAG_COMPACT | BINARY_FLAG_DICTIONARY | \
+                                 BINARY_FLAG_COMPRESSED)    /* Block size depends on content */
+
+/* Block layout (--blocks): whole records per block, never split across two */
+#define BLOCK_DEFAULT_SIZE      (1 << 20)
+#define BLOCK_MIN_SIZE          4096
+#define BLOCK_MAX_SIZE          (256 << 20)
+#define BLOCK_INDEX_MAGIC       "CIDX"
+#define COMPACT_OFFSET_STRIDE   16          /* Rows per offset table entry */
+
+/* Block compression: LZ4 block format, levels trade speed for match search */
+#define COMPRESS_DEFAULT_LEVEL  1           /* Single probe per position */
+#define COMPRESS_MAX_LEVEL      9           /* Up to 256 chained candidates */
+#define COMPRESS_MAX_THREADS    64
+#define BLOCK_JOBS_PER_THREAD   2           /* Blocks in flight per worker */
+#define BLOCK_JOB_FREE          0           /* BlockJob.state values */
+#define BLOCK_JOB_READY         1
+#define BLOCK_JOB_BUSY          2
+#define BLOCK_JOB_DONE          3
+#define LZ_MIN_MATCH            4
+#define LZ_HASH_BITS            16
+#define LZ_MAX_OFFSET           65535
+#define LZ_LAST_LITERALS        5           /* Format: the last 5 bytes are literals */
+#define LZ_MATCH_START_LIMIT    12          /* ...and no match starts in the last 12 */
+#define DICT_DEFAULT_MAX_ENTRIES 256        /* Distinct values before plain fallback */
+#define DICT_MAX_ENTRIES        65535       /* Largest dictionary (16-bit codes) */
+#define COLUMN_PLAIN            0           /* ColumnHeader.encoding values */
+#define COLUMN_CODES8           1
+#define COLUMN_CODES16          2
+
+/* Apache Arrow IPC file (--arrow); numbers from Schema.fbs / Message.fbs */
+#define ARROW_MAGIC             "ARROW1"
+#define ARROW_ALIGNMENT         8           /* Messages and body buffers */
+#define ARROW_CONTINUATION      0xFFFFFFFFu /* Starts every encapsulated message */
+#define ARROW_METADATA_V5       4
+#define ARROW_TYPE_INT          2           /* Type union members */
+#define ARROW_TYPE_FLOAT        3
+#define ARROW_TYPE_UTF8         5
+#define ARROW_PRECISION_DOUBLE  2
+#define ARROW_HEADER_SCHEMA     1           /* MessageHeader union members */
+#define ARROW_HEADER_DICTIONARY 2
+#define ARROW_HEADER_BATCH      3
+#define ARROW_MAX_BUFFERS       (RECORD_FIELD_COUNT * 3)
+
+/* External sort (--sort-by=customer_id) */
+#define SORT_DEFAULT_MEMORY     (256LL << 20)
+#define SORT_MIN_MEMORY         (1LL << 20)
+#define SORT_MAX_FAN_IN         64          /* Runs open at once while merging */
+#define SORT_MIN_READ_BUFFER    (64 << 10)  /* Per run; fewer runs per pass if less */
+#define SORT_RADIX_BITS         8           /* 4 passes over the 32-bit key */
+
+/* Sharded output (--shards) */
+#define SHARD_MAX_COUNT         256
+
+/* PackedCustomer values standing for an empty text field */
+#define PACKED_PHONE_EMPTY      0xFFFFFFFFFFFFFFFFULL
+#define PACKED_ZIP_EMPTY        0xFFFFFFFFu
+#define PACKED_DATE_EMPTY       INT_MIN
+
+/* Binary error sidecar: one fixed-size record per rejected or warned row */
+#define ERROR_SIDECAR_FILE      "conversion_errors.bin"
+#define ERROR_SIDECAR_MAGIC     "CERR"
+#define ERROR_SIDECAR_VERSION   1
+#define ERROR_BUFFER_SIZE       4096
+
+/* Asynchronous logging */
+#define LOG_RING_SIZE           4096        /* Events, power of two */
+#define LOG_EVENT_TEXT          200         /* Inline text / line excerpt */
+#define LOG_IDLE_SLEEP_MS       1
+
+/* Detail logging caps per error code: first N in full, then 1 in M */
+#define LOG_DEFAULT_FIRST       1000
+#define LOG_DEFAULT_SAMPLE      10000
+
+/* Chunked input reader and verbatim rejects file */
+#define INPUT_CHUNK_SIZE        (1 << 20)
+#define REJECT_BATCH            1024
+
+/*
+ * US state / territory code table
+ *
+ * A two-letter code maps to a slot 0..675 ((c0-'A')*26 + (c1-'A')), which is
+ * a perfect hash over all uppercase pairs. Slot STATE_SLOT_INVALID (676)
+ * catches anything that is not two uppercase letters. The table holds a
+ * dense 1-based ordinal (0 = not a valid code) that fits in a uint8 and can
+ * be reused by output formats; STATE_CODES maps it back to text.
+ */
+#define STATE_SLOT(a, b)        ((((a) - 'A') * 26) + ((b) - 'A'))
+#define STATE_SLOT_INVALID      676
+#define STATE_COUNT             62
+
+static const char STATE_CODES[STATE_COUNT + 1][MAX_STATE] = {
+    "",
+    "AL", "AK", "AZ", "AR", "CA", "CO", "CT", "DE", "FL", "GA",
+    "HI", "ID", "IL", "IN", "IA", "KS", "KY", "LA", "ME", "MD",
+    "MA", "MI", "MN", "MS", "MO", "MT", "NE", "NV", "NH", "NJ",
+    "NM", "NY", "NC", "ND", "OH", "OK", "OR", "PA", "RI", "SC",
+    "SD", "TN", "TX", "UT", "VT", "VA", "WA", "WV", "WI", "WY",
+    "DC",                                   /* District of Columbia */
+    "AS", "GU", "MP", "PR", "VI",           /* Inhabited territories */
+    "FM", "MH", "PW",                       /* Freely associated states */
+    "AA", "AE", "AP"                        /* Armed forces */
+};
+
+static const unsigned char STATE_ORDINALS[STATE_SLOT_INVALID + 1] = {
+    [STATE_SLOT('A','L')] = 1,  [STATE_SLOT('A','K')] = 2,  [STATE_SLOT('A','Z')] = 3,
+    [STATE_SLOT('A','R')] = 4,  [STATE_SLOT('C','A')] = 5,  [STATE_SLOT('C','O')] = 6,
+    [STATE_SLOT('C','T')] = 7,  [STATE_SLOT('D','E')] = 8,  [STATE_SLOT('F','L')] = 9,
+    [STATE_SLOT('G','A')] = 10, [STATE_SLOT('H','I')] = 11, [STATE_SLOT('I','D')] = 12,
+    [STATE_SLOT('I','L')] = 13, [STATE_SLOT('I','N')] = 14, [STATE_SLOT('I','A')] = 15,
+    [STATE_SLOT('K','S')] = 16, [STATE_SLOT('K','Y')] = 17, [STATE_SLOT('L','A')] = 18,
+    [STATE_SLOT('M','E')] = 19, [STATE_SLOT('M','D')] = 20, [STATE_SLOT('M','A')] = 21,
+    [STATE_SLOT('M','I')] = 22, [STATE_SLOT('M','N')] = 23, [STATE_SLOT('M','S')] = 24,
+    [STATE_SLOT('M','O')] = 25, [STATE_SLOT('M','T')] = 26, [STATE_SLOT('N','E')] = 27,
+    [STATE_SLOT('N','V')] = 28, [STATE_SLOT('N','H')] = 29, [STATE_SLOT('N','J')] = 30,
+    [STATE_SLOT('N','M')] = 31, [STATE_SLOT('N','Y')] = 32, [STATE_SLOT('N','C')] = 33,
+    [STATE_SLOT('N','D')] = 34, [STATE_SLOT('O','H')] = 35, [STATE_SLOT('O','K')] = 36,
+    [STATE_SLOT('O','R')] = 37, [STATE_SLOT('P','A')] = 38, [STATE_SLOT('R','I')] = 39,
+    [STATE_SLOT('S','C')] = 40, [STATE_SLOT('S','D')] = 41, [STATE_SLOT('T','N')] = 42,
+    [STATE_SLOT('T','X')] = 43, [STATE_SLOT('U','T')] = 44, [STATE_SLOT('V','T')] = 45,
+    [STATE_SLOT('V','A')] = 46, [STATE_SLOT('W','A')] = 47, [STATE_SLOT('W','V')] = 48,
+    [STATE_SLOT('W','I')] = 49, [STATE_SLOT('W','Y')] = 50, [STATE_SLOT('D','C')] = 51,
+    [STATE_SLOT('A','S')] = 52, [STATE_SLOT('G','U')] = 53, [STATE_SLOT('M','P')] = 54,
+    [STATE_SLOT('P','R')] = 55, [STATE_SLOT('V','I')] = 56, [STATE_SLOT('F','M')] = 57,
+    [STATE_SLOT('M','H')] = 58, [STATE_SLOT('P','W')] = 59, [STATE_SLOT('A','A')] = 60,
+    [STATE_SLOT('A','E')] = 61, [STATE_SLOT('A','P')] = 62
+};
+
+/*
+ * ZIP prefix to state table
+ *
+ * The first three digits of a ZIP code (the sectional center) belong to a
+ * single state, so the cross-field check is one load from a 1000-byte table
+ * indexed by the prefix. The table is filled from these USPS ranges at
+ * startup; prefixes not listed are unassigned (0). Prefix 969 is shared by
+ * Guam and the Pacific freely associated states and gets its own marker.
+ */
+#define ZIP_PREFIX_COUNT        1000
+#define ZIP_PREFIX_PACIFIC      0xFF
+
+typedef struct {
+    short first;
+    short last;
+    char state[MAX_STATE];
+} ZipPrefixRange;
+
+static const ZipPrefixRange ZIP_PREFIX_RANGES[] = {
+    {  5,   5, "NY"}, {  6,   7, "PR"}, {  8,   8, "VI"}, {  9,   9, "PR"},
+    { 10,  27, "MA"}, { 28,  29, "RI"}, { 30,  38, "NH"}, { 39,  49, "ME"},
+    { 50,  54, "VT"}, { 55,  55, "MA"}, { 56,  59, "VT"}, { 60,  69, "CT"},
+    { 70,  89, "NJ"}, { 90,  98, "AE"}, {100, 149, "NY"}, {150, 196, "PA"},
+    {197, 199, "DE"}, {200, 200, "DC"}, {201, 201, "VA"}, {202, 205, "DC"},
+    {206, 219, "MD"}, {220, 246, "VA"}, {247, 268, "WV"}, {270, 289, "NC"},
+    {290, 299, "SC"}, {300, 319, "GA"}, {320, 339, "FL"}, {340, 340, "AA"},
+    {341, 349, "FL"}, {350, 369, "AL"}, {370, 385, "TN"}, {386, 397, "MS"},
+    {398, 399, "GA"}, {400, 427, "KY"}, {430, 459, "OH"}, {460, 479, "IN"},
+    {480, 499, "MI"}, {500, 528, "IA"}, {530, 549, "WI"}, {550, 567, "MN"},
+    {569, 569, "DC"}, {570, 577, "SD"}, {580, 588, "ND"}, {590, 599, "MT"},
+    {600, 629, "IL"}, {630, 658, "MO"}, {660, 679, "KS"}, {680, 693, "NE"},
+    {700, 714, "LA"}, {716, 729, "AR"}, {730, 732, "OK"}, {733, 733, "TX"},
+    {734, 749, "OK"}, {750, 799, "TX"}, {800, 816, "CO"}, {820, 831, "WY"},
+    {832, 838, "ID"}, {840, 847, "UT"}, {850, 865, "AZ"}, {870, 884, "NM"},
+    {885, 885, "TX"}, {889, 898, "NV"}, {900, 961, "CA"}, {962, 966, "AP"},
+    {967, 968, "HI"}, {970, 979, "OR"}, {980, 994, "WA"}, {995, 999, "AK"}
+};
 
 /* Log levels */
 typedef enum {
@@ -92,6 +510,37 @@ typedef enum {
     LOG_DEBUG
 } LogLevel;
 
+/*
+ * Log events. Hot-path callers push the event code and a few numbers; the
+ * logging thread turns them into text. LOG_EVT_TEXT carries a message that
+ * was already formatted (log_message while the logger runs).
+ */
+typedef enum {
+    LOG_EVT_TEXT,
+    LOG_EVT_FIELD_TRUNCATED,    /* arg = field index */
+    LOG_EVT_LINE_TOO_LONG,
+    LOG_EVT_RECORD_REJECTED,
+    LOG_EVT_DUPLICATE_DROPPED,  /* arg = customer_id */
+    LOG_EVT_SPECIAL_CHAR,       /* arg = character */
+    LOG_EVT_PARSE_ERROR,        /* Error log; arg = PARSE_ERR_*, text = line */
+    LOG_EVT_VALIDATION,         /* Error log; arg = VAL_ERR_* mask */
+    LOG_EVT_NOT_PACKABLE,       /* arg = field index */
+    LOG_EVT_PROGRESS,           /* text = progress line, written to stdout as-is */
+    LOG_EVT_COUNT
+} LogEventCode;
+
+typedef struct {
+    long long sequence;         /* Ring slot state, see log_push */
+    long long offset;           /* Input byte offset */
+    long long arg;
+    long long timestamp;        /* time_t */
+    int line_number;
+    unsigned char level;
+    unsigned char code;
+    unsigned short text_len;
+    char text[LOG_EVENT_TEXT];
+} LogEvent;
+
 /* Customer structure with explicit padding for consistency */
 #pragma pack(push, 1)
 typedef struct {
@@ -105,8 +554,407 @@ typedef struct {
     char zip_code[MAX_ZIP_CODE];
     char registration_date[MAX_DATE];
 } Customer;
+
+/* Transaction structure (transactions.csv from synthetic_data_generator.py) */
+typedef struct {
+    int transaction_id;
+    int customer_id;
+    int product_id;
+    int location_id;
+    char transaction_date[MAX_DATE];
+    int quantity;
+    double unit_price;
+    double total_amount;
+    char payment_method[MAX_PAYMENT_METHOD];
+} Transaction;
+
+/*
+ * --packed customer record: the validated numeric/enumerated fields as
+ * numbers. Unpacks to the same text (format_phone, %05u, format_date,
+ * state_code).
+ */
+typedef struct {
+    int customer_id;
+    char first_name[MAX_FIRST_NAME];
+    char last_name[MAX_LAST_NAME];
+    char email[MAX_EMAIL];
+    char city[MAX_CITY];
+    unsigned long long phone;       /* 10-digit number or PACKED_PHONE_EMPTY */
+    unsigned int zip_code;          /* 0..99999 or PACKED_ZIP_EMPTY */
+    int registration_date;          /* Days since 1970-01-01 or PACKED_DATE_EMPTY */
+    unsigned char state;            /* state_ordinal(), 0 = empty */
+} PackedCustomer;
+
+/* Output file header (little-endian, BINARY_HEADER_SIZE bytes) */
+typedef struct {
+    char magic[4];                  /* BINARY_MAGIC */
+    unsigned short version;         /* BINARY_FORMAT_VERSION */
+    unsigned short header_size;     /* Offset of the first record */
+    unsigned int record_size;       /* sizeof(Customer) or sizeof(Transaction) */
+    unsigned int flags;             /* BINARY_FLAG_* */
+    long long record_count;         /* Set on close; BINARY_COUNT_UNKNOWN until then */
+    long long created;              /* time_t at conversion start */
+    char record_type[16];           /* "customer" or "transaction" */
+    char schema[224];               /* struct format ';' field names */
+    char params[240];               /* Creation parameters, key=value ... */
+} BinaryFileHeader;
+
+/*
+ * Block layout: [BlockHeader][payload] ... [BlockIndexEntry x N][BlockTrailer].
+ * The trailer is the last sizeof(BlockTrailer) bytes of the file.
+ */
+typedef struct {
+    unsigned int record_count;
+    unsigned int stored_size;       /* Payload bytes following this header */
+    unsigned int raw_size;          /* Payload bytes once decoded */
+    unsigned int crc32c;            /* CRC32C of the stored payload */
+} BlockHeader;
+
+typedef struct {
+    long long offset;               /* File offset of the BlockHeader */
+    long long first_record;         /* Ordinal of the block's first record */
+    unsigned int record_count;
+    unsigned int stored_size;
+    unsigned int raw_size;
+    unsigned int crc32c;
+} BlockIndexEntry;
+
+typedef struct {
+    long long index_offset;         /* File offset of the first BlockIndexEntry */
+    unsigned int block_count;
+    unsigned int index_crc32c;      /* CRC32C of the index entries */
+    char magic[4];                  /* BLOCK_INDEX_MAGIC */
+    unsigned int block_size;        /* Target block size the writer used */
+} BlockTrailer;
+
+/* Compile-time check: the header must stay exactly BINARY_HEADER_SIZE bytes */
+typedef char binary_header_size_check[(sizeof(BinaryFileHeader) == BINARY_HEADER_SIZE) ? 1 : -1];
+
+/* Error sidecar file header and records */
+typedef struct {
+    char magic[4];                  /* ERROR_SIDECAR_MAGIC */
+    unsigned short version;
+    unsigned short record_size;     /* sizeof(ErrorRecord) */
+} ErrorSidecarHeader;
+
+typedef struct {
+    long long byte_offset;          /* Start of the line in the input file */
+    int line_number;
+    unsigned short validation_errors;   /* VAL_ERR_* mask */
+    unsigned char parse_error;          /* PARSE_ERR_* code */
+    unsigned char failed;               /* 1 = counted as a failed record */
+} ErrorRecord;
+/* Columnar row group payload: one entry per field, then the column bytes */
+typedef struct {
+    unsigned int offset;            /* From the start of the payload */
+    unsigned int size;              /* record_count * field size unless coded */
+} ColumnDirectoryEntry;
+
+/*
+ * Leads each FIELD_CATEGORY column of a dictionary row group. Plain: the
+ * values follow. Coded: entry_count x [uint8 length][text], then one 8- or
+ * 16-bit code per row.
+ */
+typedef struct {
+    unsigned char encoding;         /* COLUMN_PLAIN / CODES8 / CODES16 */
+    unsigned char reserved;
+    unsigned short entry_count;
+} ColumnHeader;
 #pragma pack(pop)
 
+/* A field of a fixed-width record; schema order is also column order */
+typedef enum {
+    FIELD_NUMBER,                   /* int / double: copied as is */
+    FIELD_TEXT,                     /* NUL-padded char array */
+    FIELD_CATEGORY                  /* Text from a small vocabulary */
+} FieldKind;
+
+typedef struct {
+    const char *name;
+    unsigned short offset;
+    unsigned short size;
+    unsigned char kind;             /* FieldKind */
+} FieldLayout;
+
+#define RECORD_FIELD_COUNT      9
+#define FIELD_LAYOUT(type, member, kind) \
+    { #member, (unsigned short)offsetof(type, member), \
+      (unsigned short)sizeof(((type *)0)->member), kind }
+
+static const FieldLayout CUSTOMER_FIELDS[RECORD_FIELD_COUNT] = {
+    FIELD_LAYOUT(Customer, customer_id, FIELD_NUMBER),
+    FIELD_LAYOUT(Customer, first_name, FIELD_CATEGORY),
+    FIELD_LAYOUT(Customer, last_name, FIELD_CATEGORY),
+    FIELD_LAYOUT(Customer, email, FIELD_TEXT),
+    FIELD_LAYOUT(Customer, phone, FIELD_TEXT),
+    FIELD_LAYOUT(Customer, city, FIELD_CATEGORY),
+    FIELD_LAYOUT(Customer, state, FIELD_CATEGORY),
+    FIELD_LAYOUT(Customer, zip_code, FIELD_TEXT),
+    FIELD_LAYOUT(Customer, registration_date, FIELD_TEXT)
+};
+
+static const FieldLayout PACKED_CUSTOMER_FIELDS[RECORD_FIELD_COUNT] = {
+    FIELD_LAYOUT(PackedCustomer, customer_id, FIELD_NUMBER),
+    FIELD_LAYOUT(PackedCustomer, first_name, FIELD_CATEGORY),
+    FIELD_LAYOUT(PackedCustomer, last_name, FIELD_CATEGORY),
+    FIELD_LAYOUT(PackedCustomer, email, FIELD_TEXT),
+    FIELD_LAYOUT(PackedCustomer, city, FIELD_CATEGORY),
+    FIELD_LAYOUT(PackedCustomer, phone, FIELD_NUMBER),
+    FIELD_LAYOUT(PackedCustomer, zip_code, FIELD_NUMBER),
+    FIELD_LAYOUT(PackedCustomer, registration_date, FIELD_NUMBER),
+    FIELD_LAYOUT(PackedCustomer, state, FIELD_NUMBER)
+};
+
+static const FieldLayout TRANSACTION_FIELDS[RECORD_FIELD_COUNT] = {
+    FIELD_LAYOUT(Transaction, transaction_id, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, customer_id, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, product_id, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, location_id, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, transaction_date, FIELD_TEXT),
+    FIELD_LAYOUT(Transaction, quantity, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, unit_price, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, total_amount, FIELD_NUMBER),
+    FIELD_LAYOUT(Transaction, payment_method, FIELD_CATEGORY)
+};
+
+/* LZ4 compressor scratch: newest position per hash, distance to the previous */
+typedef struct {
+    int *head;                      /* 1 << LZ_HASH_BITS positions, -1 = none */
+    unsigned short *chain;          /* Indexed by position & LZ_MAX_OFFSET */
+} LzState;
+
+/*
+ * One output block on its way through the compression pool. The stored
+ * payload is [uint32 encoded size][LZ4 block], or [uint32 size][encoded
+ * bytes] when compression would not make it smaller.
+ */
+typedef struct {
+    long long state;                /* BLOCK_JOB_* (atomic) */
+    unsigned char *rows;            /* Records as gathered */
+    unsigned char *encoded;         /* Layout-encoded payload (BlockWriter flags) */
+    unsigned char *stored;
+    unsigned int record_count;
+    unsigned int encoded_size;
+    unsigned int stored_size;
+    unsigned int crc32c;            /* Of the stored payload */
+    long long first_record;
+} BlockJob;
+
+/* Block writer: records are gathered into data until the block is full */
+typedef struct {
+    unsigned char *data;
+    size_t capacity;                /* Whole records that fit the block size */
+    size_t used;
+    size_t record_size;
+    unsigned int flags;             /* Payload encoding (BINARY_FLAG_COLUMNAR) */
+    unsigned char *encoded;         /* Payload when it differs from data */
+    size_t encoded_capacity;
+    long long offset;               /* File offset where the next block goes */
+    long long records;              /* Records handed to the writer so far */
+    BlockIndexEntry *index;
+    int index_count;
+    int index_capacity;
+    int compress_level;             /* 0 = payloads stored as encoded */
+    BlockJob *jobs;                 /* Ring of blocks in flight (data is one's rows) */
+    int job_count;
+    long long submitted;            /* Blocks handed to the pool... */
+    long long retired;              /* ...and written out, in order */
+    LzState lz;                     /* For blocks the writer compresses itself */
+} BlockWriter;
+
+/*
+ * FlatBuffer built front to back: every object is appended after the
+ * fields that refer to it, so references (unsigned, forward) are patched
+ * in with fb_ref once the target exists. Positions are buffer offsets.
+ */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int failed;                     /* Out of memory; contents are unusable */
+} FlatBuilder;
+
+/* A table field for fb_table: a scalar, or a reference filled in by fb_ref */
+typedef struct {
+    int slot;                       /* Field number in the .fbs (unions take two) */
+    int size;                       /* 1, 2, 4 or 8 bytes; references are 4 */
+    long long value;
+} FbField;
+
+/* File.fbs Block: where a message sits, for the footer */
+typedef struct {
+    long long offset;               /* Of the continuation marker */
+    int metadata_length;            /* Marker, length and padded metadata */
+    int padding;
+    long long body_length;
+} ArrowBlock;
+
+/* Body of one record batch being assembled */
+typedef struct {
+    unsigned char *body;
+    size_t size;
+    long long nodes[RECORD_FIELD_COUNT][2];         /* FieldNode: length, null_count */
+    long long buffers[ARROW_MAX_BUFFERS][2];        /* Buffer: offset, length */
+    int node_count;
+    int buffer_count;
+} ArrowBatch;
+
+/* One Arrow column; dictionary columns keep every distinct value seen */
+typedef struct {
+    const FieldLayout *field;
+    char type;                      /* Schema format code: 'i', 'd' or 's' */
+    int dictionary;                 /* Int32 codes into one file-wide dictionary */
+    unsigned char *values;          /* Dictionary text, concatenated */
+    size_t values_size;
+    size_t values_capacity;
+    int *offsets;                   /* entries + 1 offsets into values */
+    int entries;
+    int offsets_capacity;
+    int *slots;                     /* Hash table: entry + 1, 0 = empty */
+    int slot_count;
+} ArrowColumn;
+
+/* One sorted run being read back during a merge */
+typedef struct {
+    FILE *file;
+    unsigned char *buffer;
+    size_t capacity;                /* Bytes, whole records */
+    size_t filled;
+    size_t pos;
+    int done;
+} SortInput;
+
+/*
+ * External sort: records are held in a run until the memory budget is
+ * used, radix-sorted on customer_id and spilled to OUTPUT.sortNNNN; at
+ * the end the runs are merged (several passes if there are more than the
+ * fan-in allows) into the real writer.
+ */
+typedef struct {
+    int active;
+    size_t record_size;
+    size_t key_offset;              /* customer_id within the record */
+    unsigned char *records;         /* Run being filled */
+    size_t run_capacity;            /* Records per run */
+    size_t run_count;
+    unsigned long long *items;      /* (biased key << 32) | position in run */
+    unsigned long long *scratch;
+    char output_file[MAX_PATH_LEN - 16];    /* Room for the .sortNNNN suffix */
+    int *runs;                      /* Ids of run files not yet merged away */
+    int run_count_files;
+    int run_capacity_files;
+    int next_run;
+} ExternalSorter;
+
+/* What picks a record's shard */
+typedef enum {
+    SHARD_BY_DEFAULT,               /* No --shard-by: hash */
+    SHARD_BY_HASH,                  /* Multiplicative hash of customer_id */
+    SHARD_BY_RANGE,                 /* customer_id against ascending bounds */
+    SHARD_BY_STATE                  /* FNV-1a of the state code */
+} ShardKey;
+
+/* One output shard: its own file, batch buffer and record count */
+typedef struct {
+    FILE *file;
+    unsigned char *buffer;          /* WRITE_BUFFER_SIZE records */
+    int buffered;
+    long long records;
+    char path[MAX_PATH_LEN + sizeof(".shard000")];
+} OutputShard;
+
+typedef struct {
+    int count;                      /* 0 = not sharding */
+    size_t record_size;
+    size_t id_offset;
+    size_t state_offset;
+    size_t state_size;              /* 1 = packed state ordinal */
+    OutputShard *shards;
+} ShardWriter;
+
+/* Arrow IPC file writer: one record batch per write batch */
+typedef struct {
+    int active;
+    size_t record_size;
+    const char *schema;             /* CUSTOMER_SCHEMA or TRANSACTION_SCHEMA */
+    ArrowColumn columns[RECORD_FIELD_COUNT];
+    FlatBuilder fb;
+    unsigned char *body;
+    size_t body_capacity;
+    long long offset;               /* File offset of the next message */
+    ArrowBlock *batches;
+    int batch_count;
+    int batch_capacity;
+    ArrowBlock dictionaries[RECORD_FIELD_COUNT];
+    int dictionary_count;
+} ArrowWriter;
+
+/* Sequential record reader over flat or block layout files */
+typedef struct {
+    FILE *file;
+    size_t record_size;             /* As stored in the file */
+    int packed;                     /* Stored as PackedCustomer, read as Customer */
+    int blocked;
+    unsigned int flags;             /* Header flags (payload encoding) */
+    long long end;                  /* Index offset (block layout) */
+    unsigned char *payload;         /* Stored bytes of the current block */
+    size_t payload_capacity;
+    unsigned char *rows;            /* ...decoded to fixed-width records */
+    size_t rows_capacity;
+    unsigned int block_count;       /* Records in the current block */
+    unsigned int block_pos;         /* Next record to hand out */
+    unsigned char *stored;          /* Packed records before unpacking */
+    size_t stored_capacity;
+    unsigned char *inflated;        /* Decompressed payload of the current block */
+    size_t inflated_capacity;
+} RecordReader;
+
+/* Values decoded from a Customer's text fields during validation */
+typedef struct {
+    int registration_days;      /* Days since 1970-01-01 (if date_valid) */
+    unsigned long long phone_number;    /* 10 canonical digits (if phone_valid) */
+    unsigned char date_valid;
+    unsigned char phone_valid;
+    unsigned char email_valid;
+    unsigned int domain_id;             /* --domain-ids: from normalize_email */
+} CustomerDerived;
+
+/* Record parsed and waiting for the batched date decode */
+typedef struct {
+    Customer customer;
+    CustomerDerived derived;
+    int line_number;
+    long long byte_offset;
+    const char *raw;            /* Original bytes in the input chunk */
+    size_t raw_len;
+    int processed_records;      /* stats.processed_records counting this row */
+    int parse_failed;           /* Staged only to be rejected in line order */
+    PackedCustomer packed;      /* --packed: built once from customer and derived */
+    char line[MAX_LINE];
+} StagedRecord;
+
+/*
+ * Input read in large chunks; lines are handed out as pointers into the
+ * chunk so rejected rows can be written back without copying. Pointers stay
+ * valid until the next refill, which only happens when the caller allows it.
+ */
+typedef struct {
+    FILE *file;
+    char *data;
+    size_t capacity;
+    size_t pos;                 /* Next unread byte */
+    size_t end;                 /* Bytes held in data */
+    long long base_offset;      /* File offset of data[0] */
+    int eof;
+    int skipping;               /* Discarding the tail of an over-long line */
+} InputReader;
+
+/* A run of original input bytes queued for the rejects file */
+typedef struct {
+    const char *data;
+    size_t len;
+} ByteSpan;
+
 /* Validation rules structure */
 typedef struct {
     int validate_email;
@@ -116,8 +964,120 @@ typedef struct {
     int validate_zip;
     int allow_empty_fields;
     int strict_mode;
+    int check_zip_state;        /* Cross-field: ZIP prefix must match state */
 } ValidationRules;
 
+/* Duplicate customer_id handling */
+typedef enum {
+    DUP_POLICY_OFF,
+    DUP_POLICY_REJECT,
+    DUP_POLICY_KEEP_FIRST,
+    DUP_POLICY_KEEP_LAST
+} DuplicatePolicy;
+
+/* Command-line options (--name=value) */
+typedef struct {
+    DuplicatePolicy duplicate_policy;
+    int transactions_mode;                      /* Input is transactions.csv */
+    char customer_keys_file[MAX_PATH_LEN];      /* Converted customer binary */
+    int domain_ids;                             /* Write email domain ID sidecars */
+    int no_header;                              /* Legacy headerless output */
+    int block_size;                             /* --blocks target size (0 = flat) */
+    int columnar;                               /* Blocks as column-major row groups */
+    int compact;                                /* Blocks as varint-length rows */
+    int dictionary;                             /* Max dictionary entries (0 = off) */
+    int packed;                                 /* Write PackedCustomer records */
+    int compress_level;                         /* LZ4 block compression (0 = off) */
+    int compress_threads;                       /* Workers (-1 = one per spare CPU) */
+    int arrow;                                  /* Arrow IPC file output */
+    int arrow_dictionary;                       /* ...with dictionary text columns */
+    int sort_by_id;                             /* Output sorted by customer_id */
+    long long sort_memory;                      /* Budget for runs and merge buffers */
+    int shard_count;                            /* Output files (0 = one OUTPUT) */
+    ShardKey shard_by;
+    int shard_bounds[SHARD_MAX_COUNT - 1];      /* --shard-by=range: first ID of shard i+1 */
+    int shard_bound_count;
+    char verify_file[MAX_PATH_LEN];             /* --verify: check a file and exit */
+    char orphans_file[MAX_PATH_LEN];            /* Reject stream for orphan rows */
+    int sample_rate;                            /* Validate 1 in N (0 = all) */
+    double sample_max_error;                    /* Error rate forcing full validation */
+    int text_error_log;                         /* Also write per-record text log */
+    int decode_errors;                          /* Print an error sidecar and exit */
+    char error_sidecar_file[MAX_PATH_LEN];
+    char rejects_file[MAX_PATH_LEN];            /* Verbatim failed rows ("" = off) */
+    long long log_first;                        /* Per-code detail lines in full */
+    long long log_sample;                       /* ...then 1 in this many */
+} ConversionOptions;
+
+/*
+ * Set of 32-bit keys. Starts as a growable bitmap (one bit per key up to the
+ * largest key seen, plus at most 1/8 growth headroom) and switches to an open-addressing hash set once the key
+ * range becomes too sparse for the bitmap to pay off.
+ */
+typedef enum {
+    IDSET_BITMAP,
+    IDSET_HASH
+} IdSetMode;
+
+typedef struct {
+    IdSetMode mode;
+    unsigned long long *bits;   /* Bitmap mode */
+    size_t bit_words;
+    unsigned int *slots;        /* Hash mode; 0 marks an empty slot */
+    size_t slot_count;          /* Power of two */
+    int has_zero;               /* Key 0 is tracked outside the hash table */
+    size_t count;
+} IdSet;
+
+/*
+ * Memoized validation verdicts for low-cardinality values. Direct-mapped:
+ * a slot holds the last value hashed to it, so a collision just costs a
+ * re-validation and memory stays fixed however many distinct values appear.
+ */
+typedef struct {
+    unsigned long long hash;
+    unsigned char len;              /* 0 = empty slot */
+    unsigned char verdict;
+    char key[VCACHE_KEY_MAX];
+} ValidationCacheEntry;
+
+typedef struct {
+    const char *name;
+    long long lookups;
+    long long hits;
+    ValidationCacheEntry entries[VCACHE_SLOTS];
+} ValidationCache;
+
+/*
+ * Email domain dictionary for --domain-ids: valid domains get a dense
+ * 1-based ID in first-seen order (0 = no valid domain), up to
+ * DOMAIN_DICT_MAX of them. Valid domains it cannot hold (dictionary full,
+ * longer than 255 bytes, out of memory) get DOMAIN_ID_UNASSIGNED and are
+ * counted. Names live in one growing arena, slots are open addressed on a
+ * 64-bit hash. Validation itself goes through the cache.
+ */
+typedef struct {
+    unsigned long long hash;
+    unsigned int name_offset;       /* Into DomainDict.names */
+    unsigned int id;
+    unsigned char len;              /* 0 = empty slot */
+    unsigned char valid;
+    long long records;
+} DomainEntry;
+
+typedef struct {
+    DomainEntry *slots;
+    size_t slot_count;              /* Power of two */
+    size_t used;
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+    unsigned int next_id;
+    long long lookups;
+    long long hits;
+    long long unassigned;           /* Records with a valid domain but no ID */
+} DomainDict;
+
 /* Statistics structure */
 typedef struct {
     int total_lines;
@@ -128,22 +1088,135 @@ typedef struct {
     int validation_errors;
     time_t start_time;
     time_t end_time;
+    long long start_ns;             /* Monotonic clock at start */
+    long long end_ns;               /* ...and at the final report */
     long long bytes_written;
+    int duplicate_records;
+    int orphan_records;
+    int sampled_records;            /* Picked by the deterministic sampler */
+    int sampled_errors;             /* ...of which had validation issues */
+    int structural_validations;     /* Validated because the cheap check failed */
+    int unvalidated_records;        /* Skipped full validation */
+    int sample_fallback_line;       /* Line where sampling gave up (0 = never) */
+    int rejected_records;           /* Written to the rejects file */
+    int blocks_written;             /* --blocks: blocks in the output */
+    int record_batches;             /* --arrow: record batches in the output */
+    int sort_runs;                  /* --sort-by: runs spilled to disk */
+    int sort_merge_passes;          /* ...passes over them (the last writes output) */
+    long long sort_spilled_bytes;   /* ...bytes written to run files, all passes */
+    long long packed_rejects;       /* --packed: records that would not round-trip */
+    long long compress_in_bytes;    /* --compress: encoded payload bytes... */
+    long long compress_out_bytes;   /* ...and what was stored for them */
+    long long val_error_counts[VAL_ERR_BITS];       /* Per VAL_ERR_* bit */
+    long long parse_error_counts[PARSE_ERR_COUNT];  /* Per PARSE_ERR_* code */
+    long long log_event_counts[LOG_EVT_COUNT];      /* Hot-path messages seen */
+    long long log_suppressed;                       /* Detail lines sampled away */
+    int zip_state_mismatches;
 } ConversionStats;
 
+/*
+ * Bounded lock-free event ring (Vyukov style: each slot's sequence says
+ * whether it is free for the producer at that position or ready for the
+ * consumer). Any thread may push; only the logging thread pops. A full ring
+ * drops the event and counts it instead of waiting.
+ */
+static LogEvent log_ring[LOG_RING_SIZE];
+static long long log_head = 0;              /* Next position to claim */
+static long long log_tail = 0;              /* Next position to consume */
+static long long log_dropped = 0;
+static long long log_stop_requested = 0;
+static int log_running = 0;
+static ThreadHandle log_thread;
+
+/*
+ * Coarse clock: the monotonic clock is read once per batch (clock_tick) and
+ * the wall-clock text used in log lines is re-formatted at most once a second.
+ * Owned by the conversion thread; the logging thread keeps its own text.
+ */
+static long long clock_now_ns = 0;          /* Monotonic time at the last tick */
+static time_t clock_wall_seconds = 0;       /* Wall clock at the last tick */
+static char clock_stamp[26] = "";           /* ctime() text of clock_wall_seconds */
+
 /* Global variables */
 static FILE *error_log = NULL;
 static FILE *debug_log = NULL;
 static LogLevel current_log_level = LOG_INFO;
 static ValidationRules validation_rules;
 static ConversionStats stats;
+static ConversionOptions options;
+static IdSet seen_ids;
+static unsigned char zip_prefix_states[ZIP_PREFIX_COUNT];
+
+/* Only the conversion thread validates, so caches need no locking */
+static ValidationCache email_domain_cache = { "Email domain", 0, 0, {{0}} };
+static DomainDict email_domains;
+static FILE *domain_id_file = NULL;         /* uint32 domain ID per output record */
+
+/* Error sidecar batch writer; offset of the record being processed */
+static FILE *error_sidecar = NULL;
+static ErrorRecord error_records[ERROR_BUFFER_SIZE];
+static int error_record_count = 0;
+static long long error_records_written = 0;
+static long long current_record_offset = 0;
+
+/* Rejects file: spans point into the input chunk until the next refill */
+static FILE *rejects_file = NULL;
+static ByteSpan reject_spans[REJECT_BATCH];
+static int reject_span_count = 0;
+
+/* Header of the output being written; rewritten with the count on close */
+static BinaryFileHeader output_header;
+static BlockWriter block_writer;
+static ArrowWriter arrow_writer;
+static ExternalSorter sorter;
+static ShardWriter shard_writer;
+
+/* Compression workers; they take BLOCK_JOB_READY blocks from block_writer.jobs */
+static ThreadHandle compress_threads[COMPRESS_MAX_THREADS];
+static int compress_thread_count = 0;
+static long long compress_stop = 0;
+/* Job state changes are atomic; the lock only orders sleeps against wake-ups */
+static ThreadLock compress_lock = THREAD_LOCK_INIT;
+static ThreadCond compress_ready = THREAD_COND_INIT;   /* a job became READY, or stop */
+static ThreadCond compress_done = THREAD_COND_INIT;    /* a job became DONE */
+static unsigned int crc32c_table[256];
+
+/* keep-last: replacements for records that were already flushed */
+static Customer *pending_replacements = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
 
 /* Function prototypes */
 void init_globals(void);
 void cleanup_globals(void);
 void log_message(LogLevel level, const char *format, ...);
-void log_parse_error(int line_num, const char *line, const char *reason);
-void log_validation_warning(int line_num, int error_code);
+long long clock_monotonic_ns(void);
+void clock_init(void);
+void clock_tick(void);
+const char* format_timestamp(time_t when, time_t *cached_when, char *text);
+int thread_start(ThreadHandle *thread, ThreadEntry entry, void *arg);
+void thread_join(ThreadHandle thread);
+void log_start(void);
+void log_stop(void);
+LogEvent* log_claim(LogLevel level, LogEventCode code, int line_num);
+void log_publish(LogEvent *event);
+void log_event(LogLevel level, LogEventCode code, int line_num, long long arg);
+int open_error_sidecar(const char *filename);
+int flush_error_records(void);
+void close_error_sidecar(void);
+int input_reader_open(InputReader *reader, FILE *file);
+void input_reader_close(InputReader *reader);
+const char* input_reader_next_line(InputReader *reader, size_t *len, int may_refill);
+int open_rejects_file(const char *filename);
+void reject_record(const char *data, size_t len);
+int flush_rejects(void);
+void close_rejects_file(void);
+int log_sample_admits(long long occurrence);
+int record_error(int line_num, int validation_errors, int parse_error, int failed);
+void describe_record_errors(FILE *out, int validation_errors, int parse_error);
+int decode_error_sidecar(const char *filename, const char *input_file);
+void log_parse_error(int line_num, const char *line, int parse_error);
+void log_validation_warning(int line_num, int error_code, int failed);
 int create_directory(const char *path);
 char* trim_whitespace(char *str);
 char* secure_strncpy(char *dest, const char *src, size_t dest_size);
@@ -151,18 +1224,119 @@ int safe_atoi(const char *str, int *value);
 void sanitize_input(char *str);
 int load_validation_rules(const char *filename, ValidationRules *rules);
 int validate_customer_id(const char *str);
+unsigned long long hash_bytes(const char *data, size_t len);
+int vcache_lookup(ValidationCache *cache, const char *key, size_t len, 
+                  unsigned long long hash);
+void vcache_store(ValidationCache *cache, const char *key, size_t len, 
+                  unsigned long long hash, int verdict);
+void domain_dict_init(DomainDict *dict);
+void domain_dict_free(DomainDict *dict);
+int validate_email_domain(const char *domain, size_t len);
+unsigned int domain_dict_intern(DomainDict *dict, const char *domain, size_t len, 
+                                int *valid);
+unsigned int email_domain_id(const char *email);
+int normalize_email(char *email, unsigned int *domain_id);
 int validate_email(const char *email);
+int write_domain_dictionary(const char *filename);
+int parse_phone(const char *phone, unsigned long long *number);
+void format_phone(unsigned long long number, char *phone);
+int normalize_phone(char *phone, unsigned long long *number);
 int validate_phone(const char *phone);
+int calendar_to_epoch_days(int year, int month, int day, int *epoch_days);
+int parse_date(const char *date, int *epoch_days);
+unsigned int parse_dates_x8(const char *const *dates, int count, int *epoch_days);
 int validate_date(const char *date);
+int state_ordinal(const char *state);
+const char* state_code(int ordinal);
+void format_date(int epoch_days, char *date);
+int pack_customer(const Customer *customer, const CustomerDerived *derived, 
+                  PackedCustomer *packed);
+void unpack_customer(const PackedCustomer *packed, Customer *customer);
 int validate_state(const char *state);
 int validate_zip(const char *zip);
-int validate_customer(Customer *customer, int line_num);
+void init_zip_prefix_table(void);
+int validate_zip_state(const char *zip, const char *state);
+int validate_customer(Customer *customer, const CustomerDerived *derived, int line_num, 
+                      int *error_code_out);
+int structural_check(const Customer *customer);
+int sample_selects(int line_num);
+void wilson_interval(int errors, int n, double *low, double *high);
+int validate_sampled(Customer *customer, const CustomerDerived *derived, int line_num);
+void decode_staged_dates(StagedRecord *staged, int count);
+char* next_csv_field(char **cursor, char *field_buffer);
 int parse_csv_line(char *line, Customer *customer, int line_num);
-int write_batch(FILE *binary, Customer *buffer, int count);
-void save_checkpoint(int records_processed);
-int load_checkpoint(void);
+int idset_init(IdSet *set);
+void idset_free(IdSet *set);
+int idset_contains(const IdSet *set, unsigned int key);
+int idset_insert(IdSet *set, unsigned int key);
+size_t idset_memory_bytes(const IdSet *set);
+int check_duplicate(const StagedRecord *record, Customer *buffer, 
+                    unsigned int *buffer_domain_ids, PackedCustomer *buffer_packed, 
+                    int buffer_count);
+int apply_pending_replacements(const char *output_file);
+int parse_option(const char *arg);
+const char* duplicate_policy_name(DuplicatePolicy policy);
+int write_file_header(FILE *binary, size_t record_size);
+int finalize_file_header(FILE *binary, long long record_count);
+long long read_file_header(FILE *f, const char *filename, size_t record_size, 
+                           BinaryFileHeader *header);
+void init_crc32c_table(void);
+unsigned int crc32c(unsigned int crc, const void *data, size_t len);
+int ensure_capacity(unsigned char **buffer, size_t *capacity, size_t needed);
+const FieldLayout* record_layout(size_t record_size);
+size_t encoded_block_bound(unsigned int flags, size_t record_size, unsigned int count);
+size_t encode_block(unsigned int flags, size_t record_size, const unsigned char *rows, 
+                    unsigned int count, unsigned char *out);
+int decode_block(unsigned int flags, size_t record_size, const unsigned char *payload, 
+                 size_t payload_size, unsigned int count, unsigned char *rows);
+int cpu_count(void);
+size_t lz_bound(size_t size);
+int lz_state_init(LzState *lz);
+void lz_state_free(LzState *lz);
+size_t lz_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity, 
+                   int level, LzState *lz);
+size_t lz_decompress(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity);
+int block_writer_open(FILE *binary, size_t record_size);
+int block_write_records(FILE *binary, const void *records, int count);
+int block_writer_close(FILE *binary);
+void block_writer_free(void);
+int arrow_writer_open(FILE *binary, size_t record_size);
+int arrow_write_batch(FILE *binary, const void *records, int count);
+int arrow_writer_close(FILE *binary);
+void arrow_writer_free(void);
+int sort_open(const char *output_file, size_t record_size);
+int sort_add_records(const void *records, int count);
+int sort_finish(FILE *binary);
+void sort_free(void);
+const char* shard_key_name(ShardKey key);
+int shard_writer_open(const char *output_file, size_t record_size);
+int shard_write_records(const void *records, int count);
+int shard_writer_close(void);
+void shard_writer_free(void);
+int read_block_index(FILE *f, const char *filename, BlockTrailer *trailer, 
+                     BlockIndexEntry **index);
+int record_reader_open(RecordReader *reader, FILE *f, const char *filename, 
+                       size_t record_size, long long *record_count);
+size_t record_reader_read(RecordReader *reader, void *buffer, size_t max_records);
+void record_reader_close(RecordReader *reader);
+int verify_binary_file(const char *filename);
+int write_records(FILE *binary, const void *buffer, size_t record_size, int count);
+int write_customers(FILE *binary, const Customer *buffer, int count);
+int write_batch(FILE *binary, const Customer *buffer, const PackedCustomer *packed, 
+                const unsigned int *domain_ids, int count);
+size_t output_record_size(void);
+int safe_atod(const char *str, double *value);
+int parse_transaction_line(char *line, Transaction *txn, int line_num);
+int validate_transaction(Transaction *txn, int line_num);
+int load_customer_keys(const char *filename, IdSet *keys);
+int convert_transactions(InputReader *reader, FILE *binary_file, int total_estimate);
+int checkpoint_supported(void);
+void save_checkpoint(int records_processed, int records_written);
+int load_checkpoint(int *records_written);
+FILE* open_resumed_output(const char *output_file, int records_written);
 void print_progress(int records, int total_estimate);
 void print_summary_report(const char *input_file, const char *output_file);
+void write_error_histogram(FILE *out, const char *indent);
 int save_summary_report(const char *input_file, const char *output_file);
 
 /*
@@ -171,7 +1345,9 @@ int save_summary_report(const char *input_file, const char *output_file);
  */
 void init_globals(void) {
     memset(&stats, 0, sizeof(ConversionStats));
-    stats.start_time = time(NULL);
+    clock_init();
+    stats.start_time = clock_wall_seconds;
+    stats.start_ns = clock_now_ns;
     
     /* Default validation rules */
     validation_rules.validate_email = 1;
@@ -181,6 +1357,22 @@ void init_globals(void) {
     validation_rules.validate_zip = 1;
     validation_rules.allow_empty_fields = 0;
     validation_rules.strict_mode = 1;
+    validation_rules.check_zip_state = 0;
+    init_zip_prefix_table();
+    init_crc32c_table();
+    
+    /* Default options */
+    memset(&options, 0, sizeof(ConversionOptions));
+    options.duplicate_policy = DUP_POLICY_OFF;
+    secure_strncpy(options.orphans_file, "transaction_orphans.csv", MAX_PATH_LEN);
+    options.sample_max_error = SAMPLE_DEFAULT_MAX_ERROR;
+    options.log_first = LOG_DEFAULT_FIRST;
+    options.log_sample = LOG_DEFAULT_SAMPLE;
+    options.compress_threads = -1;
+    options.sort_memory = SORT_DEFAULT_MEMORY;
+    secure_strncpy(options.error_sidecar_file, ERROR_SIDECAR_FILE, MAX_PATH_LEN);
+    idset_init(&seen_ids);
+    domain_dict_init(&email_domains);
     
     /* Open log files */
     error_log = fopen("conversion_errors.log", "w");
@@ -207,6 +1399,19 @@ void init_globals(void) {
  * Description: Clean up global resources
  */
 void cleanup_globals(void) {
+    log_stop();
+    close_error_sidecar();
+    close_rejects_file();
+    idset_free(&seen_ids);
+    domain_dict_free(&email_domains);
+    free(pending_replacements);
+    pending_replacements = NULL;
+    block_writer_free();
+    arrow_writer_free();
+    sort_free();
+    shard_writer_free();
+    pending_count = pending_capacity = 0;
+    
     if (error_log != NULL) {
         fclose(error_log);
         error_log = NULL;
@@ -219,720 +1424,5809 @@ void cleanup_globals(void) {
 }
 
 /*
- * Function: log_message
- * Description: Log a message with specified level
+ * Function: clock_monotonic_ns
+ * Description: Monotonic clock in nanoseconds (QueryPerformanceCounter on
+ *              Windows, CLOCK_MONOTONIC elsewhere)
  */
-void log_message(LogLevel level, const char *format, ...) {
-    if (level > current_log_level) return;
-    
-    const char *level_str[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
-    FILE *output = (level == LOG_ERROR) ? stderr : stdout;
-    
-    va_list args;
-    va_start(args, format);
-    
-    fprintf(output, "[%s] ", level_str[level]);
-    vfprintf(output, format, args);
-    fprintf(output, "\n");
-    
-    va_end(args);
-    
-    /* Also log to debug file if available */
-    if (debug_log != NULL && level <= LOG_DEBUG) {
-        va_start(args, format);
-        fprintf(debug_log, "[%s] ", level_str[level]);
-        vfprintf(debug_log, format, args);
-        fprintf(debug_log, "\n");
-        fflush(debug_log);
-        va_end(args);
-    }
+long long clock_monotonic_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    /* Split the division so counter * 1e9 cannot overflow */
+    return (counter.QuadPart / frequency.QuadPart) * 1000000000LL +
+           (counter.QuadPart % frequency.QuadPart) * 1000000000LL / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
 }
 
 /*
- * Function: log_parse_error
- * Description: Log a parsing error with context
+ * Function: format_timestamp
+ * Description: ctime() text (without newline) for when, re-formatted only
+ *              when the second differs from *cached_when
  */
-void log_parse_error(int line_num, const char *line, const char *reason) {
-    if (error_log == NULL) return;
-    
-    time_t now = time(NULL);
-    char time_str[26];
-    ctime_s(time_str, sizeof(time_str), &now);
-    
-    /* Remove newline from ctime */
-    time_str[24] = '\0';
-    
-    fprintf(error_log, "[%s] Line %d: %s\n", time_str, line_num, reason);
-    
-    /* Sanitize line before logging (remove control characters) */
-    char sanitized[MAX_LINE];
-    int j = 0;
-    for (int i = 0; i < (int)strlen(line) && i < MAX_LINE - 1 && j < MAX_LINE - 1; i++) {
-        if (isprint((unsigned char)line[i]) || line[i] == ' ') {
-            sanitized[j++] = line[i];
-        }
+const char* format_timestamp(time_t when, time_t *cached_when, char *text) {
+    if (when != *cached_when || text[0] == '\0') {
+        ctime_s(text, 26, &when);
+        text[24] = '\0';
+        *cached_when = when;
     }
-    sanitized[j] = '\0';
-    
-    fprintf(error_log, "  Content: %s\n\n", sanitized);
-    fflush(error_log);
+    return text;
 }
 
 /*
- * Function: log_validation_warning
- * Description: Log validation warnings
+ * Function: clock_init
+ * Description: Anchor the coarse clock to the wall clock once
  */
-void log_validation_warning(int line_num, int error_code) {
-    if (error_log == NULL) return;
-    
-    fprintf(error_log, "Line %d - Validation warnings:\n", line_num);
+void clock_init(void) {
+    time_t formatted = 0;
     
-    if (error_code & VAL_ERR_INVALID_ID)
-        fprintf(error_log, "  - Invalid customer ID format\n");
-    if (error_code & VAL_ERR_INVALID_EMAIL)
-        fprintf(error_log, "  - Invalid email format\n");
-    if (error_code & VAL_ERR_INVALID_PHONE)
-        fprintf(error_log, "  - Invalid phone format\n");
-    if (error_code & VAL_ERR_INVALID_DATE)
-        fprintf(error_log, "  - Invalid date format\n");
-    if (error_code & VAL_ERR_INVALID_STATE)
-        fprintf(error_log, "  - Invalid state code\n");
-    if (error_code & VAL_ERR_INVALID_ZIP)
-        fprintf(error_log, "  - Invalid zip code\n");
-    if (error_code & VAL_ERR_EMPTY_FIELD)
-        fprintf(error_log, "  - Empty required field\n");
-    if (error_code & VAL_ERR_FIELD_TOO_LONG)
-        fprintf(error_log, "  - Field exceeds maximum length\n");
+    clock_wall_seconds = time(NULL);
+    clock_now_ns = clock_monotonic_ns();
+    clock_stamp[0] = '\0';
+    format_timestamp(clock_wall_seconds, &formatted, clock_stamp);
+}
+
+/*
+ * Function: clock_tick
+ * Description: Batch boundary: read the monotonic clock and advance the
+ *              wall-clock text if a new second has started
+ */
+void clock_tick(void) {
+    static time_t formatted = 0;
     
-    fprintf(error_log, "\n");
-    fflush(error_log);
+    clock_now_ns = clock_monotonic_ns();
+    clock_wall_seconds = stats.start_time + 
+                         (time_t)((clock_now_ns - stats.start_ns) / 1000000000LL);
+    format_timestamp(clock_wall_seconds, &formatted, clock_stamp);
 }
 
 /*
- * Function: create_directory
- * Description: Creates a directory if it doesn't exist (Windows)
+ * Function: thread_start
+ * Description: Start a native thread running entry(arg)
  */
-int create_directory(const char *path) {
-    struct _stat st = {0};
+int thread_start(ThreadHandle *thread, ThreadEntry entry, void *arg) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, entry, arg, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, entry, arg) == 0;
+#endif
+}
+
+/*
+ * Function: thread_join
+ * Description: Wait for a thread started with thread_start
+ */
+void thread_join(ThreadHandle thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+/*
+ * Function: log_claim
+ * Description: Reserve the next ring slot, or return NULL (and count a drop)
+ *              if the ring is full. Fill the slot, then log_publish it.
+ */
+LogEvent* log_claim(LogLevel level, LogEventCode code, int line_num) {
+    long long pos = ATOMIC_LOAD(&log_head);
+    LogEvent *event;
     
-    if (_stat(path, &st) == -1) {
-        if (_mkdir(path) != 0) {
-            log_message(LOG_ERROR, "Failed to create directory '%s': %s", 
-                       path, strerror(errno));
-            return -1;
+    for (;;) {
+        long long seq;
+        
+        event = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        seq = ATOMIC_LOAD(&event->sequence);
+        
+        if (seq == pos) {
+            if (ATOMIC_CAS(&log_head, pos, pos + 1)) break;
+            pos = ATOMIC_LOAD(&log_head);
+        } else if (seq < pos) {
+            /* Consumer hasn't freed this slot yet: ring is full */
+            ATOMIC_ADD(&log_dropped, 1);
+            return NULL;
+        } else {
+            pos = ATOMIC_LOAD(&log_head);
         }
-        log_message(LOG_INFO, "Created directory: %s", path);
     }
     
-    return 0;
+    event->level = (unsigned char)level;
+    event->code = (unsigned char)code;
+    event->line_number = line_num;
+    event->offset = current_record_offset;
+    event->arg = 0;
+    event->timestamp = 0;
+    event->text_len = 0;
+    return event;
 }
 
 /*
- * Function: trim_whitespace
- * Description: Removes leading and trailing whitespace
+ * Function: log_publish
+ * Description: Hand a claimed slot to the logging thread
  */
-char* trim_whitespace(char *str) {
-    char *end;
-    
+void log_publish(LogEvent *event) {
+    long long pos = event->sequence;
+    ATOMIC_STORE(&event->sequence, pos + 1);
+}
+
+/*
+ * Function: log_event
+ * Description: Log a coded hot-path event (no formatting on this thread)
+ */
+void log_event(LogLevel level, LogEventCode code, int line_num, long long arg) {
+    LogEvent *event;
+    
+    if (level > current_log_level) return;
+    if (!log_sample_admits(++stats.log_event_counts[code])) {
+        stats.log_suppressed++;
+        return;
+    }
+    
+    if (!log_running) {
+        /* Not started yet (or already stopped): format right here */
+        switch (code) {
+            case LOG_EVT_FIELD_TRUNCATED:
+                log_message(level, "Line %d: %s truncated", line_num, CSV_FIELD_NAMES[arg]);
+                break;
+            case LOG_EVT_LINE_TOO_LONG:
+                log_message(level, "Line %d exceeds maximum length, may be truncated", line_num);
+                break;
+            case LOG_EVT_RECORD_REJECTED:
+                log_message(level, "Line %d: Record failed validation (strict mode)", line_num);
+                break;
+            case LOG_EVT_DUPLICATE_DROPPED:
+                log_message(level, "Line %d: Duplicate customer ID %lld dropped", line_num, arg);
+                break;
+            case LOG_EVT_SPECIAL_CHAR:
+                log_message(level, "Special character found in input: %c", (int)arg);
+                break;
+            case LOG_EVT_NOT_PACKABLE:
+                log_message(level, "Line %d: %s cannot be stored packed; record rejected", 
+                           line_num, CSV_FIELD_NAMES[arg]);
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+    
+    event = log_claim(level, code, line_num);
+    if (event == NULL) return;
+    event->arg = arg;
+    log_publish(event);
+}
+
+/*
+ * Function: log_write_event
+ * Description: Logging thread: format one event to its destinations
+ */
+static void log_write_event(const LogEvent *event) {
+    static const char *const level_str[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
+    char message[LOG_EVENT_TEXT + 128];
+    FILE *output;
+    
+    switch (event->code) {
+        case LOG_EVT_PARSE_ERROR: {
+            static time_t stamp_seconds = 0;
+            static char stamp[26] = "";
+            const char *time_str = format_timestamp((time_t)event->timestamp, 
+                                                    &stamp_seconds, stamp);
+            char sanitized[LOG_EVENT_TEXT + 1];
+            int j = 0;
+            
+            if (error_log == NULL) return;
+            
+            /* Sanitize line before logging (remove control characters) */
+            for (int i = 0; i < event->text_len; i++) {
+                if (isprint((unsigned char)event->text[i])) sanitized[j++] = event->text[i];
+            }
+            sanitized[j] = '\0';
+            
+            fprintf(error_log, "[%s] Line %d: %s\n", time_str, event->line_number, 
+                    PARSE_ERROR_TEXT[event->arg]);
+            fprintf(error_log, "  Content: %s\n\n", sanitized);
+            return;
+        }
+        case LOG_EVT_VALIDATION:
+            if (error_log == NULL) return;
+            fprintf(error_log, "Line %d - Validation warnings:\n", event->line_number);
+            describe_record_errors(error_log, (int)event->arg, PARSE_OK);
+            fprintf(error_log, "\n");
+            return;
+        case LOG_EVT_TEXT:
+            snprintf(message, sizeof(message), "%.*s", (int)event->text_len, event->text);
+            break;
+        case LOG_EVT_PROGRESS:
+            fwrite(event->text, 1, event->text_len, stdout);
+            return;
+        case LOG_EVT_FIELD_TRUNCATED:
+            snprintf(message, sizeof(message), "Line %d: %s truncated", 
+                     event->line_number, CSV_FIELD_NAMES[event->arg]);
+            break;
+        case LOG_EVT_LINE_TOO_LONG:
+            snprintf(message, sizeof(message), 
+                     "Line %d exceeds maximum length, may be truncated", event->line_number);
+            break;
+        case LOG_EVT_RECORD_REJECTED:
+            snprintf(message, sizeof(message), 
+                     "Line %d: Record failed validation (strict mode)", event->line_number);
+            break;
+        case LOG_EVT_DUPLICATE_DROPPED:
+            snprintf(message, sizeof(message), "Line %d: Duplicate customer ID %lld dropped", 
+                     event->line_number, event->arg);
+            break;
+        case LOG_EVT_SPECIAL_CHAR:
+            snprintf(message, sizeof(message), "Special character found in input: %c", 
+                     (int)event->arg);
+            break;
+        case LOG_EVT_NOT_PACKABLE:
+            snprintf(message, sizeof(message), 
+                     "Line %d: %s cannot be stored packed; record rejected", 
+                     event->line_number, CSV_FIELD_NAMES[event->arg]);
+            break;
+        default:
+            return;
+    }
+    
+    output = (event->level == LOG_ERROR) ? stderr : stdout;
+    fprintf(output, "[%s] %s\n", level_str[event->level], message);
+    if (debug_log != NULL) {
+        fprintf(debug_log, "[%s] %s\n", level_str[event->level], message);
+    }
+}
+
+/*
+ * Function: log_drain
+ * Description: Logging thread: write every ready event, then flush once
+ */
+static int log_drain(void) {
+    int count = 0;
+    
+    for (;;) {
+        LogEvent *event = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+        if (ATOMIC_LOAD(&event->sequence) != log_tail + 1) break;
+        
+        log_write_event(event);
+        
+        /* Free the slot for the producer one lap ahead */
+        ATOMIC_STORE(&event->sequence, log_tail + LOG_RING_SIZE);
+        log_tail++;
+        count++;
+    }
+    
+    if (count > 0) {
+        fflush(stdout);
+        fflush(stderr);
+        if (error_log != NULL) fflush(error_log);
+        if (debug_log != NULL) fflush(debug_log);
+    }
+    return count;
+}
+
+/*
+ * Function: log_thread_main
+ * Description: Logging thread: drain the ring, sleep briefly when idle
+ */
+static THREAD_RETURN log_thread_main(void *arg) {
+    (void)arg;
+    
+    for (;;) {
+        if (log_drain() > 0) continue;
+        if (ATOMIC_LOAD(&log_stop_requested)) {
+            log_drain();
+            break;
+        }
+        sleep_ms(LOG_IDLE_SLEEP_MS);
+    }
+    return THREAD_RESULT;
+}
+
+/*
+ * Function: log_start
+ * Description: Start the logging thread; until then logging is synchronous
+ */
+void log_start(void) {
+    if (log_running) return;
+    
+    for (long long i = 0; i < LOG_RING_SIZE; i++) {
+        log_ring[i].sequence = i;
+    }
+    log_head = log_tail = 0;
+    log_stop_requested = 0;
+    
+    if (!thread_start(&log_thread, log_thread_main, NULL)) {
+        log_message(LOG_WARNING, "Could not start logging thread, logging synchronously");
+        return;
+    }
+    log_running = 1;
+}
+
+/*
+ * Function: log_stop
+ * Description: Write out everything queued and stop the logging thread
+ */
+void log_stop(void) {
+    if (!log_running) return;
+    
+    ATOMIC_STORE(&log_stop_requested, 1);
+    thread_join(log_thread);
+    log_running = 0;
+}
+
+/*
+ * Function: log_message
+ * Description: Log a message with specified level. While the logging thread
+ *              runs the text is queued; otherwise it is written directly.
+ */
+void log_message(LogLevel level, const char *format, ...) {
+    if (level > current_log_level) return;
+    
+    const char *level_str[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
+    FILE *output = (level == LOG_ERROR) ? stderr : stdout;
+    
+    va_list args;
+    
+    if (log_running) {
+        LogEvent *event = log_claim(level, LOG_EVT_TEXT, 0);
+        int n;
+        
+        if (event == NULL) return;
+        va_start(args, format);
+        n = vsnprintf(event->text, LOG_EVENT_TEXT, format, args);
+        va_end(args);
+        event->text_len = (unsigned short)((n < 0) ? 0 : 
+                                           (n >= LOG_EVENT_TEXT) ? LOG_EVENT_TEXT - 1 : n);
+        log_publish(event);
+        return;
+    }
+    
+    va_start(args, format);
+    
+    fprintf(output, "[%s] ", level_str[level]);
+    vfprintf(output, format, args);
+    fprintf(output, "\n");
+    
+    va_end(args);
+    
+    /* Also log to debug file if available */
+    if (debug_log != NULL && level <= LOG_DEBUG) {
+        va_start(args, format);
+        fprintf(debug_log, "[%s] ", level_str[level]);
+        vfprintf(debug_log, format, args);
+        fprintf(debug_log, "\n");
+        fflush(debug_log);
+        va_end(args);
+    }
+}
+
+/*
+ * Function: open_error_sidecar
+ * Description: Create the binary error sidecar and write its header
+ */
+int open_error_sidecar(const char *filename) {
+    ErrorSidecarHeader header;
+    
+    error_sidecar = fopen(filename, "wb");
+    if (error_sidecar == NULL) {
+        log_message(LOG_WARNING, "Could not create error sidecar '%s': %s", 
+                   filename, strerror(errno));
+        return 0;
+    }
+    
+    memcpy(header.magic, ERROR_SIDECAR_MAGIC, 4);
+    header.version = ERROR_SIDECAR_VERSION;
+    header.record_size = (unsigned short)sizeof(ErrorRecord);
+    fwrite(&header, sizeof(header), 1, error_sidecar);
+    return 1;
+}
+
+/*
+ * Function: flush_error_records
+ * Description: Write buffered error records to the sidecar in one call
+ */
+int flush_error_records(void) {
+    size_t written;
+    
+    if (error_sidecar == NULL || error_record_count == 0) {
+        error_record_count = 0;
+        return 1;
+    }
+    
+    written = fwrite(error_records, sizeof(ErrorRecord), error_record_count, error_sidecar);
+    error_records_written += (long long)written;
+    if (written != (size_t)error_record_count) {
+        log_message(LOG_ERROR, "Error sidecar write failed, closing it");
+        fclose(error_sidecar);
+        error_sidecar = NULL;
+        error_record_count = 0;
+        return 0;
+    }
+    
+    error_record_count = 0;
+    return 1;
+}
+
+/*
+ * Function: close_error_sidecar
+ * Description: Flush and close the error sidecar
+ */
+void close_error_sidecar(void) {
+    flush_error_records();
+    if (error_sidecar != NULL) {
+        fclose(error_sidecar);
+        error_sidecar = NULL;
+    }
+}
+
+/*
+ * Function: input_reader_open
+ * Description: Allocate the chunk buffer for reading file
+ */
+int input_reader_open(InputReader *reader, FILE *file) {
+    memset(reader, 0, sizeof(InputReader));
+    reader->data = (char *)malloc(INPUT_CHUNK_SIZE);
+    if (reader->data == NULL) return 0;
+    reader->file = file;
+    reader->capacity = INPUT_CHUNK_SIZE;
+    return 1;
+}
+
+/*
+ * Function: input_reader_close
+ * Description: Release the chunk buffer (the FILE stays open)
+ */
+void input_reader_close(InputReader *reader) {
+    free(reader->data);
+    reader->data = NULL;
+}
+
+/*
+ * Function: input_reader_fill
+ * Description: Move the unread tail to the front and read more. Queued
+ *              rejects point into the old bytes, so they are written first.
+ */
+static void input_reader_fill(InputReader *reader) {
+    size_t remaining = reader->end - reader->pos;
+    size_t n;
+    
+    flush_rejects();
+    
+    memmove(reader->data, reader->data + reader->pos, remaining);
+    reader->base_offset += (long long)reader->pos;
+    reader->pos = 0;
+    reader->end = remaining;
+    
+    n = fread(reader->data + remaining, 1, reader->capacity - remaining, reader->file);
+    reader->end += n;
+    if (n == 0) reader->eof = 1;
+}
+
+/*
+ * Function: input_reader_next_line
+ * Description: Return the next line (including its '\n') as a pointer into
+ *              the chunk, or NULL at end of input. When the chunk holds no
+ *              complete line and may_refill is 0, returns NULL early so the
+ *              caller can finish with the current lines first.
+ */
+const char* input_reader_next_line(InputReader *reader, size_t *len, int may_refill) {
+    for (;;) {
+        char *line = reader->data + reader->pos;
+        size_t avail = reader->end - reader->pos;
+        char *newline = (char *)memchr(line, '\n', avail);
+        
+        if (newline != NULL) {
+            *len = (size_t)(newline + 1 - line);
+            reader->pos += *len;
+            if (reader->skipping) {
+                reader->skipping = 0;
+                continue;
+            }
+            return line;
+        }
+        
+        if (reader->eof) {
+            if (avail == 0 || reader->skipping) return NULL;
+            *len = avail;               /* Last line without '\n' */
+            reader->pos = reader->end;
+            return line;
+        }
+        
+        if (!may_refill) return NULL;
+        
+        if (avail == reader->capacity) {
+            /* Longer than a whole chunk: hand out what fits, drop the rest */
+            reader->pos = reader->end;
+            if (!reader->skipping) {
+                reader->skipping = 1;
+                *len = avail;
+                return line;
+            }
+            continue;
+        }
+        
+        input_reader_fill(reader);
+    }
+}
+
+/*
+ * Function: input_reader_offset
+ * Description: File offset of a pointer returned by input_reader_next_line
+ */
+static long long input_reader_offset(const InputReader *reader, const char *line) {
+    return reader->base_offset + (long long)(line - reader->data);
+}
+
+/*
+ * Function: open_rejects_file
+ * Description: Create the rejects CSV (failed rows exactly as read)
+ */
+int open_rejects_file(const char *filename) {
+    rejects_file = fopen(filename, "wb");
+    if (rejects_file == NULL) {
+        log_message(LOG_ERROR, "Could not create rejects file '%s': %s", 
+                   filename, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: reject_record
+ * Description: Queue a failed row's original bytes. Adjacent rows merge
+ *              into one span, so runs of bad lines become a single write.
+ */
+void reject_record(const char *data, size_t len) {
+    if (rejects_file == NULL) return;
+    
+    stats.rejected_records++;
+    
+    if (reject_span_count > 0) {
+        ByteSpan *last = &reject_spans[reject_span_count - 1];
+        if (last->data + last->len == data) {
+            last->len += len;
+            return;
+        }
+    }
+    
+    if (reject_span_count == REJECT_BATCH) flush_rejects();
+    reject_spans[reject_span_count].data = data;
+    reject_spans[reject_span_count].len = len;
+    reject_span_count++;
+}
+
+/*
+ * Function: flush_rejects
+ * Description: Write queued spans straight from the input chunk
+ */
+int flush_rejects(void) {
+    int ok = 1;
+    
+    if (rejects_file == NULL) {
+        reject_span_count = 0;
+        return 1;
+    }
+    
+    for (int i = 0; i < reject_span_count; i++) {
+        const ByteSpan *span = &reject_spans[i];
+        if (fwrite(span->data, 1, span->len, rejects_file) != span->len) ok = 0;
+        
+        /* Keep the file line-oriented if the input's last line had no '\n' */
+        if (span->len > 0 && span->data[span->len - 1] != '\n') fputc('\n', rejects_file);
+    }
+    reject_span_count = 0;
+    
+    if (!ok) log_message(LOG_ERROR, "Rejects file write failed");
+    return ok;
+}
+
+/*
+ * Function: close_rejects_file
+ * Description: Flush and close the rejects file
+ */
+void close_rejects_file(void) {
+    flush_rejects();
+    if (rejects_file != NULL) {
+        fclose(rejects_file);
+        rejects_file = NULL;
+    }
+}
+
+/*
+ * Function: log_sample_admits
+ * Description: Detail-log cap: the first log_first occurrences of a code are
+ *              logged, after that one in every log_sample
+ */
+int log_sample_admits(long long occurrence) {
+    if (occurrence <= options.log_first) return 1;
+    return (occurrence - options.log_first) % options.log_sample == 0;
+}
+
+/*
+ * Function: record_error
+ * Description: Count a row's error codes and queue its sidecar record (the
+ *              sidecar is never sampled). Returns 1 if the row's text detail
+ *              should be logged under the per-code caps.
+ */
+int record_error(int line_num, int validation_errors, int parse_error, int failed) {
+    ErrorRecord *rec;
+    int admit = 0;
+    
+    /* Histograms; each code's count also drives its detail-log sampling */
+    if (parse_error > PARSE_OK && parse_error < PARSE_ERR_COUNT) {
+        admit |= log_sample_admits(++stats.parse_error_counts[parse_error]);
+    }
+    for (int bit = 0; bit < VAL_ERR_BITS; bit++) {
+        if (validation_errors & (1 << bit)) {
+            admit |= log_sample_admits(++stats.val_error_counts[bit]);
+        }
+    }
+    /* Only a text detail line can be sampled away */
+    if (!admit && options.text_error_log && error_log != NULL) stats.log_suppressed++;
+    
+    if (error_sidecar == NULL) return admit;
+    
+    rec = &error_records[error_record_count++];
+    rec->byte_offset = current_record_offset;
+    rec->line_number = line_num;
+    rec->validation_errors = (unsigned short)validation_errors;
+    rec->parse_error = (unsigned char)parse_error;
+    rec->failed = (unsigned char)(failed != 0);
+    
+    if (error_record_count == ERROR_BUFFER_SIZE) {
+        flush_error_records();
+    }
+    return admit;
+}
+
+/*
+ * Function: describe_record_errors
+ * Description: Print one line per reason in a parse code / VAL_ERR_* mask
+ */
+void describe_record_errors(FILE *out, int validation_errors, int parse_error) {
+    if (parse_error > PARSE_OK && parse_error < PARSE_ERR_COUNT)
+        fprintf(out, "  - %s\n", PARSE_ERROR_TEXT[parse_error]);
+    for (int bit = 0; bit < VAL_ERR_BITS; bit++) {
+        if (validation_errors & (1 << bit))
+            fprintf(out, "  - %s\n", VAL_ERROR_TEXT[bit]);
+    }
+}
+
+/*
+ * Function: decode_error_sidecar
+ * Description: Render an error sidecar as text on stdout. With the input
+ *              file, each entry also shows the original line (read at its
+ *              byte offset).
+ */
+int decode_error_sidecar(const char *filename, const char *input_file) {
+    FILE *f = fopen(filename, "rb");
+    FILE *input = NULL;
+    ErrorSidecarHeader header;
+    ErrorRecord batch[256];
+    char line[MAX_LINE];
+    long long total = 0;
+    size_t n;
+    
+    if (f == NULL) {
+        log_message(LOG_ERROR, "Could not open error sidecar '%s': %s", 
+                   filename, strerror(errno));
+        return 0;
+    }
+    
+    if (fread(&header, sizeof(header), 1, f) != 1 || 
+        memcmp(header.magic, ERROR_SIDECAR_MAGIC, 4) != 0 ||
+        header.version != ERROR_SIDECAR_VERSION || 
+        header.record_size != sizeof(ErrorRecord)) {
+        log_message(LOG_ERROR, "'%s' is not a version %d error sidecar", 
+                   filename, ERROR_SIDECAR_VERSION);
+        fclose(f);
+        return 0;
+    }
+    
+    if (input_file != NULL) {
+        input = fopen(input_file, "rb");
+        if (input == NULL) {
+            log_message(LOG_WARNING, "Could not open '%s', showing offsets only", input_file);
+        }
+    }
+    
+    while ((n = fread(batch, sizeof(ErrorRecord), 256, f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            printf("Line %d (byte %lld) - %s:\n", batch[i].line_number, 
+                   batch[i].byte_offset, batch[i].failed ? "rejected" : "warning");
+            describe_record_errors(stdout, batch[i].validation_errors, batch[i].parse_error);
+            
+            if (input != NULL && FSEEK64(input, batch[i].byte_offset, SEEK_SET) == 0 &&
+                fgets(line, sizeof(line), input) != NULL) {
+                line[strcspn(line, "\r\n")] = '\0';
+                printf("  Content: %s\n", line);
+            }
+        }
+        total += (long long)n;
+    }
+    
+    printf("\n%lld error records\n", total);
+    
+    if (input != NULL) fclose(input);
+    fclose(f);
+    return 1;
+}
+
+/*
+ * Function: log_parse_error
+ * Description: Record a parsing error in the sidecar (and the text log when
+ *              --text-error-log is given)
+ */
+void log_parse_error(int line_num, const char *line, int parse_error) {
+    int admit = record_error(line_num, VAL_OK, parse_error, 1);
+    
+    if (!admit || !options.text_error_log || error_log == NULL) return;
+    
+    /* Queue the reason and a copy of the line; the logging thread formats it */
+    if (log_running) {
+        LogEvent *event = log_claim(LOG_ERROR, LOG_EVT_PARSE_ERROR, line_num);
+        size_t len;
+        
+        if (event == NULL) return;
+        len = strlen(line);
+        if (len > LOG_EVENT_TEXT) len = LOG_EVENT_TEXT;
+        memcpy(event->text, line, len);
+        event->text_len = (unsigned short)len;
+        event->arg = parse_error;
+        event->timestamp = (long long)clock_wall_seconds;
+        log_publish(event);
+        return;
+    }
+    
+    fprintf(error_log, "[%s] Line %d: %s\n", clock_stamp, line_num, PARSE_ERROR_TEXT[parse_error]);
+    
+    /* Sanitize line before logging (remove control characters) */
+    char sanitized[MAX_LINE];
+    int j = 0;
+    for (int i = 0; i < (int)strlen(line) && i < MAX_LINE - 1 && j < MAX_LINE - 1; i++) {
+        if (isprint((unsigned char)line[i]) || line[i] == ' ') {
+            sanitized[j++] = line[i];
+        }
+    }
+    sanitized[j] = '\0';
+    
+    fprintf(error_log, "  Content: %s\n\n", sanitized);
+    fflush(error_log);
+}
+
+/*
+ * Function: log_validation_warning
+ * Description: Record validation issues in the sidecar (and the text log
+ *              when --text-error-log is given)
+ */
+void log_validation_warning(int line_num, int error_code, int failed) {
+    int admit = record_error(line_num, error_code, PARSE_OK, failed);
+    
+    if (!admit || !options.text_error_log || error_log == NULL) return;
+    
+    if (log_running) {
+        LogEvent *event = log_claim(LOG_WARNING, LOG_EVT_VALIDATION, line_num);
+        if (event == NULL) return;
+        event->arg = error_code;
+        log_publish(event);
+        return;
+    }
+    
+    fprintf(error_log, "Line %d - Validation warnings:\n", line_num);
+    describe_record_errors(error_log, error_code, PARSE_OK);
+    fprintf(error_log, "\n");
+    fflush(error_log);
+}
+
+/*
+ * Function: create_directory
+ * Description: Creates a directory if it doesn't exist (Windows)
+ */
+int create_directory(const char *path) {
+    struct _stat st = {0};
+    
+    if (_stat(path, &st) == -1) {
+        if (_mkdir(path) != 0) {
+            log_message(LOG_ERROR, "Failed to create directory '%s': %s", 
+                       path, strerror(errno));
+            return -1;
+        }
+        log_message(LOG_INFO, "Created directory: %s", path);
+    }
+    
+    return 0;
+}
+
+/*
+ * Function: trim_whitespace
+ * Description: Removes leading and trailing whitespace
+ */
+char* trim_whitespace(char *str) {
+    char *end;
+    
     /* Trim leading space */
     while (isspace((unsigned char)*str)) str++;
     
-    if (*str == 0) return str;
+    if (*str == 0) return str;
+    
+    /* Trim trailing space */
+    end = str + strlen(str) - 1;
+    while (end > str && isspace((unsigned char)*end)) end--;
+    
+    *(end + 1) = '\0';
+    
+    return str;
+}
+
+/*
+ * Function: secure_strncpy
+ * Description: Safe string copy with guaranteed null termination
+ */
+char* secure_strncpy(char *dest, const char *src, size_t dest_size) {
+    if (dest == NULL || src == NULL || dest_size == 0) {
+        return dest;
+    }
+    
+    size_t i;
+    for (i = 0; i < dest_size - 1 && src[i] != '\0'; i++) {
+        dest[i] = src[i];
+    }
+    dest[i] = '\0';
+    
+    return dest;
+}
+
+/*
+ * Function: safe_atoi
+ * Description: Safe string to integer conversion with validation
+ */
+int safe_atoi(const char *str, int *value) {
+    char *endptr;
+    long val;
+    
+    if (str == NULL || *str == '\0') {
+        return 0;
+    }
+    
+    errno = 0;
+    val = strtol(str, &endptr, 10);
+    
+    /* Check for conversion errors */
+    if (errno == ERANGE || val > INT_MAX || val < INT_MIN) {
+        return 0;
+    }
+    
+    /* Check if entire string was consumed */
+    if (*endptr != '\0') {
+        return 0;
+    }
+    
+    *value = (int)val;
+    return 1;
+}
+
+/*
+ * Function: safe_atod
+ * Description: Safe string to double conversion with validation
+ */
+int safe_atod(const char *str, double *value) {
+    char *endptr;
+    double val;
+    
+    if (str == NULL || *str == '\0') {
+        return 0;
+    }
+    
+    errno = 0;
+    val = strtod(str, &endptr);
+    
+    if (errno == ERANGE || *endptr != '\0') {
+        return 0;
+    }
+    
+    *value = val;
+    return 1;
+}
+
+/*
+ * Function: sanitize_input
+ * Description: Remove potentially dangerous characters from input
+ */
+void sanitize_input(char *str) {
+    if (str == NULL) return;
+    
+    for (int i = 0; str[i] != '\0'; i++) {
+        /* Remove null bytes and other control characters except tab/newline */
+        if (str[i] < 32 && str[i] != '\t' && str[i] != '\n' && str[i] != '\r') {
+            str[i] = ' ';
+        }
+        /* Remove potential SQL injection characters (defense in depth) */
+        if (str[i] == '\'' || str[i] == '"' || str[i] == ';' || str[i] == '\\') {
+            /* Allow these in data but log if validation is strict */
+            if (validation_rules.strict_mode) {
+                log_event(LOG_DEBUG, LOG_EVT_SPECIAL_CHAR, 0, str[i]);
+            }
+        }
+    }
+}
+
+/*
+ * Function: load_validation_rules
+ * Description: Load validation rules from configuration file
+ */
+int load_validation_rules(const char *filename, ValidationRules *rules) {
+    FILE *f;
+    char line[256];
+    int line_num = 0;
+    
+    /* Use defaults if no file specified */
+    if (filename == NULL || strlen(filename) == 0) {
+        log_message(LOG_INFO, "Using default validation rules");
+        return 1;
+    }
+    
+    f = fopen(filename, "r");
+    if (f == NULL) {
+        log_message(LOG_WARNING, "Could not open validation rules file '%s', using defaults", 
+                   filename);
+        return 0;
+    }
+    
+    log_message(LOG_INFO, "Loading validation rules from: %s", filename);
+    
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *trimmed;
+        char key[128], value[128];
+        
+        line_num++;
+        trimmed = trim_whitespace(line);
+        
+        /* Skip empty lines and comments */
+        if (strlen(trimmed) == 0 || trimmed[0] == '#' || trimmed[0] == ';') {
+            continue;
+        }
+        
+        /* Parse key=value format */
+        if (sscanf(trimmed, "%127[^=]=%127s", key, value) == 2) {
+            char *key_trimmed = trim_whitespace(key);
+            char *value_trimmed = trim_whitespace(value);
+            
+            /* Convert value to boolean */
+            int bool_value = (strcmp(value_trimmed, "1") == 0 || 
+                            strcmp(value_trimmed, "true") == 0 ||
+                            strcmp(value_trimmed, "TRUE") == 0 ||
+                            strcmp(value_trimmed, "yes") == 0 ||
+                            strcmp(value_trimmed, "YES") == 0);
+            
+            /* Set rule based on key */
+            if (strcmp(key_trimmed, "validate_email") == 0) {
+                rules->validate_email = bool_value;
+            } else if (strcmp(key_trimmed, "validate_phone") == 0) {
+                rules->validate_phone = bool_value;
+            } else if (strcmp(key_trimmed, "validate_date") == 0) {
+                rules->validate_date = bool_value;
+            } else if (strcmp(key_trimmed, "validate_state") == 0) {
+                rules->validate_state = bool_value;
+            } else if (strcmp(key_trimmed, "validate_zip") == 0) {
+                rules->validate_zip = bool_value;
+            } else if (strcmp(key_trimmed, "allow_empty_fields") == 0) {
+                rules->allow_empty_fields = bool_value;
+            } else if (strcmp(key_trimmed, "strict_mode") == 0) {
+                rules->strict_mode = bool_value;
+            } else if (strcmp(key_trimmed, "check_zip_state") == 0) {
+                rules->check_zip_state = bool_value;
+            } else {
+                log_message(LOG_WARNING, "Unknown validation rule at line %d: %s", 
+                           line_num, key_trimmed);
+            }
+        }
+    }
+    
+    fclose(f);
+    
+    /* Log loaded rules */
+    log_message(LOG_INFO, "Validation rules loaded:");
+    log_message(LOG_INFO, "  Email validation: %s", rules->validate_email ? "ON" : "OFF");
+    log_message(LOG_INFO, "  Phone validation: %s", rules->validate_phone ? "ON" : "OFF");
+    log_message(LOG_INFO, "  Date validation: %s", rules->validate_date ? "ON" : "OFF");
+    log_message(LOG_INFO, "  State validation: %s", rules->validate_state ? "ON" : "OFF");
+    log_message(LOG_INFO, "  Zip validation: %s", rules->validate_zip ? "ON" : "OFF");
+    log_message(LOG_INFO, "  Allow empty fields: %s", rules->allow_empty_fields ? "YES" : "NO");
+    log_message(LOG_INFO, "  Strict mode: %s", rules->strict_mode ? "ON" : "OFF");
+    log_message(LOG_INFO, "  ZIP/state check: %s", rules->check_zip_state ? "ON" : "OFF");
+    
+    return 1;
+}
+
+/*
+ * Function: validate_customer_id
+ * Description: Validate customer ID is a positive integer
+ */
+int validate_customer_id(const char *str) {
+    int value;
+    
+    if (!safe_atoi(str, &value)) {
+        return 0;
+    }
+    
+    return (value > 0);
+}
+
+/*
+ * Function: hash_bytes
+ * Description: wyhash-style hash: 8 bytes per multiply-fold step
+ */
+unsigned long long hash_bytes(const char *data, size_t len) {
+    const unsigned long long k0 = 0xa0761d6478bd642fULL;
+    const unsigned long long k1 = 0xe7037ed1a0b428dbULL;
+    unsigned long long h = k0 ^ (unsigned long long)len;
+    size_t i = 0;
+    
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long chunk;
+        memcpy(&chunk, data + i, 8);
+        h = (h ^ chunk) * k1;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        unsigned long long tail = 0;
+        memcpy(&tail, data + i, len - i);
+        h = (h ^ tail) * k1;
+        h ^= h >> 32;
+    }
+    
+    h *= k0;
+    return h ^ (h >> 29);
+}
+
+/*
+ * Function: vcache_lookup
+ * Description: Return the cached verdict (0/1) for key, or -1 on a miss
+ */
+int vcache_lookup(ValidationCache *cache, const char *key, size_t len, 
+                  unsigned long long hash) {
+    ValidationCacheEntry *entry = &cache->entries[hash & (VCACHE_SLOTS - 1)];
+    
+    cache->lookups++;
+    if (entry->len == len && entry->hash == hash && memcmp(entry->key, key, len) == 0) {
+        cache->hits++;
+        return entry->verdict;
+    }
+    return -1;
+}
+
+/*
+ * Function: vcache_store
+ * Description: Remember a verdict, evicting whatever shared the slot
+ */
+void vcache_store(ValidationCache *cache, const char *key, size_t len, 
+                  unsigned long long hash, int verdict) {
+    ValidationCacheEntry *entry = &cache->entries[hash & (VCACHE_SLOTS - 1)];
+    
+    if (len == 0 || len > VCACHE_KEY_MAX) return;
+    
+    entry->hash = hash;
+    entry->len = (unsigned char)len;
+    entry->verdict = (unsigned char)(verdict != 0);
+    memcpy(entry->key, key, len);
+}
+
+/*
+ * Function: domain_dict_init
+ * Description: Start an empty domain dictionary (allocation is lazy)
+ */
+void domain_dict_init(DomainDict *dict) {
+    memset(dict, 0, sizeof(DomainDict));
+}
+
+/*
+ * Function: domain_dict_free
+ * Description: Release dictionary memory
+ */
+void domain_dict_free(DomainDict *dict) {
+    free(dict->slots);
+    free(dict->names);
+    memset(dict, 0, sizeof(DomainDict));
+}
+
+/*
+ * Function: domain_dict_find
+ * Description: Slot for (domain, hash): the matching entry or the empty slot
+ *              where it would go
+ */
+static DomainEntry* domain_dict_find(const DomainDict *dict, const char *domain, 
+                                     size_t len, unsigned long long hash) {
+    size_t mask = dict->slot_count - 1;
+    size_t i = (size_t)hash & mask;
+    
+    for (;;) {
+        DomainEntry *entry = &dict->slots[i];
+        if (entry->len == 0) return entry;
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(dict->names + entry->name_offset, domain, len) == 0) {
+            return entry;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/*
+ * Function: domain_dict_grow
+ * Description: Double the slot table (or create it); 0 on allocation failure
+ */
+static int domain_dict_grow(DomainDict *dict) {
+    size_t new_count = dict->slot_count ? dict->slot_count * 2 : DOMAIN_DICT_INITIAL;
+    DomainEntry *old_slots = dict->slots;
+    size_t old_count = dict->slot_count;
+    DomainEntry *slots = (DomainEntry *)calloc(new_count, sizeof(DomainEntry));
+    
+    if (slots == NULL) return 0;
+    
+    dict->slots = slots;
+    dict->slot_count = new_count;
+    for (size_t i = 0; i < old_count; i++) {
+        if (old_slots[i].len != 0) {
+            size_t j = (size_t)old_slots[i].hash & (new_count - 1);
+            while (slots[j].len != 0) j = (j + 1) & (new_count - 1);
+            slots[j] = old_slots[i];
+        }
+    }
+    free(old_slots);
+    return 1;
+}
+
+/*
+ * Function: validate_email_domain
+ * Description: Validate the part after '@': allowed characters only, at least
+ *              one '.', not ending in '.'. Verdicts are memoized because
+ *              feeds carry only a few hundred distinct domains.
+ */
+int validate_email_domain(const char *domain, size_t len) {
+    unsigned long long hash;
+    int cached, verdict, has_dot = 0;
+    
+    if (len == 0) return 0;
+    
+    hash = hash_bytes(domain, len);
+    cached = vcache_lookup(&email_domain_cache, domain, len, hash);
+    if (cached >= 0) return cached;
+    
+    verdict = (domain[len - 1] != '.');
+    for (size_t i = 0; i < len && verdict; i++) {
+        char c = domain[i];
+        if (c == '.') {
+            has_dot = 1;
+        } else if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '+') {
+            verdict = 0;
+        }
+    }
+    verdict = verdict && has_dot;
+    
+    vcache_store(&email_domain_cache, domain, len, hash, verdict);
+    return verdict;
+}
+
+/*
+ * Function: domain_dict_intern
+ * Description: Look up a (lowercased) domain, validating and adding it on
+ *              first sight. Returns its ID (0 if invalid) and the verdict.
+ *              Valid domains that cannot be added (past DOMAIN_DICT_MAX,
+ *              too long, out of memory) get DOMAIN_ID_UNASSIGNED.
+ */
+unsigned int domain_dict_intern(DomainDict *dict, const char *domain, size_t len, 
+                                int *valid) {
+    unsigned long long hash;
+    DomainEntry *entry;
+    
+    dict->lookups++;
+    if (len == 0 || len > UCHAR_MAX) {
+        *valid = validate_email_domain(domain, len);
+        if (!*valid) return 0;
+        dict->unassigned++;
+        return DOMAIN_ID_UNASSIGNED;
+    }
+    
+    hash = hash_bytes(domain, len);
+    if (dict->slot_count > 0) {
+        entry = domain_dict_find(dict, domain, len, hash);
+        if (entry->len != 0) {
+            dict->hits++;
+            entry->records++;
+            *valid = entry->valid;
+            return entry->id;
+        }
+    }
+    
+    *valid = validate_email_domain(domain, len);
+    
+    /* Keep the table at most half full */
+    if (dict->used >= DOMAIN_DICT_MAX ||
+        ((dict->used + 1) * 2 > dict->slot_count && !domain_dict_grow(dict))) {
+        goto unassigned;
+    }
+    
+    if (dict->names_len + len > dict->names_capacity) {
+        size_t capacity = dict->names_capacity ? dict->names_capacity * 2 : 16384;
+        char *names;
+        while (capacity < dict->names_len + len) capacity *= 2;
+        names = (char *)realloc(dict->names, capacity);
+        if (names == NULL) goto unassigned;
+        dict->names = names;
+        dict->names_capacity = capacity;
+    }
+    
+    entry = domain_dict_find(dict, domain, len, hash);
+    memcpy(dict->names + dict->names_len, domain, len);
+    entry->hash = hash;
+    entry->name_offset = (unsigned int)dict->names_len;
+    entry->len = (unsigned char)len;
+    entry->valid = (unsigned char)(*valid != 0);
+    entry->id = *valid ? ++dict->next_id : 0;
+    entry->records = 1;
+    dict->names_len += len;
+    dict->used++;
+    
+    return entry->id;
+    
+unassigned:
+    if (!*valid) return 0;
+    dict->unassigned++;
+    return DOMAIN_ID_UNASSIGNED;
+}
+
+/*
+ * Function: email_domain_id
+ * Description: ID of an already normalized email's domain. Lookup only, for
+ *              keep-last patches of the domain ID column: a domain missing
+ *              from the dictionary is one it had no room for, unless it
+ *              is not valid at all.
+ */
+unsigned int email_domain_id(const char *email) {
+    const char *at = strchr(email, '@');
+    size_t len;
+    DomainEntry *entry;
+    
+    if (at == NULL) return 0;
+    
+    len = strlen(at + 1);
+    if (len > 0 && len <= UCHAR_MAX && email_domains.slot_count > 0) {
+        entry = domain_dict_find(&email_domains, at + 1, len, hash_bytes(at + 1, len));
+        if (entry->len != 0) return entry->id;
+    }
+    return validate_email_domain(at + 1, len) ? DOMAIN_ID_UNASSIGNED : 0;
+}
+
+/*
+ * Function: normalize_email
+ * Description: Validate an email in one pass while lowercasing it in place.
+ *              Same rules as before: at least 6 characters, exactly one '@'
+ *              with a non-empty local part of [A-Za-z0-9._+-], and a valid
+ *              domain. With --domain-ids the domain is also interned and
+ *              its ID stored in *domain_id.
+ */
+int normalize_email(char *email, unsigned int *domain_id) {
+    char *at = NULL;
+    char *p;
+    int local_ok = 1;
+    int valid;
+    unsigned int id;
+    
+    if (domain_id != NULL) *domain_id = 0;
+    
+    for (p = email; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        
+        if (c >= 'A' && c <= 'Z') {
+            *p = (char)(c + ('a' - 'A'));
+        } else if (c == '@') {
+            if (at != NULL) return 0;       /* Second '@' */
+            at = p;
+        } else if (at == NULL && !isalnum(c) && c != '.' && c != '_' && 
+                   c != '-' && c != '+') {
+            local_ok = 0;
+        }
+    }
+    
+    if (p - email < 6 || at == NULL || at == email || !local_ok) return 0;
+    if (!options.domain_ids) return validate_email_domain(at + 1, (size_t)(p - at - 1));
+    
+    id = domain_dict_intern(&email_domains, at + 1, (size_t)(p - at - 1), &valid);
+    if (domain_id != NULL) *domain_id = id;
+    return valid;
+}
+
+/*
+ * Function: validate_email
+ * Description: Validate email format (basic check) without modifying it
+ */
+int validate_email(const char *email) {
+    char canonical[MAX_EMAIL];
+    
+    if (email == NULL || *email == '\0') {
+        return !validation_rules.allow_empty_fields ? 0 : 1;
+    }
+    
+    secure_strncpy(canonical, email, sizeof(canonical));
+    return normalize_email(canonical, NULL);
+}
+
+/*
+ * Function: parse_phone
+ * Description: Parse a US phone number written with any mix of spaces,
+ *              '-', '.', '(' and ')' and an optional leading "+1" / "1"
+ *              country code, e.g. "(555) 123-4567" or "+1 555.123.4567".
+ *              Stores the 10 canonical digits as an integer. Single pass,
+ *              no allocation.
+ */
+int parse_phone(const char *phone, unsigned long long *number) {
+    const unsigned char *p = (const unsigned char *)phone;
+    unsigned long long value = 0;
+    int digits = 0;
+    int plus = 0;
+    unsigned char cls;
+    
+    if (phone == NULL) return 0;
+    
+    for (; *p != '\0'; p++) {
+        cls = PHONE_CHAR_CLASS[*p];
+        if (cls == PHONE_CLASS_SEPARATOR) continue;
+        if (cls == PHONE_CLASS_INVALID) return 0;
+        if (cls == PHONE_CLASS_PLUS) {
+            /* '+' may only introduce the country code */
+            if (plus || digits > 0) return 0;
+            plus = 1;
+            continue;
+        }
+        if (++digits > PHONE_DIGITS + 1) return 0;
+        value = value * 10 + (unsigned long long)(cls - 1);
+    }
+    
+    if (digits == PHONE_DIGITS + 1) {
+        /* Leading country code: value is 1XXXXXXXXXX */
+        if (value / 10000000000ULL != PHONE_COUNTRY_CODE) return 0;
+        value %= 10000000000ULL;
+    } else if (digits != PHONE_DIGITS || plus) {
+        return 0;
+    }
+    
+    if (number != NULL) *number = value;
+    return 1;
+}
+
+/*
+ * Function: format_phone
+ * Description: Write a packed phone number in canonical XXX-XXX-XXXX form
+ *              (phone must hold at least 13 bytes)
+ */
+void format_phone(unsigned long long number, char *phone) {
+    for (int i = 11; i >= 0; i--) {
+        if (i == 3 || i == 7) {
+            phone[i] = '-';
+        } else {
+            phone[i] = (char)('0' + (int)(number % 10));
+            number /= 10;
+        }
+    }
+    phone[12] = '\0';
+}
+
+/*
+ * Function: normalize_phone
+ * Description: Rewrite a phone field in place to canonical form. Leaves the
+ *              text untouched (and returns 0) if it is not a valid number.
+ */
+int normalize_phone(char *phone, unsigned long long *number) {
+    unsigned long long value;
+    
+    if (!parse_phone(phone, &value)) return 0;
+    
+    format_phone(value, phone);
+    if (number != NULL) *number = value;
+    return 1;
+}
+
+/*
+ * Function: validate_phone
+ * Description: Validate a phone number in any accepted format
+ */
+int validate_phone(const char *phone) {
+    if (phone == NULL || *phone == '\0') {
+        return !validation_rules.allow_empty_fields ? 0 : 1;
+    }
+    
+    return parse_phone(phone, NULL);
+}
+
+/*
+ * Function: calendar_to_epoch_days
+ * Description: Check year/month/day against the calendar (month lengths and
+ *              leap years are table driven) and convert to days since
+ *              1970-01-01. Used by parse_date; parse_dates_x8 applies
+ *              the same rules lane-parallel.
+ */
+int calendar_to_epoch_days(int year, int month, int day, int *epoch_days) {
+    static const unsigned char days_in_month[2][13] = {
+        {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+        {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31}
+    };
+    static const unsigned short days_before_month[2][13] = {
+        {0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334},
+        {0, 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335}
+    };
+    int leap, y;
+
+    if (year < 1900 || year > 2100) return 0;
+    if (month < 1 || month > 12) return 0;
+
+    leap = (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+    if (day < 1 || day > days_in_month[leap][month]) return 0;
+
+    if (epoch_days != NULL) {
+        /* 719162 = days from 0001-01-01 to 1970-01-01 (proleptic Gregorian) */
+        y = year - 1;
+        *epoch_days = y * 365 + y / 4 - y / 100 + y / 400 - 719162 +
+                      days_before_month[leap][month] + day - 1;
+    }
+
+    return 1;
+}
+
+/*
+ * Function: parse_date
+ * Description: Validate a YYYY-MM-DD date in one pass and convert it to days
+ *              since 1970-01-01. This is the scalar reference implementation
+ *              for parse_dates_x8.
+ */
+int parse_date(const char *date, int *epoch_days) {
+    int parts[3] = {0, 0, 0};
+    int part = 0;
+
+    /* Single scan: digits accumulate into year/month/day, '-' only at 4 and 7 */
+    for (int i = 0; i < 10; i++) {
+        unsigned int digit = (unsigned char)date[i] - (unsigned int)'0';
+
+        if (i == 4 || i == 7) {
+            if (date[i] != '-') return 0;
+            part++;
+        } else {
+            if (digit > 9) return 0;  /* Also stops at an early '\0' */
+            parts[part] = parts[part] * 10 + (int)digit;
+        }
+    }
+    if (date[10] != '\0') return 0;
+
+    return calendar_to_epoch_days(parts[0], parts[1], parts[2], epoch_days);
+}
+
+/*
+ * Function: parse_dates_x8
+ * Description: Batch date parser for up to DATE_BATCH MAX_DATE-sized fields.
+ *              With SSSE3 the eight fields are transposed so each register
+ *              holds one or two character positions of all eight dates;
+ *              shape, digits, calendar and epoch days are then computed for
+ *              the eight lanes together (16-bit lanes, 32-bit for the day
+ *              count). Returns a bitmask with bit i set when dates[i] is
+ *              valid; epoch_days[i] is filled for those.
+ */
+unsigned int parse_dates_x8(const char *const *dates, int count, int *epoch_days) {
+    unsigned int valid_mask = 0;
+
+    if (count > DATE_BATCH) count = DATE_BATCH;
+
+#if defined(__SSSE3__) || defined(__AVX__)
+    {
+        /* Expected character (low 8 bytes: position 2k, high: 2k+1) and the
+         * largest allowed XOR result: 9 for digits, 0 for '-' and the
+         * terminator, 0xFF where anything goes */
+        #define DATE_LANES(low, high) _mm_unpacklo_epi64(_mm_set1_epi8((char)(low)), \
+                                                         _mm_set1_epi8((char)(high)))
+        const __m128i templates[6] = {
+            DATE_LANES('0', '0'), DATE_LANES('0', '0'), DATE_LANES('-', '0'),
+            DATE_LANES('0', '-'), DATE_LANES('0', '0'), DATE_LANES(0, 0)
+        };
+        const __m128i limits[6] = {
+            DATE_LANES(9, 9), DATE_LANES(9, 9), DATE_LANES(0, 9),
+            DATE_LANES(9, 0), DATE_LANES(9, 9), DATE_LANES(0, 0xFF)
+        };
+        #undef DATE_LANES
+        /* Month-indexed tables for pshufb (common year) */
+        const __m128i month_days = _mm_setr_epi8(0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 
+                                                 30, 31, 0, 0, 0);
+        const __m128i before_low = _mm_setr_epi8(0, 0, 31, 59, 90, 120, (char)151, (char)181, 
+                                                 (char)212, (char)243, 17, 48, 78, 0, 0, 0);
+        const __m128i before_high = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 
+                                                  0, 0, 1, 1, 1, 0, 0, 0);
+        const __m128i tens = _mm_set1_epi16(0x010A);    /* Byte pairs (10, 1) */
+        const __m128i zero = _mm_setzero_si128();
+        char fields[DATE_BATCH][16];
+        int lane_days[DATE_BATCH];
+        __m128i rows[DATE_BATCH], low[4], high[4], columns[6];
+        __m128i shape, calendar, year, month, day, leap, index, limit, before;
+        __m128i rest, rest_sign, offset, product_low, product_high;
+
+        memset(fields, 0, sizeof(fields));
+        for (int i = 0; i < count; i++) memcpy(fields[i], dates[i], MAX_DATE);
+        for (int i = 0; i < DATE_BATCH; i++) {
+            rows[i] = _mm_loadu_si128((const __m128i *)fields[i]);
+        }
+
+        /* 8x12 byte transpose: columns[k] = position 2k of dates 0..7, then 2k+1 */
+        for (int i = 0; i < 4; i++) {
+            low[i] = _mm_unpacklo_epi8(rows[2 * i], rows[2 * i + 1]);
+            high[i] = _mm_unpackhi_epi8(rows[2 * i], rows[2 * i + 1]);
+        }
+        {
+            __m128i front03 = _mm_unpacklo_epi16(low[0], low[1]);     /* Positions 0-3, dates 0-3 */
+            __m128i middle03 = _mm_unpackhi_epi16(low[0], low[1]);    /* 4-7, dates 0-3 */
+            __m128i back03 = _mm_unpacklo_epi16(high[0], high[1]);    /* 8-11, dates 0-3 */
+            __m128i front47 = _mm_unpacklo_epi16(low[2], low[3]);
+            __m128i middle47 = _mm_unpackhi_epi16(low[2], low[3]);
+            __m128i back47 = _mm_unpacklo_epi16(high[2], high[3]);
+            
+            columns[0] = _mm_unpacklo_epi32(front03, front47);
+            columns[1] = _mm_unpackhi_epi32(front03, front47);
+            columns[2] = _mm_unpacklo_epi32(middle03, middle47);
+            columns[3] = _mm_unpackhi_epi32(middle03, middle47);
+            columns[4] = _mm_unpacklo_epi32(back03, back47);
+            columns[5] = _mm_unpackhi_epi32(back03, back47);
+        }
+
+        /* Shape: XOR turns digits into 0..9 and '-'/terminator into 0 */
+        shape = _mm_set1_epi8(-1);
+        for (int k = 0; k < 6; k++) {
+            columns[k] = _mm_xor_si128(columns[k], templates[k]);
+            shape = _mm_and_si128(shape, _mm_cmpeq_epi8(_mm_max_epu8(columns[k], limits[k]), 
+                                                        limits[k]));
+        }
+        shape = _mm_and_si128(shape, _mm_srli_si128(shape, 8));
+
+        /* Digit pairs side by side per lane, then pmaddubsw folds them */
+        year = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_maddubs_epi16(_mm_unpacklo_epi8(columns[0], 
+                                                                _mm_srli_si128(columns[0], 8)), tens), 
+                            _mm_set1_epi16(100)),
+            _mm_maddubs_epi16(_mm_unpacklo_epi8(columns[1], _mm_srli_si128(columns[1], 8)), tens));
+        month = _mm_maddubs_epi16(_mm_unpacklo_epi8(_mm_srli_si128(columns[2], 8), columns[3]), 
+                                  tens);
+        day = _mm_maddubs_epi16(_mm_unpacklo_epi8(columns[4], _mm_srli_si128(columns[4], 8)), tens);
+
+        /* Calendar: 1900..2100, months 1..12, day within the month */
+        calendar = _mm_and_si128(_mm_cmpgt_epi16(year, _mm_set1_epi16(1899)), 
+                                 _mm_cmplt_epi16(year, _mm_set1_epi16(2101)));
+        calendar = _mm_and_si128(calendar, _mm_cmpgt_epi16(month, zero));
+        calendar = _mm_and_si128(calendar, _mm_cmplt_epi16(month, _mm_set1_epi16(13)));
+        calendar = _mm_and_si128(calendar, _mm_cmpgt_epi16(day, zero));
+        
+        /* In 1900..2100 every fourth year is leap except 1900 and 2100 */
+        leap = _mm_andnot_si128(
+            _mm_or_si128(_mm_cmpeq_epi16(year, _mm_set1_epi16(1900)), 
+                         _mm_cmpeq_epi16(year, _mm_set1_epi16(2100))), 
+            _mm_cmpeq_epi16(_mm_and_si128(year, _mm_set1_epi16(3)), zero));
+        
+        index = _mm_packus_epi16(month, month);
+        limit = _mm_unpacklo_epi8(_mm_shuffle_epi8(month_days, index), zero);
+        limit = _mm_sub_epi16(limit, _mm_and_si128(leap, _mm_cmpeq_epi16(month, _mm_set1_epi16(2))));
+        calendar = _mm_andnot_si128(_mm_cmpgt_epi16(day, limit), calendar);
+        
+        valid_mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(shape, _mm_packs_epi16(calendar, calendar))) & 0xFFu;
+        valid_mask &= (1u << count) - 1u;
+
+        /* Days since 1970-01-01: (year - 1970) * 365 plus leap days since
+         * 1970, ((year - 1) >> 2) - 492 (+1 for 1900), plus the day of year */
+        before = _mm_unpacklo_epi8(_mm_shuffle_epi8(before_low, index), 
+                                   _mm_shuffle_epi8(before_high, index));
+        before = _mm_sub_epi16(before, _mm_and_si128(leap, _mm_cmpgt_epi16(month, _mm_set1_epi16(2))));
+        rest = _mm_add_epi16(_mm_srai_epi16(_mm_sub_epi16(year, _mm_set1_epi16(1)), 2), before);
+        rest = _mm_add_epi16(rest, _mm_sub_epi16(day, _mm_set1_epi16(493)));
+        rest = _mm_sub_epi16(rest, _mm_cmpeq_epi16(year, _mm_set1_epi16(1900)));
+        
+        offset = _mm_sub_epi16(year, _mm_set1_epi16(1970));
+        product_low = _mm_mullo_epi16(offset, _mm_set1_epi16(365));
+        product_high = _mm_mulhi_epi16(offset, _mm_set1_epi16(365));
+        rest_sign = _mm_srai_epi16(rest, 15);
+        _mm_storeu_si128((__m128i *)&lane_days[0], 
+                         _mm_add_epi32(_mm_unpacklo_epi16(product_low, product_high), 
+                                       _mm_unpacklo_epi16(rest, rest_sign)));
+        _mm_storeu_si128((__m128i *)&lane_days[4], 
+                         _mm_add_epi32(_mm_unpackhi_epi16(product_low, product_high), 
+                                       _mm_unpackhi_epi16(rest, rest_sign)));
+        
+        for (int i = 0; i < count; i++) {
+            if (valid_mask & (1u << i)) epoch_days[i] = lane_days[i];
+        }
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        if (parse_date(dates[i], &epoch_days[i])) {
+            valid_mask |= 1u << i;
+        }
+    }
+#endif
+
+    return valid_mask;
+}
+
+/*
+ * Function: validate_date
+ * Description: Validate date format (YYYY-MM-DD) and calendar correctness
+ */
+int validate_date(const char *date) {
+    if (date == NULL || *date == '\0') {
+        return !validation_rules.allow_empty_fields ? 0 : 1;
+    }
+
+    return parse_date(date, NULL);
+}
+
+/*
+ * Function: state_ordinal
+ * Description: Map a state/territory code to its dense ordinal (1..STATE_COUNT),
+ *              or 0 if it is not a known code. One table load, no search.
+ */
+int state_ordinal(const char *state) {
+    unsigned int a = (unsigned char)state[0] - (unsigned int)'A';
+    unsigned int b, valid, slot;
+
+    if (a >= 26) return 0;  /* Also rejects "" so state[1] is always readable */
+
+    b = (unsigned char)state[1] - (unsigned int)'A';
+    valid = (b < 26) && state[2] == '\0';
+
+    /* Select the real slot or the invalid sentinel without branching */
+    slot = STATE_SLOT_INVALID + ((a * 26 + b - STATE_SLOT_INVALID) & (0u - valid));
+
+    return STATE_ORDINALS[slot];
+}
+
+/*
+ * Function: state_code
+ * Description: Map a state ordinal back to its two-letter code ("" if unknown)
+ */
+const char* state_code(int ordinal) {
+    if (ordinal < 0 || ordinal > STATE_COUNT) return STATE_CODES[0];
+    return STATE_CODES[ordinal];
+}
+
+/*
+ * Function: validate_state
+ * Description: Validate state code against the US state/territory table
+ */
+int validate_state(const char *state) {
+    if (state == NULL || *state == '\0') {
+        return !validation_rules.allow_empty_fields ? 0 : 1;
+    }
+
+    return state_ordinal(state) != 0;
+}
+
+/*
+ * Function: validate_zip
+ * Description: Validate ZIP code (5 digits)
+ */
+int validate_zip(const char *zip) {
+    if (zip == NULL || *zip == '\0') {
+        return !validation_rules.allow_empty_fields ? 0 : 1;
+    }
+    
+    /* Should be exactly 5 characters */
+    if (strlen(zip) != 5) return 0;
+    
+    /* All should be digits */
+    for (int i = 0; i < 5; i++) {
+        if (!isdigit((unsigned char)zip[i])) return 0;
+    }
+    
+    return 1;
+}
+
+/*
+ * Function: format_date
+ * Description: Write days since 1970-01-01 as YYYY-MM-DD (inverse of
+ *              calendar_to_epoch_days; date must hold MAX_DATE bytes)
+ */
+void format_date(int epoch_days, char *date) {
+    /* Civil-from-days over 400-year eras starting 0000-03-01 */
+    int z = epoch_days + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int day = doy - (153 * mp + 2) / 5 + 1;
+    int month = (mp < 10) ? mp + 3 : mp - 9;
+    int year = yoe + era * 400 + (month <= 2);
+    
+    char text[32];
+    
+    snprintf(text, sizeof(text), "%04d-%02d-%02d", year, month, day);
+    secure_strncpy(date, text, MAX_DATE);
+}
+
+/*
+ * Function: pack_customer
+ * Description: Convert a customer to the --packed layout. Returns -1, or
+ *              the CSV field index of the first field whose text would not
+ *              come back unchanged from unpack_customer (packed is then
+ *              incomplete). derived holds the phone and date decoded during
+ *              validation; NULL parses them from the text.
+ */
+int pack_customer(const Customer *customer, const CustomerDerived *derived, 
+                  PackedCustomer *packed) {
+    char phone[MAX_PHONE];
+    
+    packed->customer_id = customer->customer_id;
+    memcpy(packed->first_name, customer->first_name, MAX_FIRST_NAME);
+    memcpy(packed->last_name, customer->last_name, MAX_LAST_NAME);
+    memcpy(packed->email, customer->email, MAX_EMAIL);
+    memcpy(packed->city, customer->city, MAX_CITY);
+    
+    /* Phones were normalized on parse; anything else is not canonical */
+    if (customer->phone[0] == '\0') {
+        packed->phone = PACKED_PHONE_EMPTY;
+    } else if (derived != NULL) {
+        if (!derived->phone_valid) return 4;
+        packed->phone = derived->phone_number;
+    } else {
+        if (!parse_phone(customer->phone, &packed->phone)) return 4;
+        format_phone(packed->phone, phone);
+        if (strcmp(phone, customer->phone) != 0) return 4;
+    }
+    
+    if (customer->state[0] == '\0') {
+        packed->state = 0;
+    } else if ((packed->state = (unsigned char)state_ordinal(customer->state)) == 0) {
+        return 6;
+    }
+    
+    if (customer->zip_code[0] == '\0') {
+        packed->zip_code = PACKED_ZIP_EMPTY;
+    } else {
+        packed->zip_code = 0;
+        for (int i = 0; i < 5; i++) {
+            unsigned int digit = (unsigned char)customer->zip_code[i] - (unsigned int)'0';
+            if (digit > 9) return 7;
+            packed->zip_code = packed->zip_code * 10 + digit;
+        }
+        if (customer->zip_code[5] != '\0') return 7;
+    }
+    
+    if (customer->registration_date[0] == '\0') {
+        packed->registration_date = PACKED_DATE_EMPTY;
+    } else if (derived != NULL) {
+        if (!derived->date_valid) return 8;
+        packed->registration_date = derived->registration_days;
+    } else if (!parse_date(customer->registration_date, &packed->registration_date)) {
+        return 8;
+    }
+    return -1;
+}
+
+/*
+ * Function: unpack_customer
+ * Description: Rebuild the text record from a packed one
+ */
+void unpack_customer(const PackedCustomer *packed, Customer *customer) {
+    memset(customer, 0, sizeof(Customer));
+    customer->customer_id = packed->customer_id;
+    memcpy(customer->first_name, packed->first_name, MAX_FIRST_NAME);
+    memcpy(customer->last_name, packed->last_name, MAX_LAST_NAME);
+    memcpy(customer->email, packed->email, MAX_EMAIL);
+    memcpy(customer->city, packed->city, MAX_CITY);
+    if (packed->phone != PACKED_PHONE_EMPTY) format_phone(packed->phone, customer->phone);
+    memcpy(customer->state, state_code(packed->state), MAX_STATE);
+    if (packed->zip_code != PACKED_ZIP_EMPTY) {
+        snprintf(customer->zip_code, MAX_ZIP_CODE, "%05u", packed->zip_code % 100000u);
+    }
+    if (packed->registration_date != PACKED_DATE_EMPTY) {
+        format_date(packed->registration_date, customer->registration_date);
+    }
+}
+
+/*
+ * Function: init_zip_prefix_table
+ * Description: Expand ZIP_PREFIX_RANGES into the prefix -> state ordinal table
+ */
+void init_zip_prefix_table(void) {
+    memset(zip_prefix_states, 0, sizeof(zip_prefix_states));
+    
+    for (size_t i = 0; i < sizeof(ZIP_PREFIX_RANGES) / sizeof(ZIP_PREFIX_RANGES[0]); i++) {
+        int ordinal = state_ordinal(ZIP_PREFIX_RANGES[i].state);
+        for (int p = ZIP_PREFIX_RANGES[i].first; p <= ZIP_PREFIX_RANGES[i].last; p++) {
+            zip_prefix_states[p] = (unsigned char)ordinal;
+        }
+    }
+    zip_prefix_states[969] = ZIP_PREFIX_PACIFIC;
+}
+
+/*
+ * Function: validate_zip_state
+ * Description: Check that the ZIP code's 3-digit prefix belongs to the state.
+ *              Returns 1 if they agree or either field is not checkable
+ *              (the per-field rules report those), 0 on a mismatch.
+ */
+int validate_zip_state(const char *zip, const char *state) {
+    unsigned int d0 = (unsigned char)zip[0] - (unsigned int)'0';
+    unsigned int d1, d2;
+    int ordinal, expected;
+    
+    if (d0 > 9) return 1;
+    d1 = (unsigned char)zip[1] - (unsigned int)'0';
+    if (d1 > 9) return 1;
+    d2 = (unsigned char)zip[2] - (unsigned int)'0';
+    if (d2 > 9) return 1;
+    
+    ordinal = state_ordinal(state);
+    if (ordinal == 0) return 1;
+    
+    /* Unassigned prefixes (000-004, 269, 886-888, ...) are not checkable */
+    expected = zip_prefix_states[d0 * 100 + d1 * 10 + d2];
+    if (expected == 0 || expected == ordinal) return 1;
+    
+    if (expected == ZIP_PREFIX_PACIFIC) {
+        const char *code = state_code(ordinal);
+        return strcmp(code, "GU") == 0 || strcmp(code, "MP") == 0 ||
+               strcmp(code, "FM") == 0 || strcmp(code, "MH") == 0 ||
+               strcmp(code, "PW") == 0;
+    }
+    
+    /* American Samoa has a single ZIP inside Hawaii's 967 range */
+    return strcmp(zip, "96799") == 0 && strcmp(state_code(ordinal), "AS") == 0;
+}
+
+/*
+ * Function: validate_customer
+ * Description: Validate all customer fields based on rules
+ */
+int validate_customer(Customer *customer, const CustomerDerived *derived, int line_num, 
+                      int *error_code_out) {
+    int error_code = VAL_OK;
+    int is_valid = 1;
+    
+    /* Validate customer ID (always required) */
+    if (customer->customer_id <= 0) {
+        error_code |= VAL_ERR_INVALID_ID;
+        is_valid = 0;
+    }
+    
+    /* Check for empty required fields */
+    if (!validation_rules.allow_empty_fields) {
+        if (strlen(customer->first_name) == 0 || 
+            strlen(customer->last_name) == 0) {
+            error_code |= VAL_ERR_EMPTY_FIELD;
+            is_valid = 0;
+        }
+    }
+    
+    /* Validate email */
+    if (validation_rules.validate_email && strlen(customer->email) > 0) {
+        if (!derived->email_valid) {
+            error_code |= VAL_ERR_INVALID_EMAIL;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Validate phone */
+    if (validation_rules.validate_phone && strlen(customer->phone) > 0) {
+        if (!derived->phone_valid) {
+            error_code |= VAL_ERR_INVALID_PHONE;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Validate date */
+    if (validation_rules.validate_date && strlen(customer->registration_date) > 0) {
+        if (!derived->date_valid) {
+            error_code |= VAL_ERR_INVALID_DATE;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Validate state */
+    if (validation_rules.validate_state && strlen(customer->state) > 0) {
+        if (!validate_state(customer->state)) {
+            error_code |= VAL_ERR_INVALID_STATE;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Validate ZIP */
+    if (validation_rules.validate_zip && strlen(customer->zip_code) > 0) {
+        if (!validate_zip(customer->zip_code)) {
+            error_code |= VAL_ERR_INVALID_ZIP;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Cross-field: ZIP prefix must belong to the state */
+    if (validation_rules.check_zip_state) {
+        if (!validate_zip_state(customer->zip_code, customer->state)) {
+            error_code |= VAL_ERR_ZIP_STATE;
+            stats.zip_state_mismatches++;
+            if (validation_rules.strict_mode) {
+                is_valid = 0;
+            } else {
+                stats.validation_warnings++;
+            }
+        }
+    }
+    
+    /* Log validation issues */
+    if (error_code != VAL_OK) {
+        if (!is_valid) {
+            stats.validation_errors++;
+        }
+        log_validation_warning(line_num, error_code, !is_valid);
+    }
+    
+    if (error_code_out != NULL) *error_code_out = error_code;
+    return is_valid;
+}
+
+/*
+ * Function: decode_staged_dates
+ * Description: Decode registration dates for a batch of staged records
+ */
+void decode_staged_dates(StagedRecord *staged, int count) {
+    const char *dates[DATE_BATCH] = {0};
+    int days[DATE_BATCH];
+    unsigned int valid;
+    
+    for (int i = 0; i < count; i++) {
+        dates[i] = staged[i].customer.registration_date;
+    }
+    
+    valid = parse_dates_x8(dates, count, days);
+    
+    for (int i = 0; i < count; i++) {
+        staged[i].derived.date_valid = (unsigned char)((valid >> i) & 1u);
+        staged[i].derived.registration_days = staged[i].derived.date_valid ? days[i] : 0;
+    }
+}
+
+/*
+ * Function: structural_check
+ * Description: Cheap shape test used by sampled validation: lengths and
+ *              separator positions only, no character-class scans
+ */
+int structural_check(const Customer *customer) {
+    size_t email_len = strlen(customer->email);
+    
+    if (customer->customer_id <= 0) return 0;
+    if (customer->first_name[0] == '\0' || customer->last_name[0] == '\0') return 0;
+    if (email_len < 6 || memchr(customer->email, '@', email_len) == NULL) return 0;
+    if (strlen(customer->phone) != 12 || 
+        customer->phone[3] != '-' || customer->phone[7] != '-') return 0;
+    if (strlen(customer->registration_date) != 10 ||
+        customer->registration_date[4] != '-' || customer->registration_date[7] != '-') return 0;
+    if (strlen(customer->state) != 2) return 0;
+    if (strlen(customer->zip_code) != 5) return 0;
+    
+    return 1;
+}
+
+/*
+ * Function: sample_selects
+ * Description: Deterministic pseudo-random 1-in-N pick keyed on line number
+ *              (splitmix64), so reruns sample the same records
+ */
+int sample_selects(int line_num) {
+    unsigned long long z = (unsigned long long)line_num + 0x9e3779b97f4a7c15ULL;
+    
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    
+    return (z % (unsigned long long)options.sample_rate) == 0;
+}
+
+/*
+ * Function: wilson_interval
+ * Description: 95% Wilson score interval for an error proportion
+ */
+void wilson_interval(int errors, int n, double *low, double *high) {
+    double p, z2, denom, center, half;
+    
+    if (n <= 0) {
+        *low = 0.0;
+        *high = 1.0;
+        return;
+    }
+    
+    p = (double)errors / n;
+    z2 = SAMPLE_Z_95 * SAMPLE_Z_95;
+    denom = 1.0 + z2 / n;
+    center = (p + z2 / (2.0 * n)) / denom;
+    half = SAMPLE_Z_95 * sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n)) / denom;
+    
+    *low = (center - half < 0.0) ? 0.0 : center - half;
+    *high = (center + half > 1.0) ? 1.0 : center + half;
+}
+
+/*
+ * Function: validate_sampled
+ * Description: Validate according to --validate-sample. Records picked by the
+ *              sampler or failing the structural check get full validation;
+ *              the rest pass unchecked. Falls back to full validation once
+ *              the sampled error rate is confidently above the threshold.
+ */
+int validate_sampled(Customer *customer, const CustomerDerived *derived, int line_num) {
+    int sampled, error_code, is_valid;
+    double low, high;
+    
+    if (options.sample_rate <= 1) {
+        return validate_customer(customer, derived, line_num, NULL);
+    }
+    
+    sampled = sample_selects(line_num);
+    if (!sampled) {
+        if (structural_check(customer)) {
+            stats.unvalidated_records++;
+            return 1;
+        }
+        stats.structural_validations++;
+        return validate_customer(customer, derived, line_num, NULL);
+    }
+    
+    is_valid = validate_customer(customer, derived, line_num, &error_code);
+    stats.sampled_records++;
+    if (error_code != VAL_OK) stats.sampled_errors++;
+    
+    /* Lower bound of the interval keeps a few early errors from tripping it */
+    if (stats.sampled_records >= SAMPLE_MIN_RECORDS) {
+        wilson_interval(stats.sampled_errors, stats.sampled_records, &low, &high);
+        if (low > options.sample_max_error) {
+            log_message(LOG_WARNING, "Line %d: Sampled error rate %.2f%% exceeds %.2f%%, "
+                       "switching to full validation", line_num, 
+                       100.0 * stats.sampled_errors / stats.sampled_records,
+                       100.0 * options.sample_max_error);
+            stats.sample_fallback_line = line_num;
+            options.sample_rate = 0;
+        }
+    }
+    
+    return is_valid;
+}
+
+/*
+ * Function: next_csv_field
+ * Description: Extract one (optionally quoted) CSV field starting at *cursor
+ *              into field_buffer (MAX_LINE bytes), advance *cursor to the
+ *              next field, and return the whitespace-trimmed value
+ */
+char* next_csv_field(char **cursor, char *field_buffer) {
+    char *field_start = *cursor;
+    char *field_end;
+    int buffer_pos = 0;
+    int in_quotes = 0;
+    
+    /* Handle quoted fields (CSV standard) */
+    if (*field_start == '"') {
+        in_quotes = 1;
+        field_start++;
+    }
+    
+    /* Extract field */
+    field_end = field_start;
+    while (*field_end != '\0') {
+        if (in_quotes) {
+            if (*field_end == '"') {
+                /* Check for escaped quote */
+                if (*(field_end + 1) == '"') {
+                    field_buffer[buffer_pos++] = '"';
+                    field_end += 2;
+                    continue;
+                } else {
+                    in_quotes = 0;
+                    field_end++;
+                    break;
+                }
+            }
+        } else {
+            if (*field_end == ',') {
+                break;
+            }
+        }
+        
+        if (buffer_pos < MAX_LINE - 1) {
+            field_buffer[buffer_pos++] = *field_end;
+        }
+        field_end++;
+    }
+    
+    field_buffer[buffer_pos] = '\0';
+    
+    /* Move to next field */
+    *cursor = (*field_end == ',') ? field_end + 1 : field_end;
+    
+    /* Trim whitespace */
+    return trim_whitespace(field_buffer);
+}
+
+/*
+ * Function: parse_csv_line
+ * Description: Parse CSV line with robust error handling
+ */
+int parse_csv_line(char *line, Customer *customer, int line_num) {
+    char *field_start = line;
+    int field_count = 0;
+    char field_buffer[MAX_LINE];
+    
+    /* Initialize customer structure */
+    memset(customer, 0, sizeof(Customer));
+    
+    /* Sanitize input for security */
+    sanitize_input(line);
+    
+    while (*field_start != '\0' && field_count < 9) {
+        char *trimmed = next_csv_field(&field_start, field_buffer);
+        
+        /* Assign to appropriate field */
+        switch (field_count) {
+            case 0: /* customer_id */
+                if (!safe_atoi(trimmed, &customer->customer_id)) {
+                    log_parse_error(line_num, line, PARSE_ERR_INVALID_ID);
+                    return 0;
+                }
+                break;
+            case 1: /* first_name */
+                if (strlen(trimmed) >= MAX_FIRST_NAME) {
+                    log_event(LOG_WARNING, LOG_EVT_FIELD_TRUNCATED, line_num, 1);
+                    stats.validation_warnings++;
+                }
+                secure_strncpy(customer->first_name, trimmed, MAX_FIRST_NAME);
+                break;
+            case 2: /* last_name */
+                if (strlen(trimmed) >= MAX_LAST_NAME) {
+                    log_event(LOG_WARNING, LOG_EVT_FIELD_TRUNCATED, line_num, 2);
+                    stats.validation_warnings++;
+                }
+                secure_strncpy(customer->last_name, trimmed, MAX_LAST_NAME);
+                break;
+            case 3: /* email */
+                if (strlen(trimmed) >= MAX_EMAIL) {
+                    log_event(LOG_WARNING, LOG_EVT_FIELD_TRUNCATED, line_num, 3);
+                    stats.validation_warnings++;
+                }
+                secure_strncpy(customer->email, trimmed, MAX_EMAIL);
+                break;
+            case 4: /* phone */
+                secure_strncpy(customer->phone, trimmed, MAX_PHONE);
+                break;
+            case 5: /* city */
+                if (strlen(trimmed) >= MAX_CITY) {
+                    log_event(LOG_WARNING, LOG_EVT_FIELD_TRUNCATED, line_num, 5);
+                    stats.validation_warnings++;
+                }
+                secure_strncpy(customer->city, trimmed, MAX_CITY);
+                break;
+            case 6: /* state */
+                secure_strncpy(customer->state, trimmed, MAX_STATE);
+                break;
+            case 7: /* zip_code */
+                secure_strncpy(customer->zip_code, trimmed, MAX_ZIP_CODE);
+                break;
+            case 8: /* registration_date */
+                secure_strncpy(customer->registration_date, trimmed, MAX_DATE);
+                break;
+        }
+        
+        field_count++;
+    }
+    
+    /* Verify we got all required fields */
+    if (field_count != 9) {
+        log_parse_error(line_num, line, PARSE_ERR_MISSING_FIELDS);
+        return 0;
+    }
+    
+    return 1;
+}
+
+/*
+ * Function: idset_init
+ * Description: Initialize an empty key set (bitmap mode)
+ */
+int idset_init(IdSet *set) {
+    memset(set, 0, sizeof(IdSet));
+    set->mode = IDSET_BITMAP;
+    return 1;
+}
+
+/*
+ * Function: idset_free
+ * Description: Release memory held by a key set
+ */
+void idset_free(IdSet *set) {
+    free(set->bits);
+    free(set->slots);
+    memset(set, 0, sizeof(IdSet));
+}
+
+/*
+ * Function: idset_hash_slot
+ * Description: Fibonacci hash of a key into a power-of-two table
+ */
+static size_t idset_hash_slot(unsigned int key, size_t slot_count) {
+    return (size_t)((key * 2654435769u) & (unsigned int)(slot_count - 1));
+}
+
+/*
+ * Function: idset_hash_put
+ * Description: Insert into the hash table (no growth); returns 1 if new
+ */
+static int idset_hash_put(unsigned int *slots, size_t slot_count, unsigned int key) {
+    size_t i = idset_hash_slot(key, slot_count);
+    
+    while (slots[i] != 0) {
+        if (slots[i] == key) return 0;
+        i = (i + 1) & (slot_count - 1);
+    }
+    slots[i] = key;
+    return 1;
+}
+
+/*
+ * Function: idset_hash_grow
+ * Description: Double the hash table (or create it) and rehash all keys
+ */
+static int idset_hash_grow(IdSet *set) {
+    size_t new_count = (set->slot_count == 0) ? IDSET_HASH_INITIAL : set->slot_count * 2;
+    unsigned int *new_slots = (unsigned int *)calloc(new_count, sizeof(unsigned int));
+    
+    if (new_slots == NULL) return 0;
+    
+    for (size_t i = 0; i < set->slot_count; i++) {
+        if (set->slots[i] != 0) {
+            idset_hash_put(new_slots, new_count, set->slots[i]);
+        }
+    }
+    
+    free(set->slots);
+    set->slots = new_slots;
+    set->slot_count = new_count;
+    return 1;
+}
+
+/*
+ * Function: idset_to_hash
+ * Description: Migrate a bitmap that has become too sparse into hash mode
+ */
+static int idset_to_hash(IdSet *set) {
+    size_t needed = IDSET_HASH_INITIAL;
+    
+    while (needed < set->count * 2 + 2) needed *= 2;
+    
+    set->slots = (unsigned int *)calloc(needed, sizeof(unsigned int));
+    if (set->slots == NULL) return 0;
+    set->slot_count = needed;
+    
+    for (size_t w = 0; w < set->bit_words; w++) {
+        unsigned long long word = set->bits[w];
+        while (word != 0) {
+            int bit = 0;
+            while (!((word >> bit) & 1ULL)) bit++;
+            word &= word - 1;  /* Clear lowest set bit */
+            
+            unsigned int key = (unsigned int)(w * 64 + bit);
+            if (key == 0) {
+                set->has_zero = 1;
+            } else {
+                idset_hash_put(set->slots, set->slot_count, key);
+            }
+        }
+    }
+    
+    free(set->bits);
+    set->bits = NULL;
+    set->bit_words = 0;
+    set->mode = IDSET_HASH;
+    
+    log_message(LOG_INFO, "Key range is sparse, switched duplicate check to hash set "
+               "(%zu keys)", set->count);
+    return 1;
+}
+
+/*
+ * Function: idset_contains
+ * Description: Test whether a key is in the set
+ */
+int idset_contains(const IdSet *set, unsigned int key) {
+    if (set->mode == IDSET_BITMAP) {
+        size_t word = key / 64;
+        if (word >= set->bit_words) return 0;
+        return (int)((set->bits[word] >> (key % 64)) & 1ULL);
+    }
+    
+    if (key == 0) return set->has_zero;
+    if (set->slot_count == 0) return 0;
+    
+    for (size_t i = idset_hash_slot(key, set->slot_count); set->slots[i] != 0; 
+         i = (i + 1) & (set->slot_count - 1)) {
+        if (set->slots[i] == key) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Function: idset_insert
+ * Description: Add a key; returns 1 if newly added, 0 if already present,
+ *              -1 on allocation failure
+ */
+int idset_insert(IdSet *set, unsigned int key) {
+    if (set->mode == IDSET_BITMAP) {
+        size_t word = key / 64;
+        
+        if (word >= set->bit_words) {
+            unsigned long long needed_bits = ((unsigned long long)word + 1) * 64;
+            
+            /* Too sparse for a bitmap: fall through to the hash set */
+            if (needed_bits > IDSET_DENSE_MIN_BITS &&
+                needed_bits > (unsigned long long)(set->count + 1) * IDSET_DENSE_BITS_PER_ID) {
+                if (!idset_to_hash(set)) return -1;
+                return idset_insert(set, key);
+            }
+            
+            /* Just past the largest key: amortized, but not doubled */
+            size_t new_words = set->bit_words + (set->bit_words >> IDSET_GROW_SHIFT);
+            if (new_words <= word) new_words = word + 1;
+            new_words = (new_words + IDSET_GROW_WORDS - 1) / IDSET_GROW_WORDS * IDSET_GROW_WORDS;
+            
+            unsigned long long *new_bits = (unsigned long long *)realloc(
+                set->bits, new_words * sizeof(unsigned long long));
+            if (new_bits == NULL) return -1;
+            
+            memset(new_bits + set->bit_words, 0, 
+                   (new_words - set->bit_words) * sizeof(unsigned long long));
+            set->bits = new_bits;
+            set->bit_words = new_words;
+        }
+        
+        unsigned long long mask = 1ULL << (key % 64);
+        if (set->bits[word] & mask) return 0;
+        set->bits[word] |= mask;
+        set->count++;
+        return 1;
+    }
+    
+    if (key == 0) {
+        if (set->has_zero) return 0;
+        set->has_zero = 1;
+        set->count++;
+        return 1;
+    }
+    
+    /* Keep load factor at or below 0.5 */
+    if ((set->count + 1) * 2 > set->slot_count) {
+        if (!idset_hash_grow(set)) return -1;
+    }
+    
+    if (!idset_hash_put(set->slots, set->slot_count, key)) return 0;
+    set->count++;
+    return 1;
+}
+
+/*
+ * Function: idset_memory_bytes
+ * Description: Bytes currently allocated by a key set
+ */
+size_t idset_memory_bytes(const IdSet *set) {
+    return set->bit_words * sizeof(unsigned long long) + 
+           set->slot_count * sizeof(unsigned int);
+}
+
+/*
+ * Function: check_duplicate
+ * Description: Apply the duplicate customer_id policy to a parsed record.
+ *              Returns 1 if the record should be written, 0 if it is dropped.
+ *              keep-last replaces a buffered copy together with its domain ID
+ *              and packed form.
+ */
+int check_duplicate(const StagedRecord *record, Customer *buffer, 
+                    unsigned int *buffer_domain_ids, PackedCustomer *buffer_packed, 
+                    int buffer_count) {
+    const Customer *customer = &record->customer;
+    int line_num = record->line_number;
+    int inserted;
+    
+    if (options.duplicate_policy == DUP_POLICY_OFF) return 1;
+    
+    inserted = idset_insert(&seen_ids, (unsigned int)customer->customer_id);
+    if (inserted < 0) {
+        log_message(LOG_ERROR, "Out of memory in duplicate check, disabling it");
+        options.duplicate_policy = DUP_POLICY_OFF;
+        return 1;
+    }
+    if (inserted) return 1;
+    
+    stats.duplicate_records++;
+    
+    switch (options.duplicate_policy) {
+        case DUP_POLICY_REJECT:
+            log_parse_error(line_num, record->line, PARSE_ERR_DUPLICATE_ID);
+            stats.failed_records++;
+            return 0;
+            
+        case DUP_POLICY_KEEP_FIRST:
+            log_event(LOG_DEBUG, LOG_EVT_DUPLICATE_DROPPED, line_num, customer->customer_id);
+            return 0;
+            
+        case DUP_POLICY_KEEP_LAST:
+            /* Earlier copy still buffered: overwrite it in place */
+            for (int i = buffer_count - 1; i >= 0; i--) {
+                if (buffer[i].customer_id == customer->customer_id) {
+                    buffer[i] = *customer;
+                    buffer_domain_ids[i] = record->derived.domain_id;
+                    if (options.packed) buffer_packed[i] = record->packed;
+                    return 0;
+                }
+            }
+            
+            /* Earlier copy already on disk: patch it after the output is closed */
+            if (pending_count >= pending_capacity) {
+                int new_capacity = (pending_capacity == 0) ? 256 : pending_capacity * 2;
+                Customer *grown = (Customer *)realloc(pending_replacements, 
+                                                      new_capacity * sizeof(Customer));
+                if (grown == NULL) {
+                    log_message(LOG_ERROR, "Line %d: Out of memory, keeping first copy of "
+                               "customer ID %d", line_num, customer->customer_id);
+                    return 0;
+                }
+                pending_replacements = grown;
+                pending_capacity = new_capacity;
+            }
+            pending_replacements[pending_count++] = *customer;
+            return 0;
+            
+        default:
+            return 1;
+    }
+}
+
+/*
+ * Function: compare_pending_id
+ * Description: qsort/bsearch comparator on customer_id
+ */
+static int compare_pending_id(const void *a, const void *b) {
+    int ia = ((const Customer *)a)->customer_id;
+    int ib = ((const Customer *)b)->customer_id;
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Function: patch_records
+ * Description: Replace records in chunk that have a pending keep-last
+ *              replacement (and their domain ID entries). Returns how many.
+ */
+static int patch_records(Customer *chunk, size_t n, long long first_record, int unique, 
+                         FILE *ids) {
+    int patched = 0;
+    
+    for (size_t i = 0; i < n; i++) {
+        Customer key;
+        Customer *match;
+        
+        key.customer_id = chunk[i].customer_id;
+        match = (Customer *)bsearch(&key, pending_replacements, unique, 
+                                    sizeof(Customer), compare_pending_id);
+        if (match != NULL) {
+            chunk[i] = *match;
+            patched++;
+            
+            if (ids != NULL) {
+                unsigned int id = email_domain_id(match->email);
+                long long record = first_record + (long long)i;
+                FSEEK64(ids, record * (long long)sizeof(unsigned int), SEEK_SET);
+                fwrite(&id, sizeof(id), 1, ids);
+            }
+        }
+    }
+    return patched;
+}
+
+/*
+ * Function: patch_blocks
+ * Description: keep-last for block layout output: decode each block, patch
+ *              it, re-encode it in place and refresh its checksum in the
+ *              block header and the index
+ */
+static int patch_blocks(FILE *f, const char *output_file, unsigned int flags, int unique, 
+                        FILE *ids) {
+    BlockTrailer trailer;
+    BlockIndexEntry *index;
+    unsigned char *payload = NULL;
+    unsigned char *rows = NULL;
+    size_t payload_capacity = 0;
+    size_t rows_capacity = 0;
+    int patched = 0;
+    int index_dirty = 0;
+    int ok = 1;
+    
+    if (!read_block_index(f, output_file, &trailer, &index)) return -1;
+    
+    for (unsigned int b = 0; b < trailer.block_count && ok; b++) {
+        BlockIndexEntry *entry = &index[b];
+        BlockHeader header;
+        int changed;
+        
+        ok = 0;
+        FSEEK64(f, entry->offset, SEEK_SET);
+        if (!ensure_capacity(&payload, &payload_capacity, entry->stored_size) ||
+            !ensure_capacity(&rows, &rows_capacity, (size_t)entry->record_count * sizeof(Customer)) ||
+            fread(&header, sizeof(BlockHeader), 1, f) != 1 ||
+            fread(payload, 1, entry->stored_size, f) != entry->stored_size ||
+            !decode_block(flags, sizeof(Customer), payload, entry->stored_size, 
+                          entry->record_count, rows)) {
+            log_message(LOG_ERROR, "Could not read block %u of '%s'", b, output_file);
+            break;
+        }
+        ok = 1;
+        
+        changed = patch_records((Customer *)rows, entry->record_count, entry->first_record, 
+                                unique, ids);
+        if (changed == 0) continue;
+        
+        /* Fixed-width encodings keep their size, so the block is rewritten in place */
+        if (encode_block(flags, sizeof(Customer), rows, entry->record_count, payload) != 
+            entry->stored_size) {
+            log_message(LOG_ERROR, "Block %u of '%s' changed size while patching", b, output_file);
+            ok = 0;
+            break;
+        }
+        header.crc32c = entry->crc32c = crc32c(0, payload, entry->stored_size);
+        FSEEK64(f, entry->offset, SEEK_SET);
+        fwrite(&header, sizeof(BlockHeader), 1, f);
+        fwrite(payload, 1, entry->stored_size, f);
+        patched += changed;
+        index_dirty = 1;
+    }
+    
+    if (index_dirty) {
+        size_t index_bytes = (size_t)trailer.block_count * sizeof(BlockIndexEntry);
+        trailer.index_crc32c = crc32c(0, index, index_bytes);
+        FSEEK64(f, trailer.index_offset, SEEK_SET);
+        fwrite(index, 1, index_bytes, f);
+        fwrite(&trailer, sizeof(BlockTrailer), 1, f);
+    }
+    
+    free(payload);
+    free(rows);
+    free(index);
+    return ok ? patched : -1;
+}
+
+/*
+ * Function: rewrite_records
+ * Description: keep-last for layouts that cannot be patched in place
+ *              (variable-size blocks, packed records): read every record
+ *              back as a Customer, patch it and write it to out, which
+ *              already holds the header, in the output layout
+ */
+static int rewrite_records(FILE *f, const char *output_file, const BinaryFileHeader *header, 
+                           int unique, FILE *ids, Customer *chunk, FILE *out) {
+    RecordReader reader;
+    int blocked = (header->flags & BINARY_FLAG_BLOCKS) != 0;
+    long long expected;
+    long long total = 0;
+    size_t n;
+    int patched = 0;
+    int ok;
+    
+    FSEEK64(f, 0, SEEK_SET);
+    if (!record_reader_open(&reader, f, output_file, sizeof(Customer), &expected)) return -1;
+    
+    ok = !blocked || block_writer_open(out, output_record_size());
+    while (ok && (n = record_reader_read(&reader, chunk, WRITE_BUFFER_SIZE)) > 0) {
+        patched += patch_records(chunk, n, total, unique, ids);
+        ok = write_customers(out, chunk, (int)n);
+        total += (long long)n;
+    }
+    record_reader_close(&reader);
+    if (blocked && !block_writer_close(out)) ok = 0;
+    
+    if (ok && total != expected) {
+        log_message(LOG_ERROR, "Read back %lld of %lld records from '%s'", 
+                   total, expected, output_file);
+        ok = 0;
+    }
+    return ok ? patched : -1;
+}
+
+/*
+ * Function: apply_pending_replacements
+ * Description: keep-last policy: overwrite already written records with the
+ *              last duplicate seen for their customer_id. One sequential pass
+ *              over the output, only when such duplicates exist.
+ */
+int apply_pending_replacements(const char *output_file) {
+    FILE *f;
+    Customer *chunk;
+    IdSet latest;
+    BinaryFileHeader header;
+    int unique = 0;
+    int patched = 0;
+    long long offset;
+    long long data_start;
+    FILE *ids = NULL;
+    FILE *out = NULL;
+    char temp_file[MAX_PATH_LEN + sizeof(".tmp")];
+    
+    if (pending_count == 0) return 1;
+    
+    /* Walk newest to oldest so only the last entry per ID survives. Survivors
+     * fill the array from the back: slot i is only written once it was read. */
+    idset_init(&latest);
+    for (int i = pending_count - 1; i >= 0; i--) {
+        if (idset_insert(&latest, (unsigned int)pending_replacements[i].customer_id) > 0) {
+            unique++;
+            pending_replacements[pending_count - unique] = pending_replacements[i];
+        }
+    }
+    idset_free(&latest);
+    memmove(pending_replacements, pending_replacements + (pending_count - unique), 
+            (size_t)unique * sizeof(Customer));
+    qsort(pending_replacements, unique, sizeof(Customer), compare_pending_id);
+    
+    if (options.domain_ids) {
+        char ids_file[MAX_PATH_LEN + sizeof(".domain_ids")];
+        snprintf(ids_file, sizeof(ids_file), "%s.domain_ids", output_file);
+        ids = fopen(ids_file, "r+b");
+    }
+    
+    f = fopen(output_file, "r+b");
+    chunk = (Customer *)malloc(WRITE_BUFFER_SIZE * sizeof(Customer));
+    if (f == NULL || chunk == NULL) {
+        log_message(LOG_ERROR, "Could not reopen '%s' to apply keep-last duplicates", 
+                   output_file);
+        if (f) fclose(f);
+        if (ids) fclose(ids);
+        free(chunk);
+        return 0;
+    }
+    
+    data_start = read_file_header(f, output_file, sizeof(Customer), &header);
+    if (data_start >= 0 && (header.flags & (BINARY_FLAGS_VARIABLE | BINARY_FLAG_PACKED))) {
+        /* Rewrite into a temporary file: header bytes as is, then the records */
+        long long old_size;
+        
+        snprintf(temp_file, sizeof(temp_file), "%s.tmp", output_file);
+        out = fopen(temp_file, "wb");
+        FSEEK64(f, 0, SEEK_END);
+        old_size = FTELL64(f);
+        FSEEK64(f, 0, SEEK_SET);
+        if (out == NULL || fread(chunk, 1, (size_t)data_start, f) != (size_t)data_start ||
+            fwrite(chunk, 1, (size_t)data_start, out) != (size_t)data_start) {
+            log_message(LOG_ERROR, "Could not create '%s' to apply keep-last duplicates", 
+                       temp_file);
+            patched = -1;
+        } else {
+            stats.bytes_written -= old_size - data_start;
+            patched = rewrite_records(f, output_file, &header, unique, ids, chunk, out);
+        }
+        if (out != NULL && fclose(out) != 0) patched = -1;
+        data_start = (patched < 0) ? -1 : data_start;
+    } else if (data_start >= 0 && (header.flags & BINARY_FLAG_BLOCKS)) {
+        patched = patch_blocks(f, output_file, header.flags, unique, ids);
+        data_start = (patched < 0) ? -1 : data_start;
+    } else if (data_start >= 0) {
+        offset = data_start;
+        for (;;) {
+            size_t n = fread(chunk, sizeof(Customer), WRITE_BUFFER_SIZE, f);
+            int changed;
+            
+            if (n == 0) break;
+            
+            changed = patch_records(chunk, n, 
+                                    (offset - data_start) / (long long)sizeof(Customer), 
+                                    unique, ids);
+            if (changed > 0) {
+                FSEEK64(f, offset, SEEK_SET);
+                fwrite(chunk, sizeof(Customer), n, f);
+                fflush(f);
+                patched += changed;
+            }
+            offset += (long long)(n * sizeof(Customer));
+            FSEEK64(f, offset, SEEK_SET);
+        }
+    }
+    
+    fclose(f);
+    if (ids) fclose(ids);
+    free(chunk);
+    if (out != NULL) {
+        /* rename() does not replace an existing file on Windows */
+        if (data_start >= 0 && (remove(output_file) != 0 || rename(temp_file, output_file) != 0)) {
+            log_message(LOG_ERROR, "Could not replace '%s' with '%s'", output_file, temp_file);
+            data_start = -1;
+        }
+        if (data_start < 0) {
+            remove(temp_file);
+            return 0;
+        }
+    }
+    if (data_start < 0) return 0;
+    
+    log_message(LOG_INFO, "Applied %d keep-last duplicate replacements", patched);
+    return 1;
+}
+
+/*
+ * Function: compare_domain_id
+ * Description: qsort comparator ordering dictionary entries by ID
+ */
+static int compare_domain_id(const void *a, const void *b) {
+    unsigned int ia = (*(const DomainEntry * const *)a)->id;
+    unsigned int ib = (*(const DomainEntry * const *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Function: write_domain_dictionary
+ * Description: Write the ID -> domain mapping for the domain ID column as
+ *              CSV (domain_id,domain,records)
+ */
+int write_domain_dictionary(const char *filename) {
+    DomainEntry **order;
+    FILE *f;
+    size_t n = 0;
+    
+    order = (DomainEntry **)malloc((email_domains.next_id + 1) * sizeof(DomainEntry *));
+    f = fopen(filename, "w");
+    if (order == NULL || f == NULL) {
+        log_message(LOG_ERROR, "Could not write domain dictionary '%s'", filename);
+        if (f) fclose(f);
+        free(order);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < email_domains.slot_count; i++) {
+        if (email_domains.slots[i].len != 0 && email_domains.slots[i].id != 0) {
+            order[n++] = &email_domains.slots[i];
+        }
+    }
+    qsort(order, n, sizeof(DomainEntry *), compare_domain_id);
+    
+    fprintf(f, "domain_id,domain,records\n");
+    for (size_t i = 0; i < n; i++) {
+        fprintf(f, "%u,%.*s,%lld\n", order[i]->id, (int)order[i]->len, 
+                email_domains.names + order[i]->name_offset, order[i]->records);
+    }
+    
+    fclose(f);
+    free(order);
+    log_message(LOG_INFO, "Domain dictionary saved to: %s (%zu domains)", filename, n);
+    return 1;
+}
+
+/*
+ * Function: write_file_header
+ * Description: Write the output header with the record count left unknown;
+ *              finalize_file_header fills it in once all records are written
+ */
+int write_file_header(FILE *binary, size_t record_size) {
+    BinaryFileHeader *header = &output_header;
+    
+    memset(header, 0, sizeof(BinaryFileHeader));
+    memcpy(header->magic, BINARY_MAGIC, 4);
+    header->version = BINARY_FORMAT_VERSION;
+    header->header_size = BINARY_HEADER_SIZE;
+    header->record_size = (unsigned int)record_size;
+    header->record_count = BINARY_COUNT_UNKNOWN;
+    header->created = (long long)stats.start_time;
+    if (options.block_size > 0) header->flags |= BINARY_FLAG_BLOCKS;
+    if (options.columnar) header->flags |= BINARY_FLAG_COLUMNAR;
+    if (options.compact) header->flags |= BINARY_FLAG_COMPACT;
+    if (options.dictionary) header->flags |= BINARY_FLAG_DICTIONARY;
+    if (options.packed) header->flags |= BINARY_FLAG_PACKED;
+    if (options.compress_level) header->flags |= BINARY_FLAG_COMPRESSED;
+    secure_strncpy(header->record_type, options.transactions_mode ? "transaction" : "customer", 
+                   sizeof(header->record_type));
+    secure_strncpy(header->schema, options.transactions_mode ? TRANSACTION_SCHEMA : 
+                   options.packed ? PACKED_CUSTOMER_SCHEMA : CUSTOMER_SCHEMA, 
+                   sizeof(header->schema));
+    snprintf(header->params, sizeof(header->params), 
+             "converter=%s strict=%d email=%d phone=%d date=%d state=%d zip=%d "
+             "zip_state=%d allow_empty=%d dedup=%s validate_sample=%d block_size=%d "
+             "columnar=%d compact=%d dictionary=%d packed=%d compress=%d", 
+             VERSION, validation_rules.strict_mode, validation_rules.validate_email, 
+             validation_rules.validate_phone, validation_rules.validate_date, 
+             validation_rules.validate_state, validation_rules.validate_zip, 
+             validation_rules.check_zip_state, validation_rules.allow_empty_fields, 
+             duplicate_policy_name(options.duplicate_policy), options.sample_rate, 
+             options.block_size, options.columnar, options.compact, options.dictionary, 
+             options.packed, options.compress_level);
+    
+    if (fwrite(header, sizeof(BinaryFileHeader), 1, binary) != 1) {
+        log_message(LOG_ERROR, "Could not write output file header");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: finalize_file_header
+ * Description: Seek back and store the final record count in the header
+ */
+int finalize_file_header(FILE *binary, long long record_count) {
+    output_header.record_count = record_count;
+    
+    if (fflush(binary) != 0 || FSEEK64(binary, 0, SEEK_SET) != 0 ||
+        fwrite(&output_header, sizeof(BinaryFileHeader), 1, binary) != 1 ||
+        FSEEK64(binary, 0, SEEK_END) != 0) {
+        log_message(LOG_ERROR, "Could not finalize output file header: %s", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: read_file_header
+ * Description: Read a converter output header and position f at the first
+ *              record. Headerless (legacy) files get a zeroed header and
+ *              offset 0. Returns -1 if the file does not hold record_size
+ *              records in a layout this build understands.
+ */
+long long read_file_header(FILE *f, const char *filename, size_t record_size, 
+                           BinaryFileHeader *header) {
+    size_t stored_size = record_size;
+    char magic[sizeof(ARROW_MAGIC) - 1];
+    
+    if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) && 
+        memcmp(magic, ARROW_MAGIC, sizeof(magic)) == 0) {
+        log_message(LOG_ERROR, "'%s' is an Arrow IPC file (--arrow), not converter records", 
+                   filename);
+        return -1;
+    }
+    FSEEK64(f, 0, SEEK_SET);
+    
+    if (fread(header, sizeof(BinaryFileHeader), 1, f) != 1 ||
+        memcmp(header->magic, BINARY_MAGIC, 4) != 0) {
+        /* No header: records start at offset 0 */
+        memset(header, 0, sizeof(BinaryFileHeader));
+        header->record_size = (unsigned int)record_size;
+        header->record_count = BINARY_COUNT_UNKNOWN;
+        FSEEK64(f, 0, SEEK_SET);
+        return 0;
+    }
+    
+    /* Customer readers also take packed customers (RecordReader unpacks them) */
+    if ((header->flags & BINARY_FLAG_PACKED) && record_size == sizeof(Customer)) {
+        stored_size = sizeof(PackedCustomer);
+    }
+    if (header->version > BINARY_FORMAT_VERSION || header->record_size != stored_size) {
+        log_message(LOG_ERROR, "'%s' is a version %u %s file with %u-byte records "
+                   "(expected version <= %d, %zu-byte records)", filename, header->version, 
+                   header->record_type, header->record_size, BINARY_FORMAT_VERSION, stored_size);
+        return -1;
+    }
+    if ((header->flags & ~BINARY_FLAGS_KNOWN) ||
+        ((header->flags & (BINARY_FLAG_COLUMNAR | BINARY_FLAG_COMPACT | BINARY_FLAG_COMPRESSED)) && 
+         !(header->flags & BINARY_FLAG_BLOCKS)) ||
+        ((header->flags & BINARY_FLAG_COLUMNAR) && (header->flags & BINARY_FLAG_COMPACT)) ||
+        ((header->flags & BINARY_FLAG_DICTIONARY) && !(header->flags & BINARY_FLAG_COLUMNAR))) {
+        log_message(LOG_ERROR, "'%s' uses unsupported layout flags 0x%x", filename, 
+                   header->flags);
+        return -1;
+    }
+    
+    FSEEK64(f, header->header_size, SEEK_SET);
+    return header->header_size;
+}
+
+/*
+ * Function: init_crc32c_table
+ * Description: Byte-wise table for the software CRC32C (Castagnoli,
+ *              reflected polynomial 0x82F63B78)
+ */
+void init_crc32c_table(void) {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+}
+
+/*
+ * Function: crc32c
+ * Description: Extend a CRC32C over len bytes (start with crc = 0). Uses the
+ *              SSE4.2 crc32 instruction when compiled in; same result either way.
+ */
+unsigned int crc32c(unsigned int crc, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    
+    crc = ~crc;
+#ifdef HAVE_HW_CRC32C
+#if defined(__x86_64__) || defined(_M_X64)
+    while (len >= 8) {
+        unsigned long long word;
+        memcpy(&word, p, 8);
+        crc = (unsigned int)_mm_crc32_u64(crc, word);
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len >= 4) {
+        unsigned int word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+#else
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xFF];
+    }
+#endif
+    return ~crc;
+}
+
+/*
+ * Function: record_layout
+ * Description: Field table for a fixed-width record type (by its size)
+ */
+const FieldLayout* record_layout(size_t record_size) {
+    if (record_size == sizeof(Customer)) return CUSTOMER_FIELDS;
+    if (record_size == sizeof(Transaction)) return TRANSACTION_FIELDS;
+    if (record_size == sizeof(PackedCustomer)) return PACKED_CUSTOMER_FIELDS;
+    return NULL;
+}
+
+/*
+ * Function: text_length
+ * Description: Length of a NUL-padded field (size if it has no NUL)
+ */
+static size_t text_length(const unsigned char *field, size_t size) {
+    const unsigned char *nul = (const unsigned char *)memchr(field, '\0', size);
+    return nul ? (size_t)(nul - field) : size;
+}
+
+/*
+ * Function: dictionary_encode_column
+ * Description: Write a FIELD_CATEGORY column as a dictionary plus one code
+ *              per row. Returns the bytes written after the ColumnHeader
+ *              and sets *header, or 0 to fall back to plain values (more
+ *              than max_entries distinct values, or no saving).
+ */
+static size_t dictionary_encode_column(const FieldLayout *field, size_t record_size, 
+                                       const unsigned char *rows, unsigned int count, 
+                                       int max_entries, ColumnHeader *header, 
+                                       unsigned char *out) {
+    unsigned int limit = (count < (unsigned int)max_entries) ? count : (unsigned int)max_entries;
+    unsigned int slots = 16;
+    unsigned short *slot;                   /* Entry number + 1, 0 = empty */
+    const unsigned char **entry_text;
+    unsigned char *entry_len;
+    unsigned short *codes;
+    unsigned int entries = 0;
+    size_t size = 0;
+    size_t code_width;
+    const unsigned char *src = rows + field->offset;
+    
+    while (slots < 2 * limit) slots <<= 1;
+    slot = (unsigned short *)calloc(slots, sizeof(unsigned short));
+    entry_text = (const unsigned char **)malloc((limit + 1) * sizeof(*entry_text));
+    entry_len = (unsigned char *)malloc(limit + 1);
+    codes = (unsigned short *)malloc((count + 1) * sizeof(unsigned short));
+    if (slot == NULL || entry_text == NULL || entry_len == NULL || codes == NULL) goto done;
+    
+    for (unsigned int r = 0; r < count; r++, src += record_size) {
+        size_t len = text_length(src, field->size);
+        unsigned int hash = 2166136261u;        /* FNV-1a */
+        unsigned int s;
+        
+        for (size_t i = 0; i < len; i++) hash = (hash ^ src[i]) * 16777619u;
+        for (s = hash & (slots - 1); slot[s] != 0; s = (s + 1) & (slots - 1)) {
+            unsigned int e = slot[s] - 1u;
+            if (entry_len[e] == len && memcmp(entry_text[e], src, len) == 0) break;
+        }
+        if (slot[s] == 0) {
+            if (entries == limit) {
+                size = 0;
+                goto done;
+            }
+            entry_text[entries] = src;
+            entry_len[entries] = (unsigned char)len;
+            slot[s] = (unsigned short)++entries;
+            size += 1 + len;
+        }
+        codes[r] = (unsigned short)(slot[s] - 1u);
+    }
+    
+    code_width = (entries <= 256) ? 1 : 2;
+    if (size + count * code_width >= (size_t)count * field->size) {
+        size = 0;
+        goto done;
+    }
+    
+    header->encoding = (code_width == 1) ? COLUMN_CODES8 : COLUMN_CODES16;
+    header->reserved = 0;
+    header->entry_count = (unsigned short)entries;
+    size = 0;
+    for (unsigned int e = 0; e < entries; e++) {
+        out[size++] = entry_len[e];
+        memcpy(out + size, entry_text[e], entry_len[e]);
+        size += entry_len[e];
+    }
+    for (unsigned int r = 0; r < count; r++) {
+        if (code_width == 1) {
+            out[size++] = (unsigned char)codes[r];
+        } else {
+            memcpy(out + size, &codes[r], sizeof(unsigned short));
+            size += sizeof(unsigned short);
+        }
+    }
+    
+done:
+    free(slot);
+    free(entry_text);
+    free(entry_len);
+    free(codes);
+    return size;
+}
+
+/*
+ * Function: dictionary_decode_column
+ * Description: Expand a coded column into count rows; 0 if it is malformed
+ */
+static int dictionary_decode_column(const FieldLayout *field, size_t record_size, 
+                                    const ColumnHeader *header, const unsigned char *src, 
+                                    size_t size, unsigned int count, unsigned char *rows) {
+    size_t *entry_pos = (size_t *)malloc((header->entry_count + 1) * sizeof(size_t));
+    size_t code_width = (header->encoding == COLUMN_CODES8) ? 1 : 2;
+    size_t pos = 0;
+    int ok = 0;
+    
+    if (entry_pos == NULL) return 0;
+    for (unsigned int e = 0; e < header->entry_count; e++) {
+        if (pos >= size || src[pos] > field->size || src[pos] > size - pos - 1) goto done;
+        entry_pos[e] = pos;
+        pos += 1 + src[pos];
+    }
+    if (size - pos != count * code_width) goto done;
+    
+    for (unsigned int r = 0; r < count; r++, rows += record_size) {
+        unsigned short code;
+        
+        if (code_width == 1) {
+            code = src[pos++];
+        } else {
+            memcpy(&code, src + pos, sizeof(code));
+            pos += sizeof(code);
+        }
+        if (code >= header->entry_count) goto done;
+        memcpy(rows + field->offset, src + entry_pos[code] + 1, src[entry_pos[code]]);
+    }
+    ok = 1;
+    
+done:
+    free(entry_pos);
+    return ok;
+}
+
+/*
+ * Function: columnar_encode
+ * Description: Transpose count rows into a column directory followed by
+ *              each field's values back to back. With dictionary > 0,
+ *              FIELD_CATEGORY columns carry a ColumnHeader and are coded
+ *              when they have at most that many distinct values. Returns
+ *              the payload size.
+ */
+static size_t columnar_encode(const FieldLayout *fields, size_t record_size, 
+                              const unsigned char *rows, unsigned int count, 
+                              int dictionary, unsigned char *out) {
+    size_t pos = RECORD_FIELD_COUNT * sizeof(ColumnDirectoryEntry);
+    
+    for (int f = 0; f < RECORD_FIELD_COUNT; f++) {
+        ColumnDirectoryEntry entry;
+        const unsigned char *src = rows + fields[f].offset;
+        size_t width = fields[f].size;
+        
+        entry.offset = (unsigned int)pos;
+        if (dictionary > 0 && fields[f].kind == FIELD_CATEGORY) {
+            ColumnHeader header;
+            size_t coded = dictionary_encode_column(&fields[f], record_size, rows, count, 
+                                                    dictionary, &header, 
+                                                    out + pos + sizeof(ColumnHeader));
+            if (coded == 0) memset(&header, 0, sizeof(header));
+            memcpy(out + pos, &header, sizeof(header));
+            pos += sizeof(ColumnHeader);
+            if (coded > 0) {
+                pos += coded;
+                entry.size = (unsigned int)(pos - entry.offset);
+                memcpy(out + f * sizeof(ColumnDirectoryEntry), &entry, sizeof(entry));
+                continue;
+            }
+        }
+        
+        for (unsigned int r = 0; r < count; r++, src += record_size, pos += width) {
+            memcpy(out + pos, src, width);
+        }
+        entry.size = (unsigned int)(pos - entry.offset);
+        memcpy(out + f * sizeof(ColumnDirectoryEntry), &entry, sizeof(entry));
+    }
+    return pos;
+}
+
+/*
+ * Function: columnar_decode
+ * Description: Rebuild count rows from a columnar payload; 0 if the column
+ *              directory does not fit the payload
+ */
+static int columnar_decode(const FieldLayout *fields, size_t record_size, 
+                           const unsigned char *payload, size_t payload_size, 
+                           int dictionary, unsigned int count, unsigned char *rows) {
+    if (payload_size < RECORD_FIELD_COUNT * sizeof(ColumnDirectoryEntry)) return 0;
+    if (dictionary) memset(rows, 0, (size_t)count * record_size);
+    
+    for (int f = 0; f < RECORD_FIELD_COUNT; f++) {
+        ColumnDirectoryEntry entry;
+        const unsigned char *src;
+        unsigned char *dst = rows + fields[f].offset;
+        size_t width = fields[f].size;
+        size_t size;
+        
+        memcpy(&entry, payload + f * sizeof(ColumnDirectoryEntry), sizeof(entry));
+        if (entry.offset > payload_size || entry.size > payload_size - entry.offset) return 0;
+        src = payload + entry.offset;
+        size = entry.size;
+        
+        if (dictionary && fields[f].kind == FIELD_CATEGORY) {
+            ColumnHeader header;
+            
+            if (size < sizeof(ColumnHeader)) return 0;
+            memcpy(&header, src, sizeof(header));
+            src += sizeof(ColumnHeader);
+            size -= sizeof(ColumnHeader);
+            if (header.encoding == COLUMN_CODES8 || header.encoding == COLUMN_CODES16) {
+                if (!dictionary_decode_column(&fields[f], record_size, &header, src, size, 
+                                              count, rows)) {
+                    return 0;
+                }
+                continue;
+            }
+            if (header.encoding != COLUMN_PLAIN) return 0;
+        }
+        if (size != count * width) return 0;
+        
+        for (unsigned int r = 0; r < count; r++, dst += record_size, src += width) {
+            memcpy(dst, src, width);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Function: compact_encode
+ * Description: Rows with numbers copied as is and text as a varint length
+ *              plus its bytes (no padding). An offset table in front holds
+ *              the payload offset of every COMPACT_OFFSET_STRIDE-th row, so
+ *              a reader skips at most STRIDE - 1 rows to reach any ordinal.
+ */
+static size_t compact_encode(const FieldLayout *fields, size_t record_size, 
+                             const unsigned char *rows, unsigned int count, 
+                             unsigned char *out) {
+    unsigned int anchors = (count + COMPACT_OFFSET_STRIDE - 1) / COMPACT_OFFSET_STRIDE;
+    size_t pos = anchors * sizeof(unsigned int);
+    
+    for (unsigned int r = 0; r < count; r++, rows += record_size) {
+        if (r % COMPACT_OFFSET_STRIDE == 0) {
+            unsigned int anchor = (unsigned int)pos;
+            memcpy(out + (r / COMPACT_OFFSET_STRIDE) * sizeof(unsigned int), &anchor, sizeof(anchor));
+        }
+        
+        for (int f = 0; f < RECORD_FIELD_COUNT; f++) {
+            const unsigned char *src = rows + fields[f].offset;
+            size_t len;
+            
+            if (fields[f].kind == FIELD_NUMBER) {
+                memcpy(out + pos, src, fields[f].size);
+                pos += fields[f].size;
+                continue;
+            }
+            
+            /* LEB128 length, then the text */
+            len = text_length(src, fields[f].size);
+            do {
+                out[pos++] = (unsigned char)((len & 0x7F) | (len > 0x7F ? 0x80 : 0));
+                len >>= 7;
+            } while (len > 0);
+            len = text_length(src, fields[f].size);
+            memcpy(out + pos, src, len);
+            pos += len;
+        }
+    }
+    return pos;
+}
+
+/*
+ * Function: compact_decode
+ * Description: Rebuild NUL-padded rows from a compact payload; 0 if the
+ *              payload is malformed
+ */
+static int compact_decode(const FieldLayout *fields, size_t record_size, 
+                          const unsigned char *payload, size_t payload_size, 
+                          unsigned int count, unsigned char *rows) {
+    unsigned int anchors = (count + COMPACT_OFFSET_STRIDE - 1) / COMPACT_OFFSET_STRIDE;
+    size_t pos = anchors * sizeof(unsigned int);
+    
+    if (pos > payload_size) return 0;
+    memset(rows, 0, (size_t)count * record_size);
+    
+    for (unsigned int r = 0; r < count; r++, rows += record_size) {
+        for (int f = 0; f < RECORD_FIELD_COUNT; f++) {
+            unsigned char *dst = rows + fields[f].offset;
+            size_t len = 0;
+            int shift = 0;
+            
+            if (fields[f].kind == FIELD_NUMBER) {
+                if (payload_size - pos < fields[f].size) return 0;
+                memcpy(dst, payload + pos, fields[f].size);
+                pos += fields[f].size;
+                continue;
+            }
+            
+            for (;;) {
+                if (pos >= payload_size || shift > 28) return 0;
+                len |= (size_t)(payload[pos] & 0x7F) << shift;
+                shift += 7;
+                if (!(payload[pos++] & 0x80)) break;
+            }
+            if (len > fields[f].size || payload_size - pos < len) return 0;
+            memcpy(dst, payload + pos, len);
+            pos += len;
+        }
+    }
+    return pos == payload_size;
+}
+
+/*
+ * Function: encoded_block_bound
+ * Description: Largest payload encode_block can produce for count rows
+ */
+size_t encoded_block_bound(unsigned int flags, size_t record_size, unsigned int count) {
+    size_t raw = (size_t)count * record_size;
+    
+    if (flags & BINARY_FLAG_COLUMNAR) {
+        /* Coded columns are only kept when smaller than plain ones */
+        return raw + RECORD_FIELD_COUNT * (sizeof(ColumnDirectoryEntry) + sizeof(ColumnHeader));
+    }
+    if (flags & BINARY_FLAG_COMPACT) {
+        /* One length byte per text field (fields are < 128 bytes) + anchors */
+        return raw + (size_t)count * RECORD_FIELD_COUNT + 
+               ((count + COMPACT_OFFSET_STRIDE - 1) / COMPACT_OFFSET_STRIDE) * sizeof(unsigned int);
+    }
+    return raw;
+}
+
+/*
+ * Function: encode_block
+ * Description: Block payload for count fixed-width rows under the layout
+ *              flags. Returns the payload size (out must hold
+ *              encoded_block_bound bytes).
+ */
+size_t encode_block(unsigned int flags, size_t record_size, const unsigned char *rows, 
+                    unsigned int count, unsigned char *out) {
+    if (flags & BINARY_FLAG_COLUMNAR) {
+        return columnar_encode(record_layout(record_size), record_size, rows, count, 
+                               (flags & BINARY_FLAG_DICTIONARY) ? options.dictionary : 0, out);
+    }
+    if (flags & BINARY_FLAG_COMPACT) {
+        return compact_encode(record_layout(record_size), record_size, rows, count, out);
+    }
+    memcpy(out, rows, count * record_size);
+    return count * record_size;
+}
+
+/*
+ * Function: decode_block
+ * Description: Inverse of encode_block; 0 if the payload is malformed
+ */
+int decode_block(unsigned int flags, size_t record_size, const unsigned char *payload, 
+                 size_t payload_size, unsigned int count, unsigned char *rows) {
+    if (flags & BINARY_FLAG_COLUMNAR) {
+        return columnar_decode(record_layout(record_size), record_size, payload, payload_size, 
+                               (flags & BINARY_FLAG_DICTIONARY) != 0, count, rows);
+    }
+    if (flags & BINARY_FLAG_COMPACT) {
+        return compact_decode(record_layout(record_size), record_size, 
+                              payload, payload_size, count, rows);
+    }
+    if (payload_size != count * record_size) return 0;
+    memcpy(rows, payload, payload_size);
+    return 1;
+}
+
+/*
+ * Function: cpu_count
+ * Description: Logical processors available to this process (at least 1)
+ */
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/*
+ * Function: lz_bound
+ * Description: Largest LZ4 block lz_compress can produce for size bytes
+ */
+size_t lz_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+/*
+ * Function: lz_state_init
+ * Description: Allocate compressor scratch (about 384 KB)
+ */
+int lz_state_init(LzState *lz) {
+    lz->head = (int *)malloc(((size_t)1 << LZ_HASH_BITS) * sizeof(int));
+    lz->chain = (unsigned short *)malloc(((size_t)LZ_MAX_OFFSET + 1) * sizeof(unsigned short));
+    if (lz->head == NULL || lz->chain == NULL) {
+        lz_state_free(lz);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: lz_state_free
+ * Description: Release compressor scratch
+ */
+void lz_state_free(LzState *lz) {
+    free(lz->head);
+    free(lz->chain);
+    lz->head = NULL;
+    lz->chain = NULL;
+}
+
+/*
+ * Function: lz_put_length
+ * Description: LZ4 length continuation bytes (255, 255, ..., remainder)
+ */
+static unsigned char* lz_put_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/*
+ * Function: lz_compress
+ * Description: Compress size bytes into an LZ4 block (the format of
+ *              LZ4_compress_default, so any LZ4 block decoder reads it).
+ *              Level 1 tries the newest position with the same 4-byte hash;
+ *              level L walks up to 2^(L-1) earlier ones and also indexes
+ *              the positions inside matches. Returns the compressed size,
+ *              or 0 if it does not fit in capacity.
+ */
+size_t lz_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity, 
+                   int level, LzState *lz) {
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *op_end = dst + capacity;
+    int depth = (level <= 1) ? 1 : 1 << (level - 1);
+    size_t literals;
+    
+    if (size > LZ_MATCH_START_LIMIT) {
+        const unsigned char *ip_limit = end - LZ_MATCH_START_LIMIT;
+        const unsigned char *match_limit = end - LZ_LAST_LITERALS;
+        
+        for (size_t i = 0; i < ((size_t)1 << LZ_HASH_BITS); i++) lz->head[i] = -1;
+        
+        while (ip < ip_limit) {
+            int pos = (int)(ip - src);
+            int candidate;
+            int best_pos = 0;
+            size_t best_len = 0;
+            size_t match_len;
+            unsigned int word;
+            unsigned int hash;
+            unsigned char *token;
+            
+            memcpy(&word, ip, sizeof(word));
+            hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+            candidate = lz->head[hash];
+            lz->chain[pos & LZ_MAX_OFFSET] = (unsigned short)
+                ((candidate >= 0 && pos - candidate <= LZ_MAX_OFFSET) ? pos - candidate : 0);
+            lz->head[hash] = pos;
+            
+            for (int tries = 0; tries < depth && candidate >= 0 && 
+                                pos - candidate <= LZ_MAX_OFFSET; tries++) {
+                const unsigned char *match = src + candidate;
+                unsigned short step;
+                
+                if (memcmp(match, ip, LZ_MIN_MATCH) == 0) {
+                    size_t len = LZ_MIN_MATCH;
+                    while (ip + len < match_limit && match[len] == ip[len]) len++;
+                    if (len > best_len) {
+                        best_len = len;
+                        best_pos = candidate;
+                    }
+                }
+                step = lz->chain[candidate & LZ_MAX_OFFSET];
+                if (step == 0) break;
+                candidate -= step;
+            }
+            
+            if (best_len < LZ_MIN_MATCH) {
+                ip++;
+                continue;
+            }
+            
+            /* Sequence: token, literal length, literals, offset, match length */
+            literals = (size_t)(ip - anchor);
+            match_len = best_len - LZ_MIN_MATCH;
+            if ((size_t)(op_end - op) < 1 + literals / 255 + 1 + literals + 2 + match_len / 255 + 1) {
+                return 0;
+            }
+            token = op++;
+            *token = (unsigned char)(((literals >= 15) ? 15 : literals) << 4 | 
+                                     ((match_len >= 15) ? 15 : match_len));
+            if (literals >= 15) op = lz_put_length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+            *op++ = (unsigned char)((pos - best_pos) & 0xFF);
+            *op++ = (unsigned char)((pos - best_pos) >> 8);
+            if (match_len >= 15) op = lz_put_length(op, match_len - 15);
+            
+            ip += best_len;
+            anchor = ip;
+            
+            /* Deeper levels also index the positions the match covered */
+            for (int p = pos + 1; level > 1 && p < (int)(ip - src) && src + p < ip_limit; p++) {
+                memcpy(&word, src + p, sizeof(word));
+                hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+                candidate = lz->head[hash];
+                lz->chain[p & LZ_MAX_OFFSET] = (unsigned short)
+                    ((candidate >= 0 && p - candidate <= LZ_MAX_OFFSET) ? p - candidate : 0);
+                lz->head[hash] = p;
+            }
+        }
+    }
+    
+    /* Last sequence: literals only */
+    literals = (size_t)(end - anchor);
+    if ((size_t)(op_end - op) < 1 + literals / 255 + 1 + literals) return 0;
+    *op++ = (unsigned char)(((literals >= 15) ? 15 : literals) << 4);
+    if (literals >= 15) op = lz_put_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+/*
+ * Function: lz_decompress
+ * Description: Expand an LZ4 block into at most capacity bytes. Returns
+ *              the expanded size, or 0 if the block is malformed.
+ */
+size_t lz_decompress(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity) {
+    const unsigned char *ip = src;
+    const unsigned char *ip_end = src + size;
+    unsigned char *op = dst;
+    unsigned char *op_end = dst + capacity;
+    
+    while (ip < ip_end) {
+        unsigned int token = *ip++;
+        size_t literals = token >> 4;
+        size_t match_len = token & 15;
+        size_t offset;
+        const unsigned char *match;
+        
+        if (literals == 15) {
+            unsigned char more;
+            do {
+                if (ip >= ip_end) return 0;
+                more = *ip++;
+                literals += more;
+            } while (more == 255);
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) return 0;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end) break;
+        
+        if (ip_end - ip < 2) return 0;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return 0;
+        
+        if (match_len == 15) {
+            unsigned char more;
+            do {
+                if (ip >= ip_end) return 0;
+                more = *ip++;
+                match_len += more;
+            } while (more == 255);
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(op_end - op)) return 0;
+        
+        /* Byte by byte: the match may overlap what it produces */
+        match = op - offset;
+        while (match_len-- > 0) *op++ = *match++;
+    }
+    return (size_t)(op - dst);
+}
+
+/*
+ * Function: block_job_run
+ * Description: Encode, compress and checksum one queued block
+ */
+static void block_job_run(BlockJob *job, LzState *lz) {
+    size_t size;
+    size_t packed;
+    const unsigned char *payload = job->rows;
+    
+    size = (size_t)job->record_count * block_writer.record_size;
+    if (block_writer.flags != 0) {
+        payload = job->encoded;
+        size = encode_block(block_writer.flags, block_writer.record_size, job->rows, 
+                            job->record_count, job->encoded);
+    }
+    job->encoded_size = (unsigned int)size;
+    memcpy(job->stored, &job->encoded_size, sizeof(unsigned int));
+    
+    /* Only keep the LZ4 form if it is smaller; then size == stored - 4 means raw */
+    packed = (size > 1) ? lz_compress(payload, size, job->stored + sizeof(unsigned int), 
+                                      size - 1, block_writer.compress_level, lz) : 0;
+    if (packed == 0) {
+        memcpy(job->stored + sizeof(unsigned int), payload, size);
+        packed = size;
+    }
+    job->stored_size = (unsigned int)(packed + sizeof(unsigned int));
+    job->crc32c = crc32c(0, job->stored, job->stored_size);
+}
+
+/*
+ * Function: block_job_state
+ * Description: Publish a job state change and wake the threads waiting on it
+ */
+static void block_job_state(BlockJob *job, long long state, ThreadCond *waiters) {
+    ATOMIC_STORE(&job->state, state);
+    thread_lock(&compress_lock);
+    thread_wake_all(waiters);
+    thread_unlock(&compress_lock);
+}
+
+/*
+ * Function: block_job_ready
+ * Description: Whether any job in the ring is waiting for a worker
+ */
+static int block_job_ready(void) {
+    for (int i = 0; i < block_writer.job_count; i++) {
+        if (ATOMIC_LOAD(&block_writer.jobs[i].state) == BLOCK_JOB_READY) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Function: compress_thread_main
+ * Description: Compression worker: claim ready blocks until told to stop
+ */
+static THREAD_RETURN compress_thread_main(void *arg) {
+    LzState lz;
+    (void)arg;
+    
+    if (!lz_state_init(&lz)) {
+        log_message(LOG_WARNING, "Compression worker out of memory; blocks left to the writer");
+        return THREAD_RESULT;
+    }
+    while (!ATOMIC_LOAD(&compress_stop)) {
+        int claimed = 0;
+        
+        for (int i = 0; i < block_writer.job_count; i++) {
+            BlockJob *job = &block_writer.jobs[i];
+            
+            if (ATOMIC_CAS(&job->state, BLOCK_JOB_READY, BLOCK_JOB_BUSY)) {
+                block_job_run(job, &lz);
+                block_job_state(job, BLOCK_JOB_DONE, &compress_done);
+                claimed = 1;
+            }
+        }
+        if (!claimed) {
+            thread_lock(&compress_lock);
+            while (!ATOMIC_LOAD(&compress_stop) && !block_job_ready()) {
+                thread_wait(&compress_ready, &compress_lock);
+            }
+            thread_unlock(&compress_lock);
+        }
+    }
+    lz_state_free(&lz);
+    return THREAD_RESULT;
+}
+
+/*
+ * Function: block_writer_open
+ * Description: Start block layout output at the current file position.
+ *              With --compress the block being filled is one of a ring of
+ *              jobs, and workers compress full ones while the next fills.
+ */
+int block_writer_open(FILE *binary, size_t record_size) {
+    size_t per_block = (size_t)options.block_size / record_size;
+    
+    if (per_block == 0) per_block = 1;
+    memset(&block_writer, 0, sizeof(BlockWriter));
+    block_writer.record_size = record_size;
+    block_writer.capacity = per_block * record_size;
+    block_writer.offset = FTELL64(binary);
+    block_writer.flags = (options.columnar ? BINARY_FLAG_COLUMNAR : 0) | 
+                         (options.compact ? BINARY_FLAG_COMPACT : 0) | 
+                         (options.dictionary ? BINARY_FLAG_DICTIONARY : 0);
+    block_writer.encoded_capacity = (block_writer.flags != 0) ? 
+        encoded_block_bound(block_writer.flags, record_size, (unsigned int)per_block) : 
+        block_writer.capacity;
+    
+    if (options.compress_level > 0) {
+        block_writer.compress_level = options.compress_level;
+        block_writer.job_count = options.compress_threads * BLOCK_JOBS_PER_THREAD;
+        if (block_writer.job_count < 2) block_writer.job_count = 2;
+        block_writer.jobs = (BlockJob *)calloc((size_t)block_writer.job_count, sizeof(BlockJob));
+        if (block_writer.jobs == NULL || !lz_state_init(&block_writer.lz)) {
+            log_message(LOG_ERROR, "Could not allocate compression state");
+            return 0;
+        }
+        for (int i = 0; i < block_writer.job_count; i++) {
+            BlockJob *job = &block_writer.jobs[i];
+            
+            job->rows = (unsigned char *)malloc(block_writer.capacity);
+            job->encoded = (block_writer.flags != 0) ? 
+                (unsigned char *)malloc(block_writer.encoded_capacity) : NULL;
+            job->stored = (unsigned char *)malloc(block_writer.encoded_capacity + sizeof(unsigned int));
+            if (job->rows == NULL || job->stored == NULL || 
+                (block_writer.flags != 0 && job->encoded == NULL)) {
+                log_message(LOG_ERROR, "Could not allocate %zu-byte output block", 
+                            block_writer.capacity);
+                return 0;
+            }
+        }
+        block_writer.data = block_writer.jobs[0].rows;
+        
+        ATOMIC_STORE(&compress_stop, 0);
+        for (compress_thread_count = 0; compress_thread_count < options.compress_threads; 
+             compress_thread_count++) {
+            if (!thread_start(&compress_threads[compress_thread_count], compress_thread_main, NULL)) {
+                log_message(LOG_WARNING, "Could not start compression worker %d", 
+                            compress_thread_count + 1);
+                break;
+            }
+        }
+        return 1;
+    }
+    
+    block_writer.data = (unsigned char *)malloc(block_writer.capacity);
+    if (block_writer.flags != 0) {
+        block_writer.encoded = (unsigned char *)malloc(block_writer.encoded_capacity);
+    }
+    if (block_writer.data == NULL || (block_writer.flags != 0 && block_writer.encoded == NULL)) {
+        log_message(LOG_ERROR, "Could not allocate %zu-byte output block", block_writer.capacity);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: block_emit
+ * Description: Write one block with its header and add it to the index
+ */
+static int block_emit(FILE *binary, BlockHeader *header, const unsigned char *payload, 
+                      long long first_record) {
+    BlockIndexEntry *entry;
+    
+    if (block_writer.index_count == block_writer.index_capacity) {
+        int capacity = block_writer.index_capacity ? block_writer.index_capacity * 2 : 256;
+        BlockIndexEntry *grown = (BlockIndexEntry *)realloc(block_writer.index, 
+                                                           capacity * sizeof(BlockIndexEntry));
+        if (grown == NULL) {
+            log_message(LOG_ERROR, "Out of memory growing the block index");
+            return 0;
+        }
+        block_writer.index = grown;
+        block_writer.index_capacity = capacity;
+    }
+    
+    if (fwrite(header, sizeof(BlockHeader), 1, binary) != 1 ||
+        fwrite(payload, 1, header->stored_size, binary) != header->stored_size) {
+        log_message(LOG_ERROR, "Block write failed: %s", strerror(errno));
+        return 0;
+    }
+    
+    entry = &block_writer.index[block_writer.index_count++];
+    entry->offset = block_writer.offset;
+    entry->first_record = first_record;
+    entry->record_count = header->record_count;
+    entry->stored_size = header->stored_size;
+    entry->raw_size = header->raw_size;
+    entry->crc32c = header->crc32c;
+    
+    block_writer.offset += (long long)(sizeof(BlockHeader) + header->stored_size);
+    stats.bytes_written += (long long)(sizeof(BlockHeader) + header->stored_size);
+    return 1;
+}
+
+/*
+ * Function: block_retire
+ * Description: Write out the oldest job in the ring once it is compressed;
+ *              runs it here if no worker has picked it up
+ */
+static int block_retire(FILE *binary) {
+    BlockJob *job = &block_writer.jobs[block_writer.retired % block_writer.job_count];
+    BlockHeader header;
+    
+    while (ATOMIC_LOAD(&job->state) != BLOCK_JOB_DONE) {
+        if (ATOMIC_CAS(&job->state, BLOCK_JOB_READY, BLOCK_JOB_BUSY)) {
+            block_job_run(job, &block_writer.lz);
+            ATOMIC_STORE(&job->state, BLOCK_JOB_DONE);
+        } else {
+            thread_lock(&compress_lock);
+            while (ATOMIC_LOAD(&job->state) == BLOCK_JOB_BUSY) {
+                thread_wait(&compress_done, &compress_lock);
+            }
+            thread_unlock(&compress_lock);
+        }
+    }
+    
+    header.record_count = job->record_count;
+    header.raw_size = (unsigned int)(job->record_count * block_writer.record_size);
+    header.stored_size = job->stored_size;
+    header.crc32c = job->crc32c;
+    if (!block_emit(binary, &header, job->stored, job->first_record)) return 0;
+    
+    stats.compress_in_bytes += job->encoded_size;
+    stats.compress_out_bytes += job->stored_size;
+    ATOMIC_STORE(&job->state, BLOCK_JOB_FREE);
+    block_writer.retired++;
+    return 1;
+}
+
+/*
+ * Function: block_flush
+ * Description: Checksum and write the block being filled; add it to the
+ *              index. With compression the block is queued instead and
+ *              the writer moves on to the next free job.
+ */
+static int block_flush(FILE *binary) {
+    BlockHeader header;
+    unsigned char *payload;
+    unsigned int count;
+    
+    if (block_writer.used == 0) return 1;
+    count = (unsigned int)(block_writer.used / block_writer.record_size);
+    
+    if (block_writer.jobs != NULL) {
+        BlockJob *job = &block_writer.jobs[block_writer.submitted % block_writer.job_count];
+        
+        job->record_count = count;
+        job->first_record = block_writer.records - count;
+        if (compress_thread_count > 0) {
+            block_job_state(job, BLOCK_JOB_READY, &compress_ready);
+        } else {
+            block_job_run(job, &block_writer.lz);
+            ATOMIC_STORE(&job->state, BLOCK_JOB_DONE);
+        }
+        block_writer.submitted++;
+        
+        while (block_writer.submitted - block_writer.retired >= block_writer.job_count) {
+            if (!block_retire(binary)) return 0;
+        }
+        block_writer.data = block_writer.jobs[block_writer.submitted % block_writer.job_count].rows;
+        block_writer.used = 0;
+        return 1;
+    }
+    
+    header.record_count = count;
+    header.raw_size = (unsigned int)block_writer.used;
+    if (block_writer.flags != 0) {
+        payload = block_writer.encoded;
+        header.stored_size = (unsigned int)encode_block(block_writer.flags, block_writer.record_size, 
+                                                        block_writer.data, count, payload);
+    } else {
+        payload = block_writer.data;
+        header.stored_size = (unsigned int)block_writer.used;
+    }
+    header.crc32c = crc32c(0, payload, header.stored_size);
+    
+    if (!block_emit(binary, &header, payload, block_writer.records - count)) return 0;
+    block_writer.used = 0;
+    return 1;
+}
+
+/*
+ * Function: block_write_records
+ * Description: Append records to the current block, flushing full blocks
+ */
+int block_write_records(FILE *binary, const void *records, int count) {
+    const unsigned char *src = (const unsigned char *)records;
+    size_t left = (size_t)count * block_writer.record_size;
+    
+    while (left > 0) {
+        size_t room = block_writer.capacity - block_writer.used;
+        size_t n = (left < room) ? left : room;
+        
+        memcpy(block_writer.data + block_writer.used, src, n);
+        block_writer.used += n;
+        block_writer.records += (long long)(n / block_writer.record_size);
+        src += n;
+        left -= n;
+        
+        if (block_writer.used == block_writer.capacity && !block_flush(binary)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: block_writer_close
+ * Description: Write the last partial block, the index and the trailer
+ */
+int block_writer_close(FILE *binary) {
+    BlockTrailer trailer;
+    size_t index_bytes;
+    
+    if (block_writer.data == NULL) return 1;
+    if (!block_flush(binary)) return 0;
+    while (block_writer.jobs != NULL && block_writer.retired < block_writer.submitted) {
+        if (!block_retire(binary)) return 0;
+    }
+    
+    index_bytes = (size_t)block_writer.index_count * sizeof(BlockIndexEntry);
+    memset(&trailer, 0, sizeof(BlockTrailer));
+    trailer.index_offset = block_writer.offset;
+    trailer.block_count = (unsigned int)block_writer.index_count;
+    trailer.index_crc32c = crc32c(0, block_writer.index, index_bytes);
+    memcpy(trailer.magic, BLOCK_INDEX_MAGIC, 4);
+    trailer.block_size = (unsigned int)options.block_size;
+    
+    if ((index_bytes > 0 && 
+         fwrite(block_writer.index, 1, index_bytes, binary) != index_bytes) ||
+        fwrite(&trailer, sizeof(BlockTrailer), 1, binary) != 1) {
+        log_message(LOG_ERROR, "Could not write block index: %s", strerror(errno));
+        return 0;
+    }
+    stats.bytes_written += (long long)(index_bytes + sizeof(BlockTrailer));
+    
+    stats.blocks_written = block_writer.index_count;
+    block_writer_free();
+    return 1;
+}
+
+/*
+ * Function: block_writer_free
+ * Description: Stop the compression workers and release the block writer
+ */
+void block_writer_free(void) {
+    ATOMIC_STORE(&compress_stop, 1);
+    thread_lock(&compress_lock);
+    thread_wake_all(&compress_ready);
+    thread_unlock(&compress_lock);
+    for (int i = 0; i < compress_thread_count; i++) thread_join(compress_threads[i]);
+    compress_thread_count = 0;
+    
+    if (block_writer.jobs != NULL) {
+        for (int i = 0; i < block_writer.job_count; i++) {
+            free(block_writer.jobs[i].rows);
+            free(block_writer.jobs[i].encoded);
+            free(block_writer.jobs[i].stored);
+        }
+        free(block_writer.jobs);
+        block_writer.data = NULL;
+    }
+    lz_state_free(&block_writer.lz);
+    free(block_writer.data);
+    free(block_writer.encoded);
+    free(block_writer.index);
+    memset(&block_writer, 0, sizeof(BlockWriter));
+}
+
+/*
+ * Function: fb_reserve
+ * Description: Append n zero bytes to a FlatBuilder; returns their position
+ */
+static size_t fb_reserve(FlatBuilder *fb, size_t n) {
+    size_t pos = fb->size;
+    
+    if (fb->failed) return 0;
+    if (fb->size + n > fb->capacity) {
+        size_t capacity = fb->capacity ? fb->capacity : 1024;
+        unsigned char *grown;
+        
+        while (capacity < fb->size + n) capacity *= 2;
+        grown = (unsigned char *)realloc(fb->data, capacity);
+        if (grown == NULL) {
+            fb->failed = 1;
+            fb->size = 0;
+            return 0;
+        }
+        fb->data = grown;
+        fb->capacity = capacity;
+    }
+    memset(fb->data + pos, 0, n);
+    fb->size += n;
+    return pos;
+}
+
+/*
+ * Function: fb_align
+ * Description: Pad until size % align == remainder
+ */
+static void fb_align(FlatBuilder *fb, size_t align, size_t remainder) {
+    while (!fb->failed && fb->size % align != remainder) fb_reserve(fb, 1);
+}
+
+/*
+ * Function: fb_ref
+ * Description: Point the reference field at position at to target
+ */
+static void fb_ref(FlatBuilder *fb, size_t at, size_t target) {
+    unsigned int delta = (unsigned int)(target - at);
+    
+    if (!fb->failed) memcpy(fb->data + at, &delta, sizeof(delta));
+}
+
+/*
+ * Function: fb_table
+ * Description: Append a vtable and its table. Fields are laid out widest
+ *              first so each sits on its natural alignment; positions[i]
+ *              receives where field i landed (for fb_ref).
+ */
+static size_t fb_table(FlatBuilder *fb, const FbField *fields, int count, size_t *positions) {
+    unsigned short offsets[8] = {0};        /* Arrow tables have at most 7 slots */
+    unsigned short vtable_head[2];
+    size_t inline_size = sizeof(int);
+    size_t vtable;
+    size_t table;
+    int slots = 0;
+    int wide = 0;
+    int soffset;
+    
+    for (int size = 8; size >= 1; size /= 2) {
+        for (int i = 0; i < count; i++) {
+            if (fields[i].size != size) continue;
+            offsets[fields[i].slot] = (unsigned short)inline_size;
+            inline_size += (size_t)size;
+            if (size == 8) wide = 1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (fields[i].slot + 1 > slots) slots = fields[i].slot + 1;
+    }
+    
+    fb_align(fb, sizeof(unsigned short), 0);
+    vtable_head[0] = (unsigned short)(sizeof(vtable_head) + slots * sizeof(unsigned short));
+    vtable_head[1] = (unsigned short)inline_size;
+    vtable = fb_reserve(fb, vtable_head[0]);
+    
+    /* The soffset is 4 bytes, so 8-byte fields need the table at 4 mod 8 */
+    fb_align(fb, wide ? 8 : 4, wide ? 4 : 0);
+    table = fb_reserve(fb, inline_size);
+    if (fb->failed) return 0;
+    
+    memcpy(fb->data + vtable, vtable_head, sizeof(vtable_head));
+    memcpy(fb->data + vtable + sizeof(vtable_head), offsets, slots * sizeof(unsigned short));
+    soffset = (int)(table - vtable);
+    memcpy(fb->data + table, &soffset, sizeof(soffset));
+    
+    for (int i = 0; i < count; i++) {
+        size_t at = table + offsets[fields[i].slot];
+        
+        switch (fields[i].size) {
+            case 8: memcpy(fb->data + at, &fields[i].value, 8); break;
+            case 4: { int v = (int)fields[i].value; memcpy(fb->data + at, &v, 4); break; }
+            case 2: { short v = (short)fields[i].value; memcpy(fb->data + at, &v, 2); break; }
+            default: fb->data[at] = (unsigned char)fields[i].value; break;
+        }
+        if (positions != NULL) positions[i] = at;
+    }
+    return table;
+}
+
+/*
+ * Function: fb_vector
+ * Description: Append a vector of count elements (zeros if data is NULL,
+ *              e.g. references to patch); 8-byte structs are 8-aligned
+ */
+static size_t fb_vector(FlatBuilder *fb, const void *data, size_t element_size, int count) {
+    unsigned int length = (unsigned int)count;
+    size_t pos;
+    
+    fb_align(fb, element_size >= 8 ? 8 : 4, element_size >= 8 ? 4 : 0);
+    pos = fb_reserve(fb, sizeof(length) + element_size * count);
+    if (fb->failed) return 0;
+    memcpy(fb->data + pos, &length, sizeof(length));
+    if (data != NULL) memcpy(fb->data + pos + sizeof(length), data, element_size * count);
+    return pos;
+}
+
+/*
+ * Function: fb_string
+ * Description: Append a NUL-terminated string
+ */
+static size_t fb_string(FlatBuilder *fb, const char *text) {
+    unsigned int length = (unsigned int)strlen(text);
+    size_t pos;
+    
+    fb_align(fb, 4, 0);
+    pos = fb_reserve(fb, sizeof(length) + length + 1);
+    if (fb->failed) return 0;
+    memcpy(fb->data + pos, &length, sizeof(length));
+    memcpy(fb->data + pos + sizeof(length), text, length);
+    return pos;
+}
+
+/*
+ * Function: arrow_build_schema
+ * Description: Append the Schema table: one nullable Utf8 column per text
+ *              field (dictionary-encoded with int32 codes if chosen), Int32
+ *              and Float64 for numbers
+ */
+static size_t arrow_build_schema(FlatBuilder *fb) {
+    FbField schema_fields[1] = { { 1, 4, 0 } };
+    size_t fields_ref;
+    size_t schema = fb_table(fb, schema_fields, 1, &fields_ref);
+    size_t vector = fb_vector(fb, NULL, sizeof(unsigned int), RECORD_FIELD_COUNT);
+    
+    fb_ref(fb, fields_ref, vector);
+    for (int i = 0; i < RECORD_FIELD_COUNT; i++) {
+        const ArrowColumn *column = &arrow_writer.columns[i];
+        unsigned char type = (column->type == 'i') ? ARROW_TYPE_INT : 
+                             (column->type == 'd') ? ARROW_TYPE_FLOAT : ARROW_TYPE_UTF8;
+        FbField field_fields[6] = {
+            { 0, 4, 0 },                        /* name */
+            { 1, 1, column->type == 's' },      /* nullable: empty text is null */
+            { 2, 1, type },                     /* type_type */
+            { 3, 4, 0 },                        /* type */
+            { 5, 4, 0 },                        /* children */
+            { 4, 4, 0 }                         /* dictionary */
+        };
+        size_t refs[6];
+        size_t field = fb_table(fb, field_fields, column->dictionary ? 6 : 5, refs);
+        
+        fb_ref(fb, vector + sizeof(unsigned int) * (i + 1), field);
+        fb_ref(fb, refs[0], fb_string(fb, column->field->name));
+        if (type == ARROW_TYPE_INT) {
+            FbField int_fields[2] = { { 0, 4, 32 }, { 1, 1, 1 } };
+            fb_ref(fb, refs[3], fb_table(fb, int_fields, 2, NULL));
+        } else if (type == ARROW_TYPE_FLOAT) {
+            FbField float_fields[1] = { { 0, 2, ARROW_PRECISION_DOUBLE } };
+            fb_ref(fb, refs[3], fb_table(fb, float_fields, 1, NULL));
+        } else {
+            fb_ref(fb, refs[3], fb_table(fb, NULL, 0, NULL));
+        }
+        fb_ref(fb, refs[4], fb_vector(fb, NULL, sizeof(unsigned int), 0));
+        
+        if (column->dictionary) {
+            /* DictionaryEncoding: id = column number, index type int32 */
+            FbField encoding_fields[2] = { { 0, 8, i }, { 1, 4, 0 } };
+            FbField index_fields[2] = { { 0, 4, 32 }, { 1, 1, 1 } };
+            size_t encoding_refs[2];
+            
+            fb_ref(fb, refs[5], fb_table(fb, encoding_fields, 2, encoding_refs));
+            fb_ref(fb, encoding_refs[1], fb_table(fb, index_fields, 2, NULL));
+        }
+    }
+    return schema;
+}
+
+/*
+ * Function: arrow_begin_message
+ * Description: Start a Message flatbuffer; returns where its header
+ *              reference goes
+ */
+static size_t arrow_begin_message(FlatBuilder *fb, int header_type, long long body_length) {
+    FbField message_fields[4] = {
+        { 0, 2, ARROW_METADATA_V5 },            /* version */
+        { 1, 1, header_type },                  /* header_type */
+        { 2, 4, 0 },                            /* header */
+        { 3, 8, body_length }                   /* bodyLength */
+    };
+    size_t refs[4];
+    size_t root;
+    
+    fb->size = 0;
+    fb->failed = 0;
+    root = fb_reserve(fb, sizeof(unsigned int));
+    fb_ref(fb, root, fb_table(fb, message_fields, 4, refs));
+    return refs[2];
+}
+
+/*
+ * Function: arrow_build_record_batch
+ * Description: Append a RecordBatch table describing an assembled body
+ */
+static size_t arrow_build_record_batch(FlatBuilder *fb, long long length, 
+                                       const ArrowBatch *batch) {
+    FbField batch_fields[3] = { { 0, 8, length }, { 1, 4, 0 }, { 2, 4, 0 } };
+    size_t refs[3];
+    size_t table = fb_table(fb, batch_fields, 3, refs);
+    
+    fb_ref(fb, refs[1], fb_vector(fb, batch->nodes, sizeof(batch->nodes[0]), batch->node_count));
+    fb_ref(fb, refs[2], fb_vector(fb, batch->buffers, sizeof(batch->buffers[0]), 
+                                  batch->buffer_count));
+    return table;
+}
+
+/*
+ * Function: arrow_write_message
+ * Description: Write an encapsulated message (continuation marker, metadata
+ *              length, metadata padded to 8 bytes, body) and describe it
+ */
+static int arrow_write_message(FILE *binary, const unsigned char *body, size_t body_size, 
+                               ArrowBlock *block) {
+    static const unsigned char padding[ARROW_ALIGNMENT] = {0};
+    FlatBuilder *fb = &arrow_writer.fb;
+    unsigned int prefix[2];
+    size_t metadata = (fb->size + ARROW_ALIGNMENT - 1) & ~(size_t)(ARROW_ALIGNMENT - 1);
+    
+    if (fb->failed) {
+        log_message(LOG_ERROR, "Out of memory building Arrow metadata");
+        return 0;
+    }
+    prefix[0] = ARROW_CONTINUATION;
+    prefix[1] = (unsigned int)metadata;
+    if (fwrite(prefix, sizeof(prefix), 1, binary) != 1 ||
+        fwrite(fb->data, 1, fb->size, binary) != fb->size ||
+        fwrite(padding, 1, metadata - fb->size, binary) != metadata - fb->size ||
+        (body_size > 0 && fwrite(body, 1, body_size, binary) != body_size)) {
+        log_message(LOG_ERROR, "Arrow write failed: %s", strerror(errno));
+        return 0;
+    }
+    
+    if (block != NULL) {
+        memset(block, 0, sizeof(ArrowBlock));
+        block->offset = arrow_writer.offset;
+        block->metadata_length = (int)(sizeof(prefix) + metadata);
+        block->body_length = (long long)body_size;
+    }
+    arrow_writer.offset += (long long)(sizeof(prefix) + metadata + body_size);
+    stats.bytes_written += (long long)(sizeof(prefix) + metadata + body_size);
+    return 1;
+}
+
+/*
+ * Function: arrow_add_buffer
+ * Description: Reserve an 8-byte aligned buffer of length bytes in the body
+ */
+static unsigned char* arrow_add_buffer(ArrowBatch *batch, size_t length) {
+    unsigned char *start = batch->body + batch->size;
+    size_t padded = (length + ARROW_ALIGNMENT - 1) & ~(size_t)(ARROW_ALIGNMENT - 1);
+    
+    batch->buffers[batch->buffer_count][0] = (long long)batch->size;
+    batch->buffers[batch->buffer_count][1] = (long long)length;
+    batch->buffer_count++;
+    memset(start, 0, padded);
+    batch->size += padded;
+    return start;
+}
+
+/*
+ * Function: arrow_dictionary_code
+ * Description: Code of a text value in a column's dictionary, adding it
+ *              if new; -1 if out of memory
+ */
+static int arrow_dictionary_code(ArrowColumn *column, const unsigned char *text, size_t length) {
+    unsigned int hash = 2166136261u;        /* FNV-1a */
+    unsigned int slot;
+    
+    /* Keep the table at most half full */
+    if (column->entries * 2 >= column->slot_count) {
+        int slot_count = column->slot_count ? column->slot_count * 2 : 1024;
+        int *slots = (int *)calloc((size_t)slot_count, sizeof(int));
+        
+        if (slots == NULL) return -1;
+        for (int e = 0; e < column->entries; e++) {
+            unsigned int h = 2166136261u;
+            for (int k = column->offsets[e]; k < column->offsets[e + 1]; k++) {
+                h = (h ^ column->values[k]) * 16777619u;
+            }
+            slot = h & (unsigned int)(slot_count - 1);
+            while (slots[slot] != 0) slot = (slot + 1) & (unsigned int)(slot_count - 1);
+            slots[slot] = e + 1;
+        }
+        free(column->slots);
+        column->slots = slots;
+        column->slot_count = slot_count;
+    }
+    
+    for (size_t i = 0; i < length; i++) hash = (hash ^ text[i]) * 16777619u;
+    slot = hash & (unsigned int)(column->slot_count - 1);
+    while (column->slots[slot] != 0) {
+        int e = column->slots[slot] - 1;
+        if ((size_t)(column->offsets[e + 1] - column->offsets[e]) == length &&
+            memcmp(column->values + column->offsets[e], text, length) == 0) {
+            return e;
+        }
+        slot = (slot + 1) & (unsigned int)(column->slot_count - 1);
+    }
+    
+    if (column->entries + 2 > column->offsets_capacity) {
+        int capacity = column->offsets_capacity ? column->offsets_capacity * 2 : 1024;
+        int *grown = (int *)realloc(column->offsets, (size_t)capacity * sizeof(int));
+        if (grown == NULL) return -1;
+        column->offsets = grown;
+        column->offsets_capacity = capacity;
+    }
+    if (!ensure_capacity(&column->values, &column->values_capacity, 
+                         column->values_size + length + 1)) {
+        return -1;
+    }
+    if (column->entries == 0) column->offsets[0] = 0;
+    memcpy(column->values + column->values_size, text, length);
+    column->values_size += length;
+    column->offsets[column->entries + 1] = (int)column->values_size;
+    column->slots[slot] = ++column->entries;
+    return column->entries - 1;
+}
+
+/*
+ * Function: arrow_writer_open
+ * Description: Start an Arrow IPC file: magic, then the schema message.
+ *              Column types come from the record's schema format codes.
+ */
+int arrow_writer_open(FILE *binary, size_t record_size) {
+    static const char file_magic[ARROW_ALIGNMENT] = ARROW_MAGIC;
+    const FieldLayout *fields = record_layout(record_size);
+    const char *code;
+    size_t header_ref;
+    
+    memset(&arrow_writer, 0, sizeof(ArrowWriter));
+    arrow_writer.record_size = record_size;
+    arrow_writer.schema = (record_size == sizeof(Transaction)) ? TRANSACTION_SCHEMA : 
+                                                                 CUSTOMER_SCHEMA;
+    
+    /* "<i50s..." : one code per field, text lengths are in FieldLayout */
+    code = arrow_writer.schema + 1;
+    for (int i = 0; i < RECORD_FIELD_COUNT; i++) {
+        ArrowColumn *column = &arrow_writer.columns[i];
+        
+        while (isdigit((unsigned char)*code)) code++;
+        column->field = &fields[i];
+        column->type = *code++;
+        column->dictionary = options.arrow_dictionary && fields[i].kind == FIELD_CATEGORY;
+        if (column->type != 'i' && column->type != 'd' && column->type != 's') {
+            log_message(LOG_ERROR, "Field %s has no Arrow type", fields[i].name);
+            return 0;
+        }
+    }
+    
+    if (fwrite(file_magic, 1, sizeof(file_magic), binary) != sizeof(file_magic)) {
+        log_message(LOG_ERROR, "Arrow write failed: %s", strerror(errno));
+        return 0;
+    }
+    arrow_writer.offset = sizeof(file_magic);
+    stats.bytes_written += (long long)sizeof(file_magic);
+    
+    header_ref = arrow_begin_message(&arrow_writer.fb, ARROW_HEADER_SCHEMA, 0);
+    fb_ref(&arrow_writer.fb, header_ref, arrow_build_schema(&arrow_writer.fb));
+    if (!arrow_write_message(binary, NULL, 0, NULL)) return 0;
+    
+    arrow_writer.active = 1;
+    return 1;
+}
+
+/*
+ * Function: arrow_write_batch
+ * Description: Write count fixed-width records as one record batch. Text
+ *              becomes validity bitmap + int32 offsets + UTF-8 bytes (or
+ *              validity + int32 dictionary codes); numbers are copied.
+ */
+int arrow_write_batch(FILE *binary, const void *records, int count) {
+    const unsigned char *rows = (const unsigned char *)records;
+    size_t record_size = arrow_writer.record_size;
+    size_t bound = 0;
+    size_t bitmap = ((size_t)count + 7) / 8;
+    size_t header_ref;
+    ArrowBatch batch;
+    
+    /* Worst case per column: bitmap, offsets or values, text bytes, padding */
+    for (int i = 0; i < RECORD_FIELD_COUNT; i++) {
+        bound += bitmap + ((size_t)count + 1) * sizeof(int) + 
+                 (size_t)count * arrow_writer.columns[i].field->size + 3 * ARROW_ALIGNMENT;
+    }
+    if (!ensure_capacity(&arrow_writer.body, &arrow_writer.body_capacity, bound)) {
+        log_message(LOG_ERROR, "Out of memory building an Arrow record batch");
+        return 0;
+    }
+    memset(&batch, 0, sizeof(ArrowBatch));
+    batch.body = arrow_writer.body;
+    
+    for (int c = 0; c < RECORD_FIELD_COUNT; c++) {
+        ArrowColumn *column = &arrow_writer.columns[c];
+        const unsigned char *src = rows + column->field->offset;
+        size_t width = column->field->size;
+        long long nulls = 0;
+        size_t text_bytes = 0;
+        
+        if (column->type == 's') {
+            for (int r = 0; r < count; r++) {
+                size_t length = text_length(src + (size_t)r * record_size, width);
+                if (length == 0) nulls++;
+                text_bytes += length;
+            }
+        }
+        batch.nodes[batch.node_count][0] = count;
+        batch.nodes[batch.node_count][1] = nulls;
+        batch.node_count++;
+        
+        /* Validity bitmap (LSB first); omitted when nothing is null */
+        if (nulls > 0) {
+            unsigned char *validity = arrow_add_buffer(&batch, bitmap);
+            for (int r = 0; r < count; r++) {
+                if (text_length(src + (size_t)r * record_size, width) > 0) {
+                    validity[r >> 3] |= (unsigned char)(1 << (r & 7));
+                }
+            }
+        } else {
+            arrow_add_buffer(&batch, 0);
+        }
+        
+        if (column->type != 's') {
+            unsigned char *values = arrow_add_buffer(&batch, (size_t)count * width);
+            for (int r = 0; r < count; r++) {
+                memcpy(values + (size_t)r * width, src + (size_t)r * record_size, width);
+            }
+        } else if (column->dictionary) {
+            int *codes = (int *)arrow_add_buffer(&batch, (size_t)count * sizeof(int));
+            for (int r = 0; r < count; r++) {
+                const unsigned char *text = src + (size_t)r * record_size;
+                size_t length = text_length(text, width);
+                
+                codes[r] = (length == 0) ? 0 : arrow_dictionary_code(column, text, length);
+                if (codes[r] < 0) {
+                    log_message(LOG_ERROR, "Out of memory growing the %s dictionary", 
+                               column->field->name);
+                    return 0;
+                }
+            }
+        } else {
+            int *offsets = (int *)arrow_add_buffer(&batch, ((size_t)count + 1) * sizeof(int));
+            unsigned char *data;
+            int position = 0;
+            
+            /* The body was sized for the worst case, so offsets stays put */
+            data = arrow_add_buffer(&batch, text_bytes);
+            for (int r = 0; r < count; r++) {
+                const unsigned char *text = src + (size_t)r * record_size;
+                size_t length = text_length(text, width);
+                
+                offsets[r] = position;
+                memcpy(data + position, text, length);
+                position += (int)length;
+            }
+            offsets[count] = position;
+        }
+    }
+    
+    if (arrow_writer.batch_count == arrow_writer.batch_capacity) {
+        int capacity = arrow_writer.batch_capacity ? arrow_writer.batch_capacity * 2 : 256;
+        ArrowBlock *grown = (ArrowBlock *)realloc(arrow_writer.batches, 
+                                                 capacity * sizeof(ArrowBlock));
+        if (grown == NULL) {
+            log_message(LOG_ERROR, "Out of memory growing the Arrow footer");
+            return 0;
+        }
+        arrow_writer.batches = grown;
+        arrow_writer.batch_capacity = capacity;
+    }
+    
+    header_ref = arrow_begin_message(&arrow_writer.fb, ARROW_HEADER_BATCH, (long long)batch.size);
+    fb_ref(&arrow_writer.fb, header_ref, 
+           arrow_build_record_batch(&arrow_writer.fb, count, &batch));
+    if (!arrow_write_message(binary, batch.body, batch.size, 
+                             &arrow_writer.batches[arrow_writer.batch_count])) {
+        return 0;
+    }
+    arrow_writer.batch_count++;
+    stats.record_batches++;
+    return 1;
+}
+
+/*
+ * Function: arrow_writer_close
+ * Description: Write the dictionaries (one batch each, listed in the footer
+ *              like the record batches), the end-of-stream marker, the
+ *              footer and the closing magic
+ */
+int arrow_writer_close(FILE *binary) {
+    static const unsigned int end_of_stream[2] = { ARROW_CONTINUATION, 0 };
+    FlatBuilder *fb = &arrow_writer.fb;
+    FbField footer_fields[4] = { { 0, 2, ARROW_METADATA_V5 }, { 1, 4, 0 }, { 2, 4, 0 }, { 3, 4, 0 } };
+    size_t refs[4];
+    size_t root;
+    int footer_size;
+    
+    if (!arrow_writer.active) return 1;
+    
+    for (int c = 0; c < RECORD_FIELD_COUNT; c++) {
+        ArrowColumn *column = &arrow_writer.columns[c];
+        FbField dictionary_fields[2] = { { 0, 8, c }, { 1, 4, 0 } };
+        size_t header_ref;
+        size_t bound;
+        ArrowBatch batch;
+        
+        if (!column->dictionary) continue;
+        
+        bound = ((size_t)column->entries + 1) * sizeof(int) + column->values_size + 
+                3 * ARROW_ALIGNMENT;
+        if (!ensure_capacity(&arrow_writer.body, &arrow_writer.body_capacity, bound)) {
+            log_message(LOG_ERROR, "Out of memory writing the %s dictionary", column->field->name);
+            return 0;
+        }
+        memset(&batch, 0, sizeof(ArrowBatch));
+        batch.body = arrow_writer.body;
+        batch.nodes[0][0] = column->entries;
+        batch.node_count = 1;
+        arrow_add_buffer(&batch, 0);
+        if (column->entries > 0) {
+            memcpy(arrow_add_buffer(&batch, ((size_t)column->entries + 1) * sizeof(int)), 
+                   column->offsets, ((size_t)column->entries + 1) * sizeof(int));
+        } else {
+            arrow_add_buffer(&batch, sizeof(int));
+        }
+        memcpy(arrow_add_buffer(&batch, column->values_size), column->values, 
+               column->values_size);
+        
+        header_ref = arrow_begin_message(fb, ARROW_HEADER_DICTIONARY, (long long)batch.size);
+        fb_ref(fb, header_ref, fb_table(fb, dictionary_fields, 2, refs));
+        fb_ref(fb, refs[1], arrow_build_record_batch(fb, column->entries, &batch));
+        if (!arrow_write_message(binary, batch.body, batch.size, 
+                                 &arrow_writer.dictionaries[arrow_writer.dictionary_count])) {
+            return 0;
+        }
+        arrow_writer.dictionary_count++;
+    }
+    
+    fb->size = 0;
+    fb->failed = 0;
+    root = fb_reserve(fb, sizeof(unsigned int));
+    fb_ref(fb, root, fb_table(fb, footer_fields, 4, refs));
+    fb_ref(fb, refs[1], arrow_build_schema(fb));
+    fb_ref(fb, refs[2], fb_vector(fb, arrow_writer.dictionaries, sizeof(ArrowBlock), 
+                                  arrow_writer.dictionary_count));
+    fb_ref(fb, refs[3], fb_vector(fb, arrow_writer.batches, sizeof(ArrowBlock), 
+                                  arrow_writer.batch_count));
+    if (fb->failed) {
+        log_message(LOG_ERROR, "Out of memory building the Arrow footer");
+        return 0;
+    }
+    
+    footer_size = (int)fb->size;
+    if (fwrite(end_of_stream, sizeof(end_of_stream), 1, binary) != 1 ||
+        fwrite(fb->data, 1, fb->size, binary) != fb->size ||
+        fwrite(&footer_size, sizeof(footer_size), 1, binary) != 1 ||
+        fwrite(ARROW_MAGIC, 1, strlen(ARROW_MAGIC), binary) != strlen(ARROW_MAGIC)) {
+        log_message(LOG_ERROR, "Could not write Arrow footer: %s", strerror(errno));
+        return 0;
+    }
+    stats.bytes_written += (long long)(sizeof(end_of_stream) + fb->size + sizeof(footer_size) + 
+                                       strlen(ARROW_MAGIC));
+    arrow_writer_free();
+    return 1;
+}
+
+/*
+ * Function: arrow_writer_free
+ * Description: Release the Arrow writer
+ */
+void arrow_writer_free(void) {
+    for (int c = 0; c < RECORD_FIELD_COUNT; c++) {
+        free(arrow_writer.columns[c].values);
+        free(arrow_writer.columns[c].offsets);
+        free(arrow_writer.columns[c].slots);
+    }
+    free(arrow_writer.fb.data);
+    free(arrow_writer.body);
+    free(arrow_writer.batches);
+    memset(&arrow_writer, 0, sizeof(ArrowWriter));
+}
+
+/*
+ * Function: sort_run_name
+ * Description: Path of run file id (beside the output, removed when merged)
+ */
+static void sort_run_name(int id, char *path, size_t size) {
+    snprintf(path, size, "%s.sort%04d", sorter.output_file, id);
+}
+
+/*
+ * Function: sort_open
+ * Description: Start collecting output records into sorted runs
+ */
+int sort_open(const char *output_file, size_t record_size) {
+    const FieldLayout *fields = record_layout(record_size);
+    unsigned long long per_record = record_size + 2 * sizeof(unsigned long long);
+    
+    memset(&sorter, 0, sizeof(ExternalSorter));
+    sorter.record_size = record_size;
+    secure_strncpy(sorter.output_file, output_file, sizeof(sorter.output_file));
+    for (int i = 0; i < RECORD_FIELD_COUNT; i++) {
+        if (strcmp(fields[i].name, "customer_id") == 0) sorter.key_offset = fields[i].offset;
+    }
+    
+    sorter.run_capacity = (size_t)((unsigned long long)options.sort_memory / per_record);
+    if (sorter.run_capacity > 0xFFFFFFFFu) sorter.run_capacity = 0xFFFFFFFFu;
+    sorter.records = (unsigned char *)malloc(sorter.run_capacity * record_size);
+    sorter.items = (unsigned long long *)malloc(sorter.run_capacity * sizeof(unsigned long long));
+    sorter.scratch = (unsigned long long *)malloc(sorter.run_capacity * sizeof(unsigned long long));
+    if (sorter.records == NULL || sorter.items == NULL || sorter.scratch == NULL) {
+        log_message(LOG_ERROR, "Could not allocate %lld MB for sorting (lower --sort-memory)", 
+                   options.sort_memory >> 20);
+        sort_free();
+        return 0;
+    }
+    sorter.active = 1;
+    return 1;
+}
+
+/*
+ * Function: sort_run
+ * Description: Order the records of the current run: LSD radix sort of
+ *              (key, position) pairs, 8 bits at a time. Stable, so equal
+ *              IDs keep their input order. Leaves the order in items.
+ */
+static void sort_run(void) {
+    size_t n = sorter.run_count;
+    unsigned long long *items = sorter.items;
+    unsigned long long *scratch = sorter.scratch;
+    
+    for (size_t i = 0; i < n; i++) {
+        int key;
+        memcpy(&key, sorter.records + i * sorter.record_size + sorter.key_offset, sizeof(key));
+        /* Flipping the sign bit makes signed order unsigned order */
+        items[i] = ((unsigned long long)((unsigned int)key ^ 0x80000000u) << 32) | i;
+    }
+    
+    for (int shift = 32; shift < 64 && n > 0; shift += SORT_RADIX_BITS) {
+        size_t counts[1 << SORT_RADIX_BITS] = {0};
+        size_t total = 0;
+        unsigned long long *swap;
+        
+        for (size_t i = 0; i < n; i++) counts[(items[i] >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++;
+        if (counts[(items[0] >> shift) & ((1 << SORT_RADIX_BITS) - 1)] == n) continue;
+        
+        for (int d = 0; d < (1 << SORT_RADIX_BITS); d++) {
+            size_t c = counts[d];
+            counts[d] = total;
+            total += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            scratch[counts[(items[i] >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++] = items[i];
+        }
+        swap = items;
+        items = scratch;
+        scratch = swap;
+    }
+    sorter.items = items;
+    sorter.scratch = scratch;
+}
+
+/*
+ * Function: sort_add_run
+ * Description: Remember run file id for merging
+ */
+static int sort_add_run(int id) {
+    if (sorter.run_count_files == sorter.run_capacity_files) {
+        int capacity = sorter.run_capacity_files ? sorter.run_capacity_files * 2 : 64;
+        int *grown = (int *)realloc(sorter.runs, capacity * sizeof(int));
+        if (grown == NULL) {
+            log_message(LOG_ERROR, "Out of memory tracking sort runs");
+            return 0;
+        }
+        sorter.runs = grown;
+        sorter.run_capacity_files = capacity;
+    }
+    sorter.runs[sorter.run_count_files++] = id;
+    return 1;
+}
+
+/*
+ * Function: sort_spill
+ * Description: Sort the current run and write it to a new run file
+ */
+static int sort_spill(void) {
+    char path[MAX_PATH_LEN];
+    FILE *run;
+    int id = sorter.next_run++;
+    int ok = 1;
+    
+    if (sorter.run_count == 0) return 1;
+    sort_run();
+    
+    sort_run_name(id, path, sizeof(path));
+    run = fopen(path, "wb");
+    if (run == NULL || !sort_add_run(id)) {
+        log_message(LOG_ERROR, "Could not create sort run '%s': %s", path, strerror(errno));
+        if (run != NULL) fclose(run);
+        return 0;
+    }
+    setvbuf(run, NULL, _IOFBF, 1 << 20);
+    for (size_t i = 0; i < sorter.run_count && ok; i++) {
+        size_t at = (size_t)(sorter.items[i] & 0xFFFFFFFFu);
+        ok = fwrite(sorter.records + at * sorter.record_size, sorter.record_size, 1, run) == 1;
+    }
+    if (fclose(run) != 0) ok = 0;
+    if (!ok) {
+        log_message(LOG_ERROR, "Could not write sort run '%s': %s", path, strerror(errno));
+        return 0;
+    }
+    
+    stats.sort_runs++;
+    stats.sort_spilled_bytes += (long long)(sorter.run_count * sorter.record_size);
+    sorter.run_count = 0;
+    return 1;
+}
+
+/*
+ * Function: sort_add_records
+ * Description: Take records bound for the output into the current run,
+ *              spilling it whenever the memory budget is full
+ */
+int sort_add_records(const void *records, int count) {
+    const unsigned char *src = (const unsigned char *)records;
+    
+    while (count > 0) {
+        size_t n = sorter.run_capacity - sorter.run_count;
+        
+        if (n > (size_t)count) n = (size_t)count;
+        memcpy(sorter.records + sorter.run_count * sorter.record_size, src, n * sorter.record_size);
+        sorter.run_count += n;
+        src += n * sorter.record_size;
+        count -= (int)n;
+        
+        if (sorter.run_count == sorter.run_capacity && !sort_spill()) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: sort_input_key
+ * Description: Biased key of an input's current record; inputs that are
+ *              used up sort after everything
+ */
+static unsigned long long sort_input_key(const SortInput *input) {
+    int key;
+    
+    if (input->done) return 1ULL << 32;
+    memcpy(&key, input->buffer + input->pos + sorter.key_offset, sizeof(key));
+    return (unsigned int)key ^ 0x80000000u;
+}
+
+/*
+ * Function: sort_input_fill
+ * Description: Make sure an input has a current record (sets done at EOF)
+ */
+static void sort_input_fill(SortInput *input) {
+    if (input->pos < input->filled) return;
+    input->filled = fread(input->buffer, 1, input->capacity, input->file);
+    input->filled -= input->filled % sorter.record_size;
+    input->pos = 0;
+    if (input->filled == 0) input->done = 1;
+}
+
+/*
+ * Function: loser_tree_replay
+ * Description: Play input s up from its leaf: each node keeps the loser
+ *              and passes the winner on; tree[0] ends up with the smallest
+ *              key (ties to the earlier run, so merging is stable). Nodes
+ *              still -1 while building take the climber and stop there.
+ */
+static void loser_tree_replay(int *tree, const SortInput *inputs, int k, int s) {
+    int winner = s;
+    unsigned long long winner_key = sort_input_key(&inputs[s]);
     
-    /* Trim trailing space */
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
+    for (int node = (s + k) / 2; node > 0; node /= 2) {
+        int other = tree[node];
+        unsigned long long other_key;
+        
+        if (other < 0) {
+            tree[node] = winner;
+            return;
+        }
+        other_key = sort_input_key(&inputs[other]);
+        if (other_key < winner_key || (other_key == winner_key && other < winner)) {
+            tree[node] = winner;
+            winner = other;
+            winner_key = other_key;
+        }
+    }
+    tree[0] = winner;
+}
+
+/*
+ * Function: sort_merge
+ * Description: Merge runs[first..first+k) in one pass. To a new run file
+ *              if out_id >= 0, otherwise into the output through
+ *              write_records, WRITE_BUFFER_SIZE records per batch.
+ */
+static int sort_merge(FILE *binary, int first, int k, int out_id, unsigned char *memory, 
+                      size_t memory_size) {
+    SortInput inputs[SORT_MAX_FAN_IN];
+    int tree[SORT_MAX_FAN_IN];
+    size_t batch_bytes = (size_t)WRITE_BUFFER_SIZE * sorter.record_size;
+    size_t per_input = (memory_size - batch_bytes) / (size_t)k;
+    unsigned char *batch = memory + per_input * (size_t)k;
+    size_t batch_used = 0;
+    char path[MAX_PATH_LEN];
+    FILE *out = NULL;
+    int ok = 1;
+    
+    per_input -= per_input % sorter.record_size;
+    memset(inputs, 0, sizeof(inputs));
+    for (int i = 0; i < k && ok; i++) {
+        sort_run_name(sorter.runs[first + i], path, sizeof(path));
+        inputs[i].file = fopen(path, "rb");
+        inputs[i].buffer = memory + per_input * (size_t)i;
+        inputs[i].capacity = per_input;
+        if (inputs[i].file == NULL) {
+            log_message(LOG_ERROR, "Could not reopen sort run '%s': %s", path, strerror(errno));
+            ok = 0;
+        } else {
+            sort_input_fill(&inputs[i]);
+        }
+    }
+    if (ok && out_id >= 0) {
+        sort_run_name(out_id, path, sizeof(path));
+        out = fopen(path, "wb");
+        if (out == NULL) {
+            log_message(LOG_ERROR, "Could not create sort run '%s': %s", path, strerror(errno));
+            ok = 0;
+        }
+    }
     
-    *(end + 1) = '\0';
+    if (ok) {
+        for (int i = 0; i < k; i++) tree[i] = -1;
+        for (int i = k - 1; i >= 0; i--) loser_tree_replay(tree, inputs, k, i);
+    }
     
-    return str;
+    while (ok && !inputs[tree[0]].done) {
+        SortInput *input = &inputs[tree[0]];
+        
+        memcpy(batch + batch_used, input->buffer + input->pos, sorter.record_size);
+        batch_used += sorter.record_size;
+        input->pos += sorter.record_size;
+        sort_input_fill(input);
+        loser_tree_replay(tree, inputs, k, tree[0]);
+        
+        if (batch_used == batch_bytes || (batch_used > 0 && inputs[tree[0]].done)) {
+            if (out != NULL) {
+                ok = fwrite(batch, 1, batch_used, out) == batch_used;
+                stats.sort_spilled_bytes += (long long)batch_used;
+            } else {
+                ok = write_records(binary, batch, sorter.record_size, 
+                                   (int)(batch_used / sorter.record_size));
+            }
+            batch_used = 0;
+        }
+    }
+    
+    for (int i = 0; i < k; i++) {
+        if (inputs[i].file == NULL) continue;
+        fclose(inputs[i].file);
+        sort_run_name(sorter.runs[first + i], path, sizeof(path));
+        remove(path);
+    }
+    if (out != NULL && fclose(out) != 0) ok = 0;
+    if (!ok && out_id >= 0) log_message(LOG_ERROR, "Could not write sort run: %s", strerror(errno));
+    return ok;
 }
 
 /*
- * Function: secure_strncpy
- * Description: Safe string copy with guaranteed null termination
+ * Function: sort_finish
+ * Description: Write everything collected to the output in customer_id
+ *              order. A single run goes straight from memory; otherwise
+ *              the runs are merged SORT_MAX_FAN_IN (or as many as the
+ *              budget gives a read buffer) at a time until one pass can
+ *              feed the output.
  */
-char* secure_strncpy(char *dest, const char *src, size_t dest_size) {
-    if (dest == NULL || src == NULL || dest_size == 0) {
-        return dest;
+int sort_finish(FILE *binary) {
+    size_t memory_size;
+    unsigned char *memory;
+    int fan_in;
+    int ok = 1;
+    
+    if (!sorter.active) return 1;
+    sorter.active = 0;
+    
+    if (sorter.run_count_files == 0) {
+        size_t done = 0;
+        unsigned char *batch = (unsigned char *)malloc((size_t)WRITE_BUFFER_SIZE * sorter.record_size);
+        
+        if (batch == NULL) {
+            log_message(LOG_ERROR, "Out of memory writing sorted output");
+            sort_free();
+            return 0;
+        }
+        sort_run();
+        while (ok && done < sorter.run_count) {
+            size_t n = sorter.run_count - done;
+            if (n > WRITE_BUFFER_SIZE) n = WRITE_BUFFER_SIZE;
+            for (size_t i = 0; i < n; i++) {
+                size_t at = (size_t)(sorter.items[done + i] & 0xFFFFFFFFu);
+                memcpy(batch + i * sorter.record_size, sorter.records + at * sorter.record_size, 
+                       sorter.record_size);
+            }
+            ok = write_records(binary, batch, sorter.record_size, (int)n);
+            done += n;
+        }
+        free(batch);
+        sort_free();
+        return ok;
     }
     
-    size_t i;
-    for (i = 0; i < dest_size - 1 && src[i] != '\0'; i++) {
-        dest[i] = src[i];
+    /* Everything left on disk: the run buffers become merge buffers */
+    if (!sort_spill()) return 0;
+    free(sorter.items);
+    free(sorter.scratch);
+    sorter.items = sorter.scratch = NULL;
+    memory = sorter.records;
+    sorter.records = NULL;
+    memory_size = sorter.run_capacity * sorter.record_size;
+    
+    fan_in = 0;
+    if (memory_size > (size_t)WRITE_BUFFER_SIZE * sorter.record_size) {
+        size_t read_buffer = (size_t)SORT_MIN_READ_BUFFER > sorter.record_size ? 
+                             (size_t)SORT_MIN_READ_BUFFER : sorter.record_size;
+        fan_in = (int)((memory_size - (size_t)WRITE_BUFFER_SIZE * sorter.record_size) / read_buffer);
+    }
+    if (fan_in > SORT_MAX_FAN_IN) fan_in = SORT_MAX_FAN_IN;
+    if (fan_in < 2) {
+        free(memory);
+        log_message(LOG_ERROR, "--sort-memory is too small to merge sort runs");
+        sort_free();
+        return 0;
     }
-    dest[i] = '\0';
     
-    return dest;
+    /*
+     * Merge the oldest runs into a new one until a single pass remains. The
+     * merged run takes their place at the front: ties go to the lower input,
+     * so run order must stay input order for the sort to be stable.
+     */
+    while (ok && sorter.run_count_files > fan_in) {
+        int id = sorter.next_run++;
+        int k = fan_in;
+        
+        if (sorter.run_count_files - fan_in + 1 < k) k = sorter.run_count_files - fan_in + 1;
+        ok = sort_merge(binary, 0, k, id, memory, memory_size);
+        if (ok) {
+            stats.sort_merge_passes++;
+            sorter.runs[0] = id;
+            memmove(sorter.runs + 1, sorter.runs + k, (sorter.run_count_files - k) * sizeof(int));
+            sorter.run_count_files -= k - 1;
+        }
+    }
+    if (ok) {
+        ok = sort_merge(binary, 0, sorter.run_count_files, -1, memory, memory_size);
+        stats.sort_merge_passes++;
+        sorter.run_count_files = 0;
+    }
+    
+    free(memory);
+    sort_free();
+    return ok;
 }
 
 /*
- * Function: safe_atoi
- * Description: Safe string to integer conversion with validation
+ * Function: sort_free
+ * Description: Release the sorter and remove any run files left behind
  */
-int safe_atoi(const char *str, int *value) {
-    char *endptr;
-    long val;
+void sort_free(void) {
+    char path[MAX_PATH_LEN];
     
-    if (str == NULL || *str == '\0') {
+    for (int i = 0; i < sorter.run_count_files; i++) {
+        sort_run_name(sorter.runs[i], path, sizeof(path));
+        remove(path);
+    }
+    free(sorter.records);
+    free(sorter.items);
+    free(sorter.scratch);
+    free(sorter.runs);
+    memset(&sorter, 0, sizeof(ExternalSorter));
+}
+
+/*
+ * Function: shard_key_name
+ * Description: Name of a --shard-by key for reports
+ */
+const char* shard_key_name(ShardKey key) {
+    switch (key) {
+        case SHARD_BY_RANGE: return "customer_id range";
+        case SHARD_BY_STATE: return "state";
+        default: return "customer_id hash";
+    }
+}
+
+/*
+ * Function: shard_writer_open
+ * Description: Create OUTPUT.shardNN for every shard, each with its own
+ *              header (unless --no-header) and batch buffer
+ */
+int shard_writer_open(const char *output_file, size_t record_size) {
+    const FieldLayout *fields = record_layout(record_size);
+    
+    memset(&shard_writer, 0, sizeof(ShardWriter));
+    shard_writer.record_size = record_size;
+    for (int i = 0; i < RECORD_FIELD_COUNT; i++) {
+        if (strcmp(fields[i].name, "customer_id") == 0) shard_writer.id_offset = fields[i].offset;
+        if (strcmp(fields[i].name, "state") == 0) {
+            shard_writer.state_offset = fields[i].offset;
+            shard_writer.state_size = fields[i].size;
+        }
+    }
+    
+    shard_writer.shards = (OutputShard *)calloc(options.shard_count, sizeof(OutputShard));
+    if (shard_writer.shards == NULL) {
+        log_message(LOG_ERROR, "Out of memory opening output shards");
         return 0;
     }
+    shard_writer.count = options.shard_count;
     
-    errno = 0;
-    val = strtol(str, &endptr, 10);
+    for (int i = 0; i < shard_writer.count; i++) {
+        OutputShard *shard = &shard_writer.shards[i];
+        
+        snprintf(shard->path, sizeof(shard->path), "%s.shard%02d", output_file, i);
+        shard->buffer = (unsigned char *)malloc((size_t)WRITE_BUFFER_SIZE * record_size);
+        shard->file = fopen(shard->path, "wb");
+        if (shard->buffer == NULL || shard->file == NULL) {
+            log_message(LOG_ERROR, "Could not create output shard '%s': %s", 
+                       shard->path, strerror(errno));
+            return 0;
+        }
+        if (!options.no_header && !write_file_header(shard->file, record_size)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: shard_of
+ * Description: Shard a record belongs to. Hash: (uint32)(id * 2654435769)
+ *              scaled to N, so loaders can recompute it; state: FNV-1a of
+ *              the code mod N (packed ordinals are mapped back to the code
+ *              first, so --packed shards alike)
+ */
+static int shard_of(const unsigned char *record) {
+    unsigned int hash = 2166136261u;
+    int id;
     
-    /* Check for conversion errors */
-    if (errno == ERANGE || val > INT_MAX || val < INT_MIN) {
-        return 0;
+    if (options.shard_by == SHARD_BY_STATE) {
+        const char *state = (const char *)record + shard_writer.state_offset;
+        size_t length;
+        
+        if (shard_writer.state_size == 1) state = state_code(*(const unsigned char *)state);
+        length = text_length((const unsigned char *)state, MAX_STATE);
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ (unsigned char)state[i]) * 16777619u;
+        }
+        /* Modulo: two-letter codes leave FNV's top bits nearly constant */
+        return (int)(hash % (unsigned int)shard_writer.count);
     }
     
-    /* Check if entire string was consumed */
-    if (*endptr != '\0') {
+    memcpy(&id, record + shard_writer.id_offset, sizeof(id));
+    if (options.shard_by == SHARD_BY_RANGE) {
+        /* Bounds ascend: shard i holds IDs in [bound[i-1], bound[i]) */
+        int lo = 0, hi = options.shard_bound_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (id >= options.shard_bounds[mid]) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    hash = (unsigned int)id * 2654435769u;
+    return (int)(((unsigned long long)hash * (unsigned int)shard_writer.count) >> 32);
+}
+
+/*
+ * Function: shard_flush
+ * Description: Write a shard's buffered records to its file
+ */
+static int shard_flush(OutputShard *shard) {
+    size_t written;
+    
+    if (shard->buffered == 0) return 1;
+    written = fwrite(shard->buffer, shard_writer.record_size, shard->buffered, shard->file);
+    if (written != (size_t)shard->buffered) {
+        log_message(LOG_ERROR, "Batch write to '%s' failed: expected %d, wrote %zu", 
+                   shard->path, shard->buffered, written);
         return 0;
     }
+    stats.bytes_written += (long long)(written * shard_writer.record_size);
+    shard->records += shard->buffered;
+    shard->buffered = 0;
+    return 1;
+}
+
+/*
+ * Function: shard_write_records
+ * Description: Route each record into its shard's buffer, writing a
+ *              shard out whenever its buffer fills
+ */
+int shard_write_records(const void *records, int count) {
+    const unsigned char *record = (const unsigned char *)records;
     
-    *value = (int)val;
+    for (int i = 0; i < count; i++, record += shard_writer.record_size) {
+        OutputShard *shard = &shard_writer.shards[shard_of(record)];
+        
+        memcpy(shard->buffer + (size_t)shard->buffered * shard_writer.record_size, record, 
+               shard_writer.record_size);
+        if (++shard->buffered == WRITE_BUFFER_SIZE && !shard_flush(shard)) return 0;
+    }
     return 1;
 }
 
 /*
- * Function: sanitize_input
- * Description: Remove potentially dangerous characters from input
+ * Function: shard_writer_close
+ * Description: Flush every shard, store its record count and close it
  */
-void sanitize_input(char *str) {
-    if (str == NULL) return;
+int shard_writer_close(void) {
+    int ok = 1;
     
-    for (int i = 0; str[i] != '\0'; i++) {
-        /* Remove null bytes and other control characters except tab/newline */
-        if (str[i] < 32 && str[i] != '\t' && str[i] != '\n' && str[i] != '\r') {
-            str[i] = ' ';
+    for (int i = 0; i < shard_writer.count; i++) {
+        OutputShard *shard = &shard_writer.shards[i];
+        
+        if (!shard_flush(shard) || 
+            (!options.no_header && !finalize_file_header(shard->file, shard->records))) {
+            ok = 0;
         }
-        /* Remove potential SQL injection characters (defense in depth) */
-        if (str[i] == '\'' || str[i] == '"' || str[i] == ';' || str[i] == '\\') {
-            /* Allow these in data but log if validation is strict */
-            if (validation_rules.strict_mode) {
-                log_message(LOG_DEBUG, "Special character found in input: %c", str[i]);
-            }
+        if (fclose(shard->file) != 0) {
+            log_message(LOG_ERROR, "Could not close output shard '%s': %s", 
+                       shard->path, strerror(errno));
+            ok = 0;
         }
+        shard->file = NULL;
     }
+    return ok;
 }
 
 /*
- * Function: load_validation_rules
- * Description: Load validation rules from configuration file
+ * Function: shard_writer_free
+ * Description: Release the shard buffers (closing any file still open)
  */
-int load_validation_rules(const char *filename, ValidationRules *rules) {
-    FILE *f;
-    char line[256];
-    int line_num = 0;
+void shard_writer_free(void) {
+    for (int i = 0; i < shard_writer.count; i++) {
+        if (shard_writer.shards[i].file != NULL) fclose(shard_writer.shards[i].file);
+        free(shard_writer.shards[i].buffer);
+    }
+    free(shard_writer.shards);
+    memset(&shard_writer, 0, sizeof(ShardWriter));
+}
+
+/*
+ * Function: read_block_index
+ * Description: Load the footer index of a block layout file (caller frees
+ *              *index). Checks the trailer magic and the index checksum.
+ */
+int read_block_index(FILE *f, const char *filename, BlockTrailer *trailer, 
+                     BlockIndexEntry **index) {
+    size_t index_bytes;
+    
+    *index = NULL;
+    if (FSEEK64(f, -(long long)sizeof(BlockTrailer), SEEK_END) != 0 ||
+        fread(trailer, sizeof(BlockTrailer), 1, f) != 1 ||
+        memcmp(trailer->magic, BLOCK_INDEX_MAGIC, 4) != 0) {
+        log_message(LOG_ERROR, "'%s' has no block index (incomplete file?)", filename);
+        return 0;
+    }
     
-    /* Use defaults if no file specified */
-    if (filename == NULL || strlen(filename) == 0) {
-        log_message(LOG_INFO, "Using default validation rules");
+    index_bytes = (size_t)trailer->block_count * sizeof(BlockIndexEntry);
+    *index = (BlockIndexEntry *)malloc(index_bytes ? index_bytes : 1);
+    if (*index == NULL || FSEEK64(f, trailer->index_offset, SEEK_SET) != 0 ||
+        fread(*index, 1, index_bytes, f) != index_bytes) {
+        log_message(LOG_ERROR, "Could not read block index of '%s'", filename);
+        free(*index);
+        *index = NULL;
+        return 0;
+    }
+    if (crc32c(0, *index, index_bytes) != trailer->index_crc32c) {
+        log_message(LOG_ERROR, "Block index of '%s' fails its checksum", filename);
+        free(*index);
+        *index = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Function: record_reader_open
+ * Description: Prepare to read the records of a converter output file in
+ *              order, whatever its layout
+ */
+int record_reader_open(RecordReader *reader, FILE *f, const char *filename, 
+                       size_t record_size, long long *record_count) {
+    BinaryFileHeader header;
+    long long start = read_file_header(f, filename, record_size, &header);
+    
+    memset(reader, 0, sizeof(RecordReader));
+    if (start < 0) return 0;
+    
+    reader->file = f;
+    reader->record_size = header.record_size ? header.record_size : record_size;
+    reader->packed = (header.flags & BINARY_FLAG_PACKED) != 0;
+    reader->blocked = (header.flags & BINARY_FLAG_BLOCKS) != 0;
+    reader->flags = header.flags;
+    *record_count = header.record_count;
+    
+    if (reader->blocked) {
+        BlockTrailer trailer;
+        BlockIndexEntry *index;
+        
+        if (!read_block_index(f, filename, &trailer, &index)) return 0;
+        free(index);
+        reader->end = trailer.index_offset;
+        FSEEK64(f, start, SEEK_SET);
+    }
+    return 1;
+}
+
+/*
+ * Function: ensure_capacity
+ * Description: Grow a heap buffer to at least needed bytes
+ */
+int ensure_capacity(unsigned char **buffer, size_t *capacity, size_t needed) {
+    unsigned char *grown;
+    
+    if (needed <= *capacity) return 1;
+    grown = (unsigned char *)realloc(*buffer, needed);
+    if (grown == NULL) return 0;
+    *buffer = grown;
+    *capacity = needed;
+    return 1;
+}
+
+/*
+ * Function: inflate_block
+ * Description: Point at the encoded payload of the block in reader->payload,
+ *              decompressing it first if the file is compressed
+ */
+static int inflate_block(RecordReader *reader, size_t stored_size, unsigned int record_count, 
+                         const unsigned char **payload, size_t *payload_size) {
+    unsigned int size;
+    
+    if (!(reader->flags & BINARY_FLAG_COMPRESSED)) {
+        *payload = reader->payload;
+        *payload_size = stored_size;
         return 1;
     }
     
-    f = fopen(filename, "r");
-    if (f == NULL) {
-        log_message(LOG_WARNING, "Could not open validation rules file '%s', using defaults", 
-                   filename);
+    if (stored_size < sizeof(unsigned int)) return 0;
+    memcpy(&size, reader->payload, sizeof(unsigned int));
+    if (size == stored_size - sizeof(unsigned int)) {
+        *payload = reader->payload + sizeof(unsigned int);
+        *payload_size = size;
+        return 1;
+    }
+    if (size > encoded_block_bound(reader->flags, reader->record_size, record_count) ||
+        !ensure_capacity(&reader->inflated, &reader->inflated_capacity, size) ||
+        lz_decompress(reader->payload + sizeof(unsigned int), stored_size - sizeof(unsigned int), 
+                      reader->inflated, size) != size) {
         return 0;
     }
+    *payload = reader->inflated;
+    *payload_size = size;
+    return 1;
+}
+
+/*
+ * Function: read_stored_records
+ * Description: Read up to max_records records as stored; 0 at end of data.
+ *              Blocks are checksummed and decoded one at a time.
+ */
+static size_t read_stored_records(RecordReader *reader, void *buffer, size_t max_records) {
+    unsigned char *dst = (unsigned char *)buffer;
+    size_t total = 0;
     
-    log_message(LOG_INFO, "Loading validation rules from: %s", filename);
+    if (!reader->blocked) {
+        return fread(buffer, reader->record_size, max_records, reader->file);
+    }
     
-    while (fgets(line, sizeof(line), f) != NULL) {
-        char *trimmed;
-        char key[128], value[128];
-        
-        line_num++;
-        trimmed = trim_whitespace(line);
-        
-        /* Skip empty lines and comments */
-        if (strlen(trimmed) == 0 || trimmed[0] == '#' || trimmed[0] == ';') {
-            continue;
-        }
+    while (total < max_records) {
+        size_t n;
         
-        /* Parse key=value format */
-        if (sscanf(trimmed, "%127[^=]=%127s", key, value) == 2) {
-            char *key_trimmed = trim_whitespace(key);
-            char *value_trimmed = trim_whitespace(value);
+        if (reader->block_pos == reader->block_count) {
+            BlockHeader header;
+            long long offset = FTELL64(reader->file);
+            const unsigned char *payload;
+            size_t payload_size;
             
-            /* Convert value to boolean */
-            int bool_value = (strcmp(value_trimmed, "1") == 0 || 
-                            strcmp(value_trimmed, "true") == 0 ||
-                            strcmp(value_trimmed, "TRUE") == 0 ||
-                            strcmp(value_trimmed, "yes") == 0 ||
-                            strcmp(value_trimmed, "YES") == 0);
+            if (offset >= reader->end ||
+                fread(&header, sizeof(BlockHeader), 1, reader->file) != 1) break;
             
-            /* Set rule based on key */
-            if (strcmp(key_trimmed, "validate_email") == 0) {
-                rules->validate_email = bool_value;
-            } else if (strcmp(key_trimmed, "validate_phone") == 0) {
-                rules->validate_phone = bool_value;
-            } else if (strcmp(key_trimmed, "validate_date") == 0) {
-                rules->validate_date = bool_value;
-            } else if (strcmp(key_trimmed, "validate_state") == 0) {
-                rules->validate_state = bool_value;
-            } else if (strcmp(key_trimmed, "validate_zip") == 0) {
-                rules->validate_zip = bool_value;
-            } else if (strcmp(key_trimmed, "allow_empty_fields") == 0) {
-                rules->allow_empty_fields = bool_value;
-            } else if (strcmp(key_trimmed, "strict_mode") == 0) {
-                rules->strict_mode = bool_value;
-            } else {
-                log_message(LOG_WARNING, "Unknown validation rule at line %d: %s", 
-                           line_num, key_trimmed);
+            if (!ensure_capacity(&reader->payload, &reader->payload_capacity, header.stored_size) ||
+                !ensure_capacity(&reader->rows, &reader->rows_capacity, 
+                                 (size_t)header.record_count * reader->record_size) ||
+                fread(reader->payload, 1, header.stored_size, reader->file) != header.stored_size ||
+                crc32c(0, reader->payload, header.stored_size) != header.crc32c ||
+                !inflate_block(reader, header.stored_size, header.record_count, 
+                               &payload, &payload_size) ||
+                !decode_block(reader->flags & ~BINARY_FLAG_COMPRESSED, reader->record_size, 
+                              payload, payload_size, header.record_count, reader->rows)) {
+                log_message(LOG_ERROR, "Damaged block at offset %lld", offset);
+                break;
             }
+            reader->block_count = header.record_count;
+            reader->block_pos = 0;
+            continue;
         }
+        
+        n = max_records - total;
+        if (n > reader->block_count - reader->block_pos) n = reader->block_count - reader->block_pos;
+        memcpy(dst + total * reader->record_size, 
+               reader->rows + (size_t)reader->block_pos * reader->record_size, 
+               n * reader->record_size);
+        reader->block_pos += (unsigned int)n;
+        total += n;
     }
-    
-    fclose(f);
-    
-    /* Log loaded rules */
-    log_message(LOG_INFO, "Validation rules loaded:");
-    log_message(LOG_INFO, "  Email validation: %s", rules->validate_email ? "ON" : "OFF");
-    log_message(LOG_INFO, "  Phone validation: %s", rules->validate_phone ? "ON" : "OFF");
-    log_message(LOG_INFO, "  Date validation: %s", rules->validate_date ? "ON" : "OFF");
-    log_message(LOG_INFO, "  State validation: %s", rules->validate_state ? "ON" : "OFF");
-    log_message(LOG_INFO, "  Zip validation: %s", rules->validate_zip ? "ON" : "OFF");
-    log_message(LOG_INFO, "  Allow empty fields: %s", rules->allow_empty_fields ? "YES" : "NO");
-    log_message(LOG_INFO, "  Strict mode: %s", rules->strict_mode ? "ON" : "OFF");
-    
-    return 1;
+    return total;
 }
 
 /*
- * Function: validate_customer_id
- * Description: Validate customer ID is a positive integer
+ * Function: record_reader_read
+ * Description: Read up to max_records records of the size the reader was
+ *              opened for; 0 at end of data. Packed customers are unpacked.
  */
-int validate_customer_id(const char *str) {
-    int value;
+size_t record_reader_read(RecordReader *reader, void *buffer, size_t max_records) {
+    PackedCustomer *packed;
+    size_t n;
     
-    if (!safe_atoi(str, &value)) {
+    if (!reader->packed) return read_stored_records(reader, buffer, max_records);
+    
+    if (!ensure_capacity(&reader->stored, &reader->stored_capacity, 
+                         max_records * sizeof(PackedCustomer))) {
+        log_message(LOG_ERROR, "Out of memory reading packed records");
         return 0;
     }
-    
-    return (value > 0);
+    n = read_stored_records(reader, reader->stored, max_records);
+    packed = (PackedCustomer *)reader->stored;
+    for (size_t i = 0; i < n; i++) unpack_customer(&packed[i], (Customer *)buffer + i);
+    return n;
 }
 
 /*
- * Function: validate_email
- * Description: Validate email format (basic check)
+ * Function: record_reader_close
+ * Description: Free the reader's block buffers (the file stays open)
  */
-int validate_email(const char *email) {
-    char *at, *dot;
-    size_t len;
-    
-    if (email == NULL || *email == '\0') {
-        return !validation_rules.allow_empty_fields ? 0 : 1;
-    }
-    
-    len = strlen(email);
-    
-    /* Check minimum length */
-    if (len < 6) return 0;  /* Minimum: a@b.co */
+void record_reader_close(RecordReader *reader) {
+    free(reader->payload);
+    free(reader->rows);
+    free(reader->stored);
+    free(reader->inflated);
+    reader->payload = reader->rows = reader->stored = reader->inflated = NULL;
+    reader->payload_capacity = reader->rows_capacity = reader->stored_capacity = 0;
+    reader->inflated_capacity = 0;
+}
+
+/*
+ * Function: verify_binary_file
+ * Description: --verify: check a converter output file's header, record
+ *              count and (block layout) every block checksum without
+ *              decoding records. Prints bad blocks with their record range.
+ */
+int verify_binary_file(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    BinaryFileHeader header;
+    BlockTrailer trailer;
+    BlockIndexEntry *index;
+    unsigned char *payload = NULL;
+    size_t payload_capacity = 0;
+    long long records = 0;
+    int bad = 0;
     
-    /* Must contain exactly one @ */
-    at = strchr(email, '@');
-    if (at == NULL || at == email || strchr(at + 1, '@') != NULL) {
+    if (f == NULL) {
+        log_message(LOG_ERROR, "Could not open '%s': %s", filename, strerror(errno));
         return 0;
     }
     
-    /* Must contain at least one . after @ */
-    dot = strrchr(email, '.');
-    if (dot == NULL || dot < at || dot == email + len - 1) {
+    if (fread(&header, sizeof(BinaryFileHeader), 1, f) != 1 ||
+        memcmp(header.magic, BINARY_MAGIC, 4) != 0) {
+        log_message(LOG_ERROR, "'%s' has no file header; nothing to verify", filename);
+        fclose(f);
         return 0;
     }
     
-    /* Check for valid characters */
-    for (size_t i = 0; i < len; i++) {
-        char c = email[i];
-        if (!isalnum((unsigned char)c) && c != '@' && c != '.' && 
-            c != '_' && c != '-' && c != '+') {
+    printf("%s: %s records, %u bytes each, format version %u\n", filename, 
+           header.record_type, header.record_size, header.version);
+    if (header.record_count == BINARY_COUNT_UNKNOWN) {
+        printf("  Header was never finalized (writer did not finish)\n");
+        bad++;
+    }
+    
+    if (!(header.flags & BINARY_FLAG_BLOCKS)) {
+        long long size;
+        
+        FSEEK64(f, 0, SEEK_END);
+        size = FTELL64(f) - header.header_size;
+        records = size / (long long)header.record_size;
+        if (size % (long long)header.record_size != 0) {
+            printf("  %lld trailing bytes after the last whole record\n", 
+                   size % (long long)header.record_size);
+            bad++;
+        }
+        printf("  Flat layout: no block checksums\n");
+    } else {
+        if (!read_block_index(f, filename, &trailer, &index)) {
+            fclose(f);
             return 0;
         }
+        
+        for (unsigned int b = 0; b < trailer.block_count; b++) {
+            const BlockIndexEntry *entry = &index[b];
+            BlockHeader block;
+            const char *problem = NULL;
+            
+            if (entry->stored_size > payload_capacity) {
+                free(payload);
+                payload_capacity = entry->stored_size;
+                payload = (unsigned char *)malloc(payload_capacity);
+                if (payload == NULL) {
+                    log_message(LOG_ERROR, "Out of memory verifying '%s'", filename);
+                    free(index);
+                    fclose(f);
+                    return 0;
+                }
+            }
+            
+            if (entry->first_record != records) {
+                problem = "index ordinals are not contiguous";
+            } else if (FSEEK64(f, entry->offset, SEEK_SET) != 0 ||
+                       fread(&block, sizeof(BlockHeader), 1, f) != 1 ||
+                       fread(payload, 1, entry->stored_size, f) != entry->stored_size) {
+                problem = "block is truncated";
+            } else if (block.record_count != entry->record_count ||
+                       block.stored_size != entry->stored_size ||
+                       block.crc32c != entry->crc32c) {
+                problem = "block header does not match the index";
+            } else if (crc32c(0, payload, entry->stored_size) != entry->crc32c) {
+                problem = "checksum mismatch";
+            }
+            
+            if (problem != NULL) {
+                printf("  Block %u (records %lld-%lld, offset %lld): %s\n", b, 
+                       entry->first_record, entry->first_record + entry->record_count - 1, 
+                       entry->offset, problem);
+                bad++;
+            }
+            records = entry->first_record + entry->record_count;
+        }
+        printf("  %u blocks checked, %d bad\n", trailer.block_count, bad);
+        free(index);
+        free(payload);
     }
     
-    return 1;
+    if (header.record_count != BINARY_COUNT_UNKNOWN && header.record_count != records) {
+        printf("  Header lists %lld records, file holds %lld\n", header.record_count, records);
+        bad++;
+    }
+    printf("%s: %s\n", filename, bad ? "FAILED" : "OK");
+    
+    fclose(f);
+    return bad == 0;
 }
 
 /*
- * Function: validate_phone
- * Description: Validate phone format (XXX-XXX-XXXX)
+ * Function: write_records
+ * Description: Write a batch of fixed-size records to binary file
  */
-int validate_phone(const char *phone) {
-    size_t len;
-    
-    if (phone == NULL || *phone == '\0') {
-        return !validation_rules.allow_empty_fields ? 0 : 1;
-    }
+int write_records(FILE *binary, const void *buffer, size_t record_size, int count) {
+    size_t written;
     
-    len = strlen(phone);
+    if (count == 0) return 1;
+    if (sorter.active) return sort_add_records(buffer, count);
+    if (shard_writer.count > 0) return shard_write_records(buffer, count);
+    if (arrow_writer.active) return arrow_write_batch(binary, buffer, count);
+    if (block_writer.data != NULL) return block_write_records(binary, buffer, count);
     
-    /* Check for standard format: XXX-XXX-XXXX (12 characters) */
-    if (len != 12) return 0;
+    written = fwrite(buffer, record_size, count, binary);
     
-    /* Verify format */
-    for (int i = 0; i < 12; i++) {
-        if (i == 3 || i == 7) {
-            if (phone[i] != '-') return 0;
-        } else {
-            if (!isdigit((unsigned char)phone[i])) return 0;
-        }
+    if (written != (size_t)count) {
+        log_message(LOG_ERROR, "Batch write failed: expected %d, wrote %zu", 
+                   count, written);
+        return 0;
     }
     
+    stats.bytes_written += (long long)(written * record_size);
+    
     return 1;
 }
 
 /*
- * Function: validate_date
- * Description: Validate date format (YYYY-MM-DD)
+ * Function: output_record_size
+ * Description: Size of one record as stored in the output file
  */
-int validate_date(const char *date) {
-    int year, month, day;
-    
-    if (date == NULL || *date == '\0') {
-        return !validation_rules.allow_empty_fields ? 0 : 1;
-    }
-    
-    /* Check format: YYYY-MM-DD (10 characters) */
-    if (strlen(date) != 10) return 0;
-    
-    if (date[4] != '-' || date[7] != '-') return 0;
-    
-    /* Verify all other characters are digits */
-    for (int i = 0; i < 10; i++) {
-        if (i != 4 && i != 7) {
-            if (!isdigit((unsigned char)date[i])) return 0;
-        }
-    }
-    
-    /* Parse and validate date components */
-    year = atoi(date);
-    month = atoi(date + 5);
-    day = atoi(date + 8);
+size_t output_record_size(void) {
+    if (options.transactions_mode) return sizeof(Transaction);
+    return options.packed ? sizeof(PackedCustomer) : sizeof(Customer);
+}
+
+/*
+ * Function: write_customers
+ * Description: Write customer records in the output's record layout
+ *              (--packed records read back for keep-last; new records are
+ *              packed on input)
+ */
+int write_customers(FILE *binary, const Customer *buffer, int count) {
+    PackedCustomer packed[WRITE_BUFFER_SIZE / 4];
+    int max = (int)(sizeof(packed) / sizeof(packed[0]));
     
-    if (year < 1900 || year > 2100) return 0;
-    if (month < 1 || month > 12) return 0;
-    if (day < 1 || day > 31) return 0;
+    if (!options.packed) return write_records(binary, buffer, sizeof(Customer), count);
     
-    /* Basic day validation per month */
-    if (month == 2 && day > 29) return 0;
-    if ((month == 4 || month == 6 || month == 9 || month == 11) && day > 30) {
-        return 0;
+    for (int done = 0; done < count; ) {
+        int n = (count - done < max) ? count - done : max;
+        for (int i = 0; i < n; i++) pack_customer(&buffer[done + i], NULL, &packed[i]);
+        if (!write_records(binary, packed, sizeof(PackedCustomer), n)) return 0;
+        done += n;
     }
-    
     return 1;
 }
 
 /*
- * Function: validate_state
- * Description: Validate state code (2 uppercase letters)
+ * Function: write_batch
+ * Description: Write a batch of records to binary file (--packed: the
+ *              records as packed during validation)
  */
-int validate_state(const char *state) {
-    if (state == NULL || *state == '\0') {
-        return !validation_rules.allow_empty_fields ? 0 : 1;
+int write_batch(FILE *binary, const Customer *buffer, const PackedCustomer *packed, 
+                const unsigned int *domain_ids, int count) {
+    if (options.packed) {
+        if (!write_records(binary, packed, sizeof(PackedCustomer), count)) return 0;
+    } else if (!write_customers(binary, buffer, count)) {
+        return 0;
     }
     
-    /* Should be exactly 2 characters */
-    if (strlen(state) != 2) return 0;
-    
-    /* Both should be uppercase letters */
-    if (!isupper((unsigned char)state[0]) || !isupper((unsigned char)state[1])) {
+    /* Domain ID column runs parallel to the records (IDs from normalize_email) */
+    if (domain_id_file != NULL && 
+        fwrite(domain_ids, sizeof(unsigned int), count, domain_id_file) != (size_t)count) {
+        log_message(LOG_ERROR, "Domain ID column write failed");
         return 0;
     }
-    
     return 1;
 }
 
 /*
- * Function: validate_zip
- * Description: Validate ZIP code (5 digits)
+ * Function: parse_transaction_line
+ * Description: Parse a transactions.csv line
  */
-int validate_zip(const char *zip) {
-    if (zip == NULL || *zip == '\0') {
-        return !validation_rules.allow_empty_fields ? 0 : 1;
-    }
+int parse_transaction_line(char *line, Transaction *txn, int line_num) {
+    char *field_start = line;
+    int field_count = 0;
+    char field_buffer[MAX_LINE];
+    int ok = 1;
     
-    /* Should be exactly 5 characters */
-    if (strlen(zip) != 5) return 0;
+    memset(txn, 0, sizeof(Transaction));
+    sanitize_input(line);
     
-    /* All should be digits */
-    for (int i = 0; i < 5; i++) {
-        if (!isdigit((unsigned char)zip[i])) return 0;
+    while (*field_start != '\0' && field_count < 9) {
+        char *trimmed = next_csv_field(&field_start, field_buffer);
+        
+        switch (field_count) {
+            case 0: ok = safe_atoi(trimmed, &txn->transaction_id); break;
+            case 1: ok = safe_atoi(trimmed, &txn->customer_id); break;
+            case 2: ok = safe_atoi(trimmed, &txn->product_id); break;
+            case 3: ok = safe_atoi(trimmed, &txn->location_id); break;
+            case 4: secure_strncpy(txn->transaction_date, trimmed, MAX_DATE); break;
+            case 5: ok = safe_atoi(trimmed, &txn->quantity); break;
+            case 6: ok = safe_atod(trimmed, &txn->unit_price); break;
+            case 7: ok = safe_atod(trimmed, &txn->total_amount); break;
+            case 8: secure_strncpy(txn->payment_method, trimmed, MAX_PAYMENT_METHOD); break;
+        }
+        
+        if (!ok) {
+            log_parse_error(line_num, line, PARSE_ERR_INVALID_NUMBER);
+            return 0;
+        }
+        
+        field_count++;
+    }
+    
+    if (field_count != 9) {
+        log_parse_error(line_num, line, PARSE_ERR_MISSING_FIELDS);
+        return 0;
     }
     
     return 1;
 }
 
 /*
- * Function: validate_customer
- * Description: Validate all customer fields based on rules
+ * Function: validate_transaction
+ * Description: Validate transaction fields (keys positive, date, quantity)
  */
-int validate_customer(Customer *customer, int line_num) {
+int validate_transaction(Transaction *txn, int line_num) {
     int error_code = VAL_OK;
-    int is_valid = 1;
     
-    /* Validate customer ID (always required) */
-    if (customer->customer_id <= 0) {
+    if (txn->transaction_id <= 0 || txn->customer_id <= 0 || 
+        txn->product_id <= 0 || txn->location_id <= 0) {
         error_code |= VAL_ERR_INVALID_ID;
-        is_valid = 0;
     }
     
-    /* Check for empty required fields */
-    if (!validation_rules.allow_empty_fields) {
-        if (strlen(customer->first_name) == 0 || 
-            strlen(customer->last_name) == 0) {
-            error_code |= VAL_ERR_EMPTY_FIELD;
-            is_valid = 0;
-        }
+    if (validation_rules.validate_date && !validate_date(txn->transaction_date)) {
+        error_code |= VAL_ERR_INVALID_DATE;
     }
     
-    /* Validate email */
-    if (validation_rules.validate_email && strlen(customer->email) > 0) {
-        if (!validate_email(customer->email)) {
-            error_code |= VAL_ERR_INVALID_EMAIL;
-            if (validation_rules.strict_mode) {
-                is_valid = 0;
-            } else {
-                stats.validation_warnings++;
-            }
-        }
+    if (txn->quantity <= 0) {
+        error_code |= VAL_ERR_EMPTY_FIELD;
     }
     
-    /* Validate phone */
-    if (validation_rules.validate_phone && strlen(customer->phone) > 0) {
-        if (!validate_phone(customer->phone)) {
-            error_code |= VAL_ERR_INVALID_PHONE;
-            if (validation_rules.strict_mode) {
-                is_valid = 0;
-            } else {
-                stats.validation_warnings++;
-            }
-        }
+    if (error_code != VAL_OK) {
+        stats.validation_errors++;
+        log_validation_warning(line_num, error_code, 1);
+        return 0;
     }
     
-    /* Validate date */
-    if (validation_rules.validate_date && strlen(customer->registration_date) > 0) {
-        if (!validate_date(customer->registration_date)) {
-            error_code |= VAL_ERR_INVALID_DATE;
-            if (validation_rules.strict_mode) {
-                is_valid = 0;
-            } else {
-                stats.validation_warnings++;
-            }
-        }
+    return 1;
+}
+
+/*
+ * Function: load_customer_keys
+ * Description: Load every customer_id from a converted customer binary into
+ *              a key set for referential integrity checks
+ */
+int load_customer_keys(const char *filename, IdSet *keys) {
+    FILE *f = fopen(filename, "rb");
+    RecordReader reader;
+    Customer *chunk;
+    size_t n;
+    long long total = 0;
+    long long expected;
+    
+    if (f == NULL) {
+        log_message(LOG_ERROR, "Could not open customer binary '%s': %s", 
+                   filename, strerror(errno));
+        return 0;
     }
     
-    /* Validate state */
-    if (validation_rules.validate_state && strlen(customer->state) > 0) {
-        if (!validate_state(customer->state)) {
-            error_code |= VAL_ERR_INVALID_STATE;
-            if (validation_rules.strict_mode) {
-                is_valid = 0;
-            } else {
-                stats.validation_warnings++;
-            }
-        }
+    chunk = (Customer *)malloc(WRITE_BUFFER_SIZE * sizeof(Customer));
+    if (chunk == NULL || 
+        !record_reader_open(&reader, f, filename, sizeof(Customer), &expected)) {
+        free(chunk);
+        fclose(f);
+        return 0;
     }
     
-    /* Validate ZIP */
-    if (validation_rules.validate_zip && strlen(customer->zip_code) > 0) {
-        if (!validate_zip(customer->zip_code)) {
-            error_code |= VAL_ERR_INVALID_ZIP;
-            if (validation_rules.strict_mode) {
-                is_valid = 0;
-            } else {
-                stats.validation_warnings++;
+    while ((n = record_reader_read(&reader, chunk, WRITE_BUFFER_SIZE)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (idset_insert(keys, (unsigned int)chunk[i].customer_id) < 0) {
+                log_message(LOG_ERROR, "Out of memory loading customer keys");
+                record_reader_close(&reader);
+                free(chunk);
+                fclose(f);
+                return 0;
             }
         }
+        total += (long long)n;
     }
     
-    /* Log validation issues */
-    if (error_code != VAL_OK) {
-        if (!is_valid) {
-            stats.validation_errors++;
-        }
-        log_validation_warning(line_num, error_code);
+    record_reader_close(&reader);
+    free(chunk);
+    fclose(f);
+    
+    if (expected != BINARY_COUNT_UNKNOWN && expected != total) {
+        log_message(LOG_WARNING, "'%s' header lists %lld records but %lld were read", 
+                   filename, expected, total);
     }
     
-    return is_valid;
+    log_message(LOG_INFO, "Loaded %zu customer keys from %lld records (%s, %.2f MB)", 
+               keys->count, total, (keys->mode == IDSET_BITMAP) ? "bitmap" : "hash set",
+               idset_memory_bytes(keys) / 1048576.0);
+    return 1;
 }
 
 /*
- * Function: parse_csv_line
- * Description: Parse CSV line with robust error handling
+ * Function: convert_transactions
+ * Description: Convert transactions.csv, checking customer_id against the
+ *              customer key set. Orphan rows go to the orphans CSV exactly
+ *              as read (line ending included).
  */
-int parse_csv_line(char *line, Customer *customer, int line_num) {
-    char *field_start = line;
-    char *field_end;
-    int field_count = 0;
-    char field_buffer[MAX_LINE];
-    int in_quotes = 0;
-    
-    /* Initialize customer structure */
-    memset(customer, 0, sizeof(Customer));
+int convert_transactions(InputReader *reader, FILE *binary_file, int total_estimate) {
+    char line[MAX_LINE];
+    const char *raw;
+    size_t raw_len;
+    Transaction *buffer;
+    FILE *orphans = NULL;
+    IdSet customer_keys;
+    int have_keys = 0;
+    int buffer_count = 0;
+    int line_number = 0;
+    int ret_code = 0;
     
-    /* Sanitize input for security */
-    sanitize_input(line);
+    buffer = (Transaction *)malloc(WRITE_BUFFER_SIZE * sizeof(Transaction));
+    if (buffer == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate write buffer");
+        return 1;
+    }
     
-    while (*field_start != '\0' && field_count < 9) {
-        int buffer_pos = 0;
-        
-        /* Handle quoted fields (CSV standard) */
-        if (*field_start == '"') {
-            in_quotes = 1;
-            field_start++;
-        }
-        
-        /* Extract field */
-        field_end = field_start;
-        while (*field_end != '\0') {
-            if (in_quotes) {
-                if (*field_end == '"') {
-                    /* Check for escaped quote */
-                    if (*(field_end + 1) == '"') {
-                        field_buffer[buffer_pos++] = '"';
-                        field_end += 2;
-                        continue;
-                    } else {
-                        in_quotes = 0;
-                        field_end++;
-                        break;
-                    }
-                }
-            } else {
-                if (*field_end == ',') {
-                    break;
-                }
-            }
-            
-            if (buffer_pos < MAX_LINE - 1) {
-                field_buffer[buffer_pos++] = *field_end;
-            }
-            field_end++;
+    idset_init(&customer_keys);
+    if (strlen(options.customer_keys_file) > 0) {
+        if (!load_customer_keys(options.customer_keys_file, &customer_keys)) {
+            idset_free(&customer_keys);
+            free(buffer);
+            return 1;
         }
+        have_keys = 1;
         
-        field_buffer[buffer_pos] = '\0';
+        orphans = fopen(options.orphans_file, "wb");
+        if (orphans == NULL) {
+            log_message(LOG_ERROR, "Could not create orphans file '%s': %s", 
+                       options.orphans_file, strerror(errno));
+            idset_free(&customer_keys);
+            free(buffer);
+            return 1;
+        }
+    } else {
+        log_message(LOG_WARNING, "No --customer-keys given, skipping referential checks");
+    }
+    
+    while ((raw = input_reader_next_line(reader, &raw_len, 1)) != NULL) {
+        size_t copy_len = (raw_len < MAX_LINE - 1) ? raw_len : MAX_LINE - 1;
+        Transaction txn;
         
-        /* Trim whitespace */
-        char *trimmed = trim_whitespace(field_buffer);
+        line_number++;
+        stats.total_lines++;
+        current_record_offset = input_reader_offset(reader, raw);
         
-        /* Assign to appropriate field */
-        switch (field_count) {
-            case 0: /* customer_id */
-                if (!safe_atoi(trimmed, &customer->customer_id)) {
-                    log_parse_error(line_num, line, "Invalid customer ID");
-                    return 0;
-                }
-                break;
-            case 1: /* first_name */
-                if (strlen(trimmed) >= MAX_FIRST_NAME) {
-                    log_message(LOG_WARNING, "Line %d: First name truncated", line_num);
-                    stats.validation_warnings++;
-                }
-                secure_strncpy(customer->first_name, trimmed, MAX_FIRST_NAME);
-                break;
-            case 2: /* last_name */
-                if (strlen(trimmed) >= MAX_LAST_NAME) {
-                    log_message(LOG_WARNING, "Line %d: Last name truncated", line_num);
-                    stats.validation_warnings++;
-                }
-                secure_strncpy(customer->last_name, trimmed, MAX_LAST_NAME);
-                break;
-            case 3: /* email */
-                if (strlen(trimmed) >= MAX_EMAIL) {
-                    log_message(LOG_WARNING, "Line %d: Email truncated", line_num);
-                    stats.validation_warnings++;
-                }
-                secure_strncpy(customer->email, trimmed, MAX_EMAIL);
-                break;
-            case 4: /* phone */
-                secure_strncpy(customer->phone, trimmed, MAX_PHONE);
-                break;
-            case 5: /* city */
-                if (strlen(trimmed) >= MAX_CITY) {
-                    log_message(LOG_WARNING, "Line %d: City name truncated", line_num);
-                    stats.validation_warnings++;
-                }
-                secure_strncpy(customer->city, trimmed, MAX_CITY);
-                break;
-            case 6: /* state */
-                secure_strncpy(customer->state, trimmed, MAX_STATE);
-                break;
-            case 7: /* zip_code */
-                secure_strncpy(customer->zip_code, trimmed, MAX_ZIP_CODE);
-                break;
-            case 8: /* registration_date */
-                secure_strncpy(customer->registration_date, trimmed, MAX_DATE);
-                break;
+        /* Working copy for the parser, which edits it in place */
+        memcpy(line, raw, copy_len);
+        line[copy_len] = '\0';
+        
+        /* Check for line truncation */
+        if (raw_len > MAX_LINE - 1) {
+            log_event(LOG_WARNING, LOG_EVT_LINE_TOO_LONG, line_number, 0);
+        }
+        
+        /* Header goes to the orphans file too so it stays a valid CSV */
+        if (line_number == 1 && strstr(line, "transaction_id") != NULL) {
+            log_message(LOG_INFO, "Skipping header line");
+            if (orphans != NULL) fwrite(raw, 1, raw_len, orphans);
+            continue;
         }
         
-        field_count++;
+        if (strlen(trim_whitespace(line)) == 0) {
+            continue;
+        }
+        
+        stats.processed_records++;
+        
+        if (!parse_transaction_line(line, &txn, line_number) ||
+            !validate_transaction(&txn, line_number)) {
+            stats.failed_records++;
+            continue;
+        }
+        
+        /* Foreign key check: one bit test per row */
+        if (have_keys && !idset_contains(&customer_keys, (unsigned int)txn.customer_id)) {
+            stats.orphan_records++;
+            stats.failed_records++;
+            record_error(line_number, VAL_OK, PARSE_ERR_ORPHAN_KEY, 1);
+            fwrite(raw, 1, raw_len, orphans);
+            continue;
+        }
         
-        /* Move to next field */
-        if (*field_end == ',') {
-            field_start = field_end + 1;
+        buffer[buffer_count++] = txn;
+        
+        if (buffer_count >= WRITE_BUFFER_SIZE) {
+            if (!write_records(binary_file, buffer, sizeof(Transaction), buffer_count)) {
+                ret_code = 1;
+                break;
+            }
+            stats.successful_records += buffer_count;
+            buffer_count = 0;
+        }
+        
+        if (stats.processed_records % PROGRESS_INTERVAL == 0) {
+            clock_tick();
+            print_progress(stats.processed_records, total_estimate);
+        }
+    }
+    
+    if (buffer_count > 0 && ret_code == 0) {
+        if (!write_records(binary_file, buffer, sizeof(Transaction), buffer_count)) {
+            ret_code = 1;
         } else {
-            field_start = field_end;
+            stats.successful_records += buffer_count;
         }
     }
     
-    /* Verify we got all required fields */
-    if (field_count != 9) {
-        log_parse_error(line_num, line, "Incomplete record - missing fields");
-        return 0;
+    if (orphans != NULL) {
+        fclose(orphans);
+        if (stats.orphan_records > 0) {
+            log_message(LOG_WARNING, "%d orphan transactions written to %s", 
+                       stats.orphan_records, options.orphans_file);
+        }
     }
     
-    return 1;
+    idset_free(&customer_keys);
+    free(buffer);
+    return ret_code;
 }
 
 /*
- * Function: write_batch
- * Description: Write a batch of records to binary file
+ * Function: checkpoint_supported
+ * Description: Whether this run can save and resume checkpoints. Runs with
+ *              state the checkpoint does not hold always start over.
  */
-int write_batch(FILE *binary, Customer *buffer, int count) {
-    size_t written;
+int checkpoint_supported(void) {
+    /* Transactions have their own loop; sorted output is only written at the end */
+    if (options.transactions_mode || options.sort_by_id) return 0;
     
-    if (count == 0) return 1;
-    
-    written = fwrite(buffer, sizeof(Customer), count, binary);
+    /* The seen-ID set is not saved: a resumed run would accept earlier IDs again */
+    if (options.duplicate_policy != DUP_POLICY_OFF) return 0;
     
-    if (written != (size_t)count) {
-        log_message(LOG_ERROR, "Batch write failed: expected %d, wrote %zu", 
-                   count, written);
-        return 0;
-    }
+    /* A resume appends to the records already written: flat layout only */
+    if (options.block_size > 0 || options.arrow || options.domain_ids) return 0;
     
-    stats.bytes_written += (long long)(written * sizeof(Customer));
+    /* Shards are recreated on open; the checkpoint holds no per-shard counts */
+    if (options.shard_count > 0) return 0;
     
     return 1;
 }
 
 /*
  * Function: save_checkpoint
- * Description: Save processing checkpoint for resume capability
+ * Description: Save processing checkpoint for resume capability: input
+ *              records consumed and output records written up to them
  */
-void save_checkpoint(int records_processed) {
+void save_checkpoint(int records_processed, int records_written) {
     FILE *checkpoint = fopen(".conversion_checkpoint", "w");
     if (checkpoint != NULL) {
-        fprintf(checkpoint, "%d\n", records_processed);
+        fprintf(checkpoint, "%d %d\n", records_processed, records_written);
         fclose(checkpoint);
     }
 }
 
 /*
  * Function: load_checkpoint
- * Description: Load checkpoint to resume interrupted conversion
+ * Description: Load checkpoint to resume interrupted conversion. Returns
+ *              the input records to skip (0 for none or an unreadable file).
  */
-int load_checkpoint(void) {
+int load_checkpoint(int *records_written) {
     FILE *checkpoint = fopen(".conversion_checkpoint", "r");
     int records = 0;
     
+    *records_written = 0;
     if (checkpoint != NULL) {
-        if (fscanf(checkpoint, "%d", &records) == 1) {
-            log_message(LOG_INFO, "Found checkpoint at record %d", records);
+        if (fscanf(checkpoint, "%d %d", &records, records_written) == 2 && 
+            records > 0 && *records_written >= 0) {
+            log_message(LOG_INFO, "Found checkpoint at record %d (%d written)", 
+                       records, *records_written);
+        } else {
+            records = 0;
+            *records_written = 0;
         }
         fclose(checkpoint);
     }
@@ -940,15 +7234,67 @@ int load_checkpoint(void) {
     return records;
 }
 
+/*
+ * Function: open_resumed_output
+ * Description: Reopen the output of an interrupted run, keep its first
+ *              records_written records (dropping anything written after the
+ *              checkpoint) and position it to append. The header is written
+ *              again with the record count unknown until the file is closed.
+ */
+FILE* open_resumed_output(const char *output_file, int records_written) {
+    BinaryFileHeader header;
+    size_t record_size = output_record_size();
+    long long data_offset;
+    long long keep;
+    FILE *f = fopen(output_file, "r+b");
+    
+    if (f == NULL) {
+        log_message(LOG_ERROR, "Could not reopen output file '%s' to resume: %s", 
+                   output_file, strerror(errno));
+        return NULL;
+    }
+    
+    data_offset = read_file_header(f, output_file, record_size, &header);
+    keep = data_offset + (long long)records_written * (long long)record_size;
+    if (data_offset < 0 || (data_offset == 0) != (options.no_header != 0) || 
+        (data_offset > 0 && header.flags != (options.packed ? BINARY_FLAG_PACKED : 0u))) {
+        log_message(LOG_ERROR, "'%s' was not written with these output options; "
+                   "cannot resume into it", output_file);
+        fclose(f);
+        return NULL;
+    }
+    if (FSEEK64(f, 0, SEEK_END) != 0 || FTELL64(f) < keep) {
+        log_message(LOG_ERROR, "'%s' holds fewer than the %d records of the checkpoint", 
+                   output_file, records_written);
+        fclose(f);
+        return NULL;
+    }
+    
+    if (FTRUNCATE64(f, keep) != 0 || FSEEK64(f, 0, SEEK_SET) != 0 ||
+        (!options.no_header && !write_file_header(f, record_size)) || 
+        FSEEK64(f, keep, SEEK_SET) != 0) {
+        log_message(LOG_ERROR, "Could not prepare '%s' for resume: %s", 
+                   output_file, strerror(errno));
+        fclose(f);
+        return NULL;
+    }
+    
+    log_message(LOG_INFO, "Resuming after %d records already in %s", 
+               records_written, output_file);
+    return f;
+}
+
 /*
  * Function: print_progress
- * Description: Display progress information
+ * Description: Display progress information. While the logging thread runs
+ *              the line goes through it, so it never splits a log message.
  */
 void print_progress(int records, int total_estimate) {
     double percentage;
-    time_t current_time = time(NULL);
-    double elapsed = difftime(current_time, stats.start_time);
+    double elapsed = (clock_now_ns - stats.start_ns) / 1e9;
     double rate;
+    char line[LOG_EVENT_TEXT];
+    int len;
     
     if (total_estimate > 0) {
         percentage = (double)records / total_estimate * 100.0;
@@ -958,19 +7304,67 @@ void print_progress(int records, int total_estimate) {
     
     rate = (elapsed > 0) ? (records / elapsed) : 0;
     
-    printf("\rProcessed: %d records", records);
+    len = snprintf(line, sizeof(line), "\rProcessed: %d records", records);
     
     if (total_estimate > 0) {
-        printf(" (%.1f%%)", percentage);
+        len += snprintf(line + len, sizeof(line) - len, " (%.1f%%)", percentage);
     }
     
     if (rate > 0) {
-        printf(" - Rate: %.0f rec/sec", rate);
+        len += snprintf(line + len, sizeof(line) - len, " - Rate: %.0f rec/sec", rate);
+    }
+    
+    if (log_running) {
+        LogEvent *event = log_claim(LOG_INFO, LOG_EVT_PROGRESS, 0);
+        
+        if (event == NULL) return;
+        memcpy(event->text, line, (size_t)len);
+        event->text_len = (unsigned short)len;
+        log_publish(event);
+        return;
     }
     
+    fputs(line, stdout);
     fflush(stdout);
 }
 
+/*
+ * Function: duplicate_policy_name
+ * Description: Display name of a duplicate policy
+ */
+const char* duplicate_policy_name(DuplicatePolicy policy) {
+    switch (policy) {
+        case DUP_POLICY_REJECT:     return "reject";
+        case DUP_POLICY_KEEP_FIRST: return "keep-first";
+        case DUP_POLICY_KEEP_LAST:  return "keep-last";
+        default:                    return "off";
+    }
+}
+
+/*
+ * Function: write_error_histogram
+ * Description: One line per parse failure reason and validation error code
+ *              that occurred, with its share of processed records
+ */
+void write_error_histogram(FILE *out, const char *indent) {
+    double total = stats.processed_records > 0 ? stats.processed_records : 1;
+    
+    for (int code = PARSE_OK + 1; code < PARSE_ERR_COUNT; code++) {
+        if (stats.parse_error_counts[code] == 0) continue;
+        fprintf(out, "%s%-34s %10lld (%6.2f%%)\n", indent, PARSE_ERROR_TEXT[code],
+                stats.parse_error_counts[code], 100.0 * stats.parse_error_counts[code] / total);
+    }
+    for (int bit = 0; bit < VAL_ERR_BITS; bit++) {
+        if (stats.val_error_counts[bit] == 0) continue;
+        fprintf(out, "%s%-34s %10lld (%6.2f%%)\n", indent, VAL_ERROR_TEXT[bit],
+                stats.val_error_counts[bit], 100.0 * stats.val_error_counts[bit] / total);
+    }
+    if (stats.log_suppressed > 0) {
+        fprintf(out, "%s%lld detail lines sampled out (--log-first=%lld, --log-sample=1/%lld)\n",
+                indent, stats.log_suppressed, options.log_first, options.log_sample);
+    }
+}
+
 /*
  * Function: print_summary_report
  * Description: Print conversion summary to console
@@ -980,8 +7374,9 @@ void print_summary_report(const char *input_file, const char *output_file) {
     double rate;
     double success_rate;
     
-    stats.end_time = time(NULL);
-    elapsed = difftime(stats.end_time, stats.start_time);
+    stats.end_ns = clock_monotonic_ns();
+    stats.end_time = stats.start_time + (time_t)((stats.end_ns - stats.start_ns) / 1000000000LL);
+    elapsed = (stats.end_ns - stats.start_ns) / 1e9;
     rate = (elapsed > 0) ? (stats.successful_records / elapsed) : 0;
     
     if (stats.processed_records > 0) {
@@ -1008,13 +7403,100 @@ void print_summary_report(const char *input_file, const char *output_file) {
     printf("--- Validation Statistics ---\n");
     printf("Validation errors:       %d\n", stats.validation_errors);
     printf("Validation warnings:     %d\n", stats.validation_warnings);
+    if (options.duplicate_policy != DUP_POLICY_OFF) {
+        printf("Duplicate customer IDs:  %d (%s, %s, %.2f MB)\n", stats.duplicate_records,
+               duplicate_policy_name(options.duplicate_policy),
+               (seen_ids.mode == IDSET_BITMAP) ? "bitmap" : "hash set",
+               idset_memory_bytes(&seen_ids) / 1048576.0);
+    }
+    if (options.transactions_mode && strlen(options.customer_keys_file) > 0) {
+        printf("Orphan customer keys:    %d (see %s)\n", stats.orphan_records, 
+               options.orphans_file);
+    }
+    if (stats.sampled_records > 0) {
+        double low, high;
+        wilson_interval(stats.sampled_errors, stats.sampled_records, &low, &high);
+        printf("Sampled validation:      %d sampled, %d structural, %d unvalidated\n",
+               stats.sampled_records, stats.structural_validations, 
+               stats.unvalidated_records);
+        printf("Estimated error rate:    %.3f%% (95%% CI %.3f%% - %.3f%%)\n",
+               100.0 * stats.sampled_errors / stats.sampled_records, 
+               100.0 * low, 100.0 * high);
+        if (stats.sample_fallback_line > 0) {
+            printf("Sampling fallback:       full validation from line %d\n", 
+                   stats.sample_fallback_line);
+        }
+    }
+    if (strlen(options.rejects_file) > 0 && !options.transactions_mode) {
+        printf("Rejected rows:           %d (see %s)\n", stats.rejected_records, 
+               options.rejects_file);
+    }
+    if (log_dropped > 0) {
+        printf("Log events dropped:      %lld (logging fell behind)\n", log_dropped);
+    }
+    if (validation_rules.check_zip_state) {
+        printf("ZIP/state mismatches:    %d\n", stats.zip_state_mismatches);
+    }
+    if (email_domain_cache.lookups > 0) {
+        printf("%s cache:     %.2f%% hits (%lld lookups)\n", email_domain_cache.name,
+               100.0 * email_domain_cache.hits / email_domain_cache.lookups,
+               email_domain_cache.lookups);
+    }
+    if (email_domains.lookups > 0) {
+        printf("Email domains:           %u valid, %zu distinct (%.2f%% dictionary hits)\n",
+               email_domains.next_id, email_domains.used,
+               100.0 * email_domains.hits / email_domains.lookups);
+        if (email_domains.unassigned > 0) {
+            printf("Domain IDs unassigned:   %lld records (dictionary limit %d domains)\n",
+                   email_domains.unassigned, DOMAIN_DICT_MAX);
+        }
+    }
     printf("\n");
     printf("--- Performance Metrics ---\n");
-    printf("Elapsed time:            %.2f seconds\n", elapsed);
+    printf("Elapsed time:            %.6f seconds (%lld ns)\n", elapsed, 
+           stats.end_ns - stats.start_ns);
     printf("Processing rate:         %.0f records/second\n", rate);
-    printf("Record size:             %zu bytes\n", sizeof(Customer));
+    printf("Record size:             %zu bytes%s\n", output_record_size(), 
+           options.packed ? " (packed)" : "");
+    if (options.packed && stats.packed_rejects > 0) {
+        printf("Not packable:            %lld records rejected\n", stats.packed_rejects);
+    }
     printf("Total bytes written:     %lld bytes (%.2f MB)\n", 
            stats.bytes_written, stats.bytes_written / 1048576.0);
+    if (options.block_size > 0) {
+        printf("Blocks written:          %d x %d KB%s%s, CRC32C (%s)\n", stats.blocks_written, 
+               options.block_size >> 10, options.columnar ? " columnar row groups" : 
+               options.compact ? " compact rows" : "", 
+               options.dictionary ? " + dictionaries" : "", CRC32C_IMPL);
+    }
+    if (options.arrow) {
+        printf("Arrow IPC file:          %d record batches%s\n", stats.record_batches, 
+               options.arrow_dictionary ? ", dictionary-encoded text" : "");
+    }
+    if (shard_writer.count > 0) {
+        long long fewest = shard_writer.shards[0].records, most = fewest;
+        for (int i = 1; i < shard_writer.count; i++) {
+            if (shard_writer.shards[i].records < fewest) fewest = shard_writer.shards[i].records;
+            if (shard_writer.shards[i].records > most) most = shard_writer.shards[i].records;
+        }
+        printf("Output shards:           %d by %s, %lld..%lld records each\n", shard_writer.count, 
+               shard_key_name(options.shard_by), fewest, most);
+    }
+    if (options.sort_by_id && stats.sort_runs == 0) {
+        printf("Sorted by customer_id:   in memory\n");
+    } else if (options.sort_by_id) {
+        printf("Sorted by customer_id:   %d runs, %d merge pass%s, %.2f MB spilled\n", 
+               stats.sort_runs, stats.sort_merge_passes, 
+               stats.sort_merge_passes == 1 ? "" : "es", stats.sort_spilled_bytes / 1048576.0);
+    }
+    if (options.compress_level > 0) {
+        printf("Compression:             LZ4 level %d, %d worker%s, %.2f MB -> %.2f MB (%.1f%%)\n", 
+               options.compress_level, options.compress_threads, 
+               options.compress_threads == 1 ? "" : "s", 
+               stats.compress_in_bytes / 1048576.0, stats.compress_out_bytes / 1048576.0, 
+               stats.compress_in_bytes > 0 ? 
+               100.0 * stats.compress_out_bytes / stats.compress_in_bytes : 0.0);
+    }
     printf("\n");
     
     if (stats.failed_records > 0 || stats.validation_errors > 0) {
@@ -1025,82 +7507,476 @@ void print_summary_report(const char *input_file, const char *output_file) {
         if (stats.validation_errors > 0) {
             printf("  %d validation errors detected\n", stats.validation_errors);
         }
-        printf("  Check conversion_errors.log for details\n");
-        printf("\n");
+        printf("  %lld error records in %s (view with --decode-errors)\n", 
+               error_records_written, options.error_sidecar_file);
+        printf("\n");
+        printf("--- Error Histogram ---\n");
+        write_error_histogram(stdout, "");
+        printf("\n");
+    }
+    
+    printf("================================================================================\n");
+    
+    if (stats.successful_records > 0) {
+        printf("Status: COMPLETED %s\n", 
+               (stats.failed_records == 0) ? "SUCCESSFULLY" : "WITH ERRORS");
+    } else {
+        printf("Status: FAILED - No records converted\n");
+    }
+    
+    printf("================================================================================\n");
+}
+
+/*
+ * Function: save_summary_report
+ * Description: Save summary report to file
+ */
+int save_summary_report(const char *input_file, const char *output_file) {
+    FILE *report = fopen("conversion_summary.txt", "w");
+    double elapsed, rate, success_rate;
+    
+    if (report == NULL) {
+        log_message(LOG_WARNING, "Could not create summary report file");
+        return 0;
+    }
+    
+    elapsed = (stats.end_ns - stats.start_ns) / 1e9;
+    rate = (elapsed > 0) ? (stats.successful_records / elapsed) : 0;
+    success_rate = (stats.processed_records > 0) ? 
+                   (double)stats.successful_records / stats.processed_records * 100.0 : 0.0;
+    
+    fprintf(report, "Customer Data Conversion Summary Report\n");
+    fprintf(report, "Generated: %s\n", ctime(&stats.end_time));
+    fprintf(report, "Version: %s\n", VERSION);
+    fprintf(report, "========================================\n\n");
+    
+    fprintf(report, "Input File:  %s\n", input_file);
+    fprintf(report, "Output File: %s\n\n", output_file);
+    
+    fprintf(report, "Processing Statistics:\n");
+    fprintf(report, "  Total lines read:       %d\n", stats.total_lines);
+    fprintf(report, "  Records processed:      %d\n", stats.processed_records);
+    fprintf(report, "  Successfully converted: %d\n", stats.successful_records);
+    fprintf(report, "  Failed records:         %d\n", stats.failed_records);
+    fprintf(report, "  Success rate:           %.2f%%\n\n", success_rate);
+    
+    fprintf(report, "Validation Statistics:\n");
+    fprintf(report, "  Validation errors:      %d\n", stats.validation_errors);
+    fprintf(report, "  Validation warnings:    %d\n", stats.validation_warnings);
+    if (options.duplicate_policy != DUP_POLICY_OFF) {
+        fprintf(report, "  Duplicate IDs:          %d\n", stats.duplicate_records);
+    }
+    if (options.transactions_mode && strlen(options.customer_keys_file) > 0) {
+        fprintf(report, "  Orphan customer keys:   %d\n", stats.orphan_records);
+    }
+    if (stats.sampled_records > 0) {
+        double low, high;
+        wilson_interval(stats.sampled_errors, stats.sampled_records, &low, &high);
+        fprintf(report, "  Sampled records:        %d\n", stats.sampled_records);
+        fprintf(report, "  Structural validations: %d\n", stats.structural_validations);
+        fprintf(report, "  Unvalidated records:    %d\n", stats.unvalidated_records);
+        fprintf(report, "  Estimated error rate:   %.3f%% (95%% CI %.3f%% - %.3f%%)\n",
+                100.0 * stats.sampled_errors / stats.sampled_records, 
+                100.0 * low, 100.0 * high);
+        if (stats.sample_fallback_line > 0) {
+            fprintf(report, "  Sampling fallback:      line %d\n", stats.sample_fallback_line);
+        }
+    }
+    if (strlen(options.rejects_file) > 0 && !options.transactions_mode) {
+        fprintf(report, "  Rejected rows:          %d\n", stats.rejected_records);
+    }
+    if (log_dropped > 0) {
+        fprintf(report, "  Log events dropped:     %lld\n", log_dropped);
+    }
+    if (validation_rules.check_zip_state) {
+        fprintf(report, "  ZIP/state mismatches:   %d\n", stats.zip_state_mismatches);
+    }
+    if (email_domain_cache.lookups > 0) {
+        fprintf(report, "  %s cache hits: %.2f%% of %lld\n", email_domain_cache.name,
+                100.0 * email_domain_cache.hits / email_domain_cache.lookups,
+                email_domain_cache.lookups);
+    }
+    if (email_domains.lookups > 0) {
+        fprintf(report, "  Email domains:          %u valid, %zu distinct\n", 
+                email_domains.next_id, email_domains.used);
+        fprintf(report, "  Domain dictionary hits: %.2f%% of %lld\n",
+                100.0 * email_domains.hits / email_domains.lookups, email_domains.lookups);
+        if (email_domains.unassigned > 0) {
+            fprintf(report, "  Domain IDs unassigned:  %lld records (dictionary limit %d domains)\n",
+                    email_domains.unassigned, DOMAIN_DICT_MAX);
+        }
+    }
+    fprintf(report, "\n");
+    
+    fprintf(report, "Performance Metrics:\n");
+    fprintf(report, "  Elapsed time:           %.6f seconds (%lld ns)\n", elapsed, 
+            stats.end_ns - stats.start_ns);
+    fprintf(report, "  Processing rate:        %.0f records/second\n", rate);
+    fprintf(report, "  Record size:            %zu bytes%s\n", output_record_size(), 
+            options.packed ? " (packed)" : "");
+    if (options.packed && stats.packed_rejects > 0) {
+        fprintf(report, "  Not packable:           %lld records rejected\n", stats.packed_rejects);
+    }
+    fprintf(report, "  Total bytes written:    %lld bytes\n", stats.bytes_written);
+    if (options.block_size > 0) {
+        fprintf(report, "  Blocks written:         %d x %d KB%s\n", stats.blocks_written, 
+                options.block_size >> 10, options.dictionary ? " (columnar, dictionary)" : 
+                options.columnar ? " (columnar)" : options.compact ? " (compact)" : "");
+    }
+    if (options.arrow) {
+        fprintf(report, "  Arrow IPC file:         %d record batches%s\n", stats.record_batches, 
+                options.arrow_dictionary ? ", dictionary-encoded text" : "");
+    }
+    if (shard_writer.count > 0) {
+        fprintf(report, "  Output shards:          %d by %s\n", shard_writer.count, 
+                shard_key_name(options.shard_by));
+        for (int i = 0; i < shard_writer.count; i++) {
+            fprintf(report, "    %s: %lld records\n", shard_writer.shards[i].path, 
+                    shard_writer.shards[i].records);
+        }
+    }
+    if (options.sort_by_id) {
+        fprintf(report, "  Sorted by customer_id:  %d runs, %d merge passes, %lld bytes spilled\n", 
+                stats.sort_runs, stats.sort_merge_passes, stats.sort_spilled_bytes);
+    }
+    if (options.compress_level > 0) {
+        fprintf(report, "  Compression:            LZ4 level %d, %d worker%s, %lld -> %lld bytes\n", 
+                options.compress_level, options.compress_threads, 
+                options.compress_threads == 1 ? "" : "s", 
+                stats.compress_in_bytes, stats.compress_out_bytes);
+    }
+    fprintf(report, "\n");
+    
+    if (stats.failed_records > 0 || stats.validation_errors > 0) {
+        fprintf(report, "Error Histogram:\n");
+        write_error_histogram(report, "  ");
+        fprintf(report, "\n");
+    }
+    
+    fprintf(report, "Configuration:\n");
+    fprintf(report, "  Email validation:       %s\n", 
+            validation_rules.validate_email ? "Enabled" : "Disabled");
+    fprintf(report, "  Phone validation:       %s\n", 
+            validation_rules.validate_phone ? "Enabled" : "Disabled");
+    fprintf(report, "  Date validation:        %s\n", 
+            validation_rules.validate_date ? "Enabled" : "Disabled");
+    fprintf(report, "  State validation:       %s\n", 
+            validation_rules.validate_state ? "Enabled" : "Disabled");
+    fprintf(report, "  Zip validation:         %s\n", 
+            validation_rules.validate_zip ? "Enabled" : "Disabled");
+    fprintf(report, "  Strict mode:            %s\n", 
+            validation_rules.strict_mode ? "Enabled" : "Disabled");
+    fprintf(report, "  ZIP/state check:        %s\n", 
+            validation_rules.check_zip_state ? "Enabled" : "Disabled");
+    fprintf(report, "  Duplicate policy:       %s\n\n", 
+            duplicate_policy_name(options.duplicate_policy));
+    
+    fclose(report);
+    
+    log_message(LOG_INFO, "Summary report saved to: conversion_summary.txt");
+    return 1;
+}
+
+/*
+ * Function: option_value
+ * Description: If arg is "--name" or "--name=value", return the value ("" when
+ *              absent); otherwise NULL
+ */
+static const char* option_value(const char *arg, const char *name) {
+    size_t len = strlen(name);
+    
+    if (strncmp(arg, name, len) != 0) return NULL;
+    if (arg[len] == '=') return arg + len + 1;
+    if (arg[len] == '\0') return "";
+    return NULL;
+}
+
+/*
+ * Function: parse_option
+ * Description: Parse a --name=value command-line option
+ */
+int parse_option(const char *arg) {
+    const char *value;
+    
+    if ((value = option_value(arg, "--dedup")) != NULL) {
+        if (*value == '\0' || strcmp(value, "keep-first") == 0) {
+            options.duplicate_policy = DUP_POLICY_KEEP_FIRST;
+        } else if (strcmp(value, "reject") == 0) {
+            options.duplicate_policy = DUP_POLICY_REJECT;
+        } else if (strcmp(value, "keep-last") == 0) {
+            options.duplicate_policy = DUP_POLICY_KEEP_LAST;
+        } else if (strcmp(value, "off") == 0) {
+            options.duplicate_policy = DUP_POLICY_OFF;
+        } else {
+            log_message(LOG_ERROR, "Invalid --dedup policy '%s' "
+                       "(expected reject, keep-first, keep-last or off)", value);
+            return 0;
+        }
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--validate-sample")) != NULL) {
+        /* Accept "1/N" or just "N" */
+        const char *denominator = strchr(value, '/');
+        int rate;
+        
+        if (denominator != NULL && strncmp(value, "1/", 2) != 0) denominator = NULL;
+        if (!safe_atoi(denominator ? denominator + 1 : value, &rate) || rate < 1) {
+            log_message(LOG_ERROR, "Invalid --validate-sample '%s' (expected 1/N)", value);
+            return 0;
+        }
+        options.sample_rate = rate;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--sample-max-error")) != NULL) {
+        double rate;
+        
+        if (!safe_atod(value, &rate) || rate < 0.0 || rate > 1.0) {
+            log_message(LOG_ERROR, "Invalid --sample-max-error '%s' (expected 0..1)", value);
+            return 0;
+        }
+        options.sample_max_error = rate;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--transactions")) != NULL) {
+        options.transactions_mode = 1;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--customer-keys")) != NULL && *value != '\0') {
+        secure_strncpy(options.customer_keys_file, value, MAX_PATH_LEN);
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--orphans")) != NULL && *value != '\0') {
+        secure_strncpy(options.orphans_file, value, MAX_PATH_LEN);
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--rejects")) != NULL) {
+        secure_strncpy(options.rejects_file, 
+                       (*value != '\0') ? value : "conversion_rejects.csv", MAX_PATH_LEN);
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--log-first")) != NULL) {
+        int first;
+        if (!safe_atoi(value, &first) || first < 0) {
+            log_message(LOG_ERROR, "Invalid --log-first '%s'", value);
+            return 0;
+        }
+        options.log_first = first;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--log-sample")) != NULL) {
+        /* Accept "1/M" or just "M" */
+        const char *denominator = strchr(value, '/');
+        int rate;
+        
+        if (denominator != NULL && strncmp(value, "1/", 2) != 0) denominator = NULL;
+        if (!safe_atoi(denominator ? denominator + 1 : value, &rate) || rate < 1) {
+            log_message(LOG_ERROR, "Invalid --log-sample '%s' (expected 1/M)", value);
+            return 0;
+        }
+        options.log_sample = rate;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--text-error-log")) != NULL) {
+        options.text_error_log = 1;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--error-file")) != NULL && *value != '\0') {
+        secure_strncpy(options.error_sidecar_file, value, MAX_PATH_LEN);
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--decode-errors")) != NULL) {
+        options.decode_errors = 1;
+        if (*value != '\0') secure_strncpy(options.error_sidecar_file, value, MAX_PATH_LEN);
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--blocks")) != NULL) {
+        /* Optional size in bytes, with K or M suffix */
+        char *end;
+        long size = (*value == '\0') ? BLOCK_DEFAULT_SIZE : strtol(value, &end, 10);
+        
+        if (*value != '\0') {
+            if (*end == 'K' || *end == 'k') { size <<= 10; end++; }
+            else if (*end == 'M' || *end == 'm') { size <<= 20; end++; }
+            if (*end != '\0' || end == value) size = -1;
+        }
+        if (size < BLOCK_MIN_SIZE || size > BLOCK_MAX_SIZE) {
+            log_message(LOG_ERROR, "Invalid --blocks size '%s' (expected %dK..%dM)", 
+                       value, BLOCK_MIN_SIZE >> 10, BLOCK_MAX_SIZE >> 20);
+            return 0;
+        }
+        options.block_size = (int)size;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--columnar")) != NULL) {
+        options.columnar = 1;
+        return 1;
+    }
+    
+    if ((value = option_value(arg, "--dictionary")) != NULL) {
+        /* Optional cardinality limit per column and row group */
+        int entries = DICT_DEFAULT_MAX_ENTRIES;
+        
+        if (*value != '\0' && (!safe_atoi(value, &entries) || entries < 1 || 
+                                entries > DICT_MAX_ENTRIES)) {
+            log_message(LOG_ERROR, "Invalid --dictionary '%s' (expected 1..%d)", 
+                       value, DICT_MAX_ENTRIES);
+            return 0;
+        }
+        options.dictionary = entries;
+        options.columnar = 1;
+        return 1;
     }
     
-    printf("================================================================================\n");
+    if ((value = option_value(arg, "--packed")) != NULL) {
+        options.packed = 1;
+        return 1;
+    }
     
-    if (stats.successful_records > 0) {
-        printf("Status: COMPLETED %s\n", 
-               (stats.failed_records == 0) ? "SUCCESSFULLY" : "WITH ERRORS");
-    } else {
-        printf("Status: FAILED - No records converted\n");
+    if ((value = option_value(arg, "--compact")) != NULL) {
+        options.compact = 1;
+        return 1;
     }
     
-    printf("================================================================================\n");
-}
-
-/*
- * Function: save_summary_report
- * Description: Save summary report to file
- */
-int save_summary_report(const char *input_file, const char *output_file) {
-    FILE *report = fopen("conversion_summary.txt", "w");
-    double elapsed, rate, success_rate;
+    if ((value = option_value(arg, "--arrow")) != NULL) {
+        if (*value != '\0' && strcmp(value, "dictionary") != 0) {
+            log_message(LOG_ERROR, "Invalid --arrow '%s' (expected --arrow or "
+                       "--arrow=dictionary)", value);
+            return 0;
+        }
+        options.arrow = 1;
+        options.arrow_dictionary = (*value != '\0');
+        return 1;
+    }
     
-    if (report == NULL) {
-        log_message(LOG_WARNING, "Could not create summary report file");
-        return 0;
+    if ((value = option_value(arg, "--sort-by")) != NULL) {
+        if (strcmp(value, "customer_id") != 0) {
+            log_message(LOG_ERROR, "Invalid --sort-by '%s' (only customer_id is supported)", value);
+            return 0;
+        }
+        options.sort_by_id = 1;
+        return 1;
     }
     
-    elapsed = difftime(stats.end_time, stats.start_time);
-    rate = (elapsed > 0) ? (stats.successful_records / elapsed) : 0;
-    success_rate = (stats.processed_records > 0) ? 
-                   (double)stats.successful_records / stats.processed_records * 100.0 : 0.0;
+    if ((value = option_value(arg, "--sort-memory")) != NULL) {
+        /* Size in bytes, with K, M or G suffix */
+        char *end;
+        long long size = strtoll(value, &end, 10);
+        
+        if (*end == 'K' || *end == 'k') { size <<= 10; end++; }
+        else if (*end == 'M' || *end == 'm') { size <<= 20; end++; }
+        else if (*end == 'G' || *end == 'g') { size <<= 30; end++; }
+        if (*end != '\0' || end == value || size < SORT_MIN_MEMORY) {
+            log_message(LOG_ERROR, "Invalid --sort-memory '%s' (expected at least 1M)", value);
+            return 0;
+        }
+        options.sort_memory = size;
+        return 1;
+    }
     
-    fprintf(report, "Customer Data Conversion Summary Report\n");
-    fprintf(report, "Generated: %s\n", ctime(&stats.end_time));
-    fprintf(report, "Version: %s\n", VERSION);
-    fprintf(report, "========================================\n\n");
+    if ((value = option_value(arg, "--shards")) != NULL) {
+        int count;
+        
+        if (!safe_atoi(value, &count) || count < 2 || count > SHARD_MAX_COUNT) {
+            log_message(LOG_ERROR, "Invalid --shards '%s' (expected 2..%d)", value, SHARD_MAX_COUNT);
+            return 0;
+        }
+        options.shard_count = count;
+        return 1;
+    }
     
-    fprintf(report, "Input File:  %s\n", input_file);
-    fprintf(report, "Output File: %s\n\n", output_file);
+    if ((value = option_value(arg, "--shard-by")) != NULL) {
+        if (strcmp(value, "hash") == 0) {
+            options.shard_by = SHARD_BY_HASH;
+        } else if (strcmp(value, "state") == 0) {
+            options.shard_by = SHARD_BY_STATE;
+        } else if (strncmp(value, "range:", 6) == 0) {
+            /* Comma-separated first IDs of shards 1.., strictly ascending */
+            const char *p = value + 6;
+            
+            options.shard_by = SHARD_BY_RANGE;
+            options.shard_bound_count = 0;
+            while (*p != '\0') {
+                char *end;
+                long bound = strtol(p, &end, 10);
+                
+                if (end == p || (*end != ',' && *end != '\0') || bound < INT_MIN || 
+                    bound > INT_MAX || options.shard_bound_count == SHARD_MAX_COUNT - 1 || 
+                    (options.shard_bound_count > 0 && 
+                     bound <= options.shard_bounds[options.shard_bound_count - 1])) {
+                    options.shard_bound_count = 0;
+                    break;
+                }
+                options.shard_bounds[options.shard_bound_count++] = (int)bound;
+                p = (*end == ',') ? end + 1 : end;
+            }
+            if (options.shard_bound_count == 0) {
+                log_message(LOG_ERROR, "Invalid --shard-by '%s' (expected ascending IDs, "
+                           "e.g. range:1000,5000)", value);
+                return 0;
+            }
+        } else {
+            log_message(LOG_ERROR, "Invalid --shard-by '%s' (expected hash, state or "
+                       "range:B1,B2,...)", value);
+            return 0;
+        }
+        return 1;
+    }
     
-    fprintf(report, "Processing Statistics:\n");
-    fprintf(report, "  Total lines read:       %d\n", stats.total_lines);
-    fprintf(report, "  Records processed:      %d\n", stats.processed_records);
-    fprintf(report, "  Successfully converted: %d\n", stats.successful_records);
-    fprintf(report, "  Failed records:         %d\n", stats.failed_records);
-    fprintf(report, "  Success rate:           %.2f%%\n\n", success_rate);
+    if ((value = option_value(arg, "--compress-threads")) != NULL) {
+        int threads;
+        
+        if (!safe_atoi(value, &threads) || threads < 0 || threads > COMPRESS_MAX_THREADS) {
+            log_message(LOG_ERROR, "Invalid --compress-threads '%s' (expected 0..%d)", 
+                       value, COMPRESS_MAX_THREADS);
+            return 0;
+        }
+        options.compress_threads = threads;
+        return 1;
+    }
     
-    fprintf(report, "Validation Statistics:\n");
-    fprintf(report, "  Validation errors:      %d\n", stats.validation_errors);
-    fprintf(report, "  Validation warnings:    %d\n\n", stats.validation_warnings);
+    if ((value = option_value(arg, "--compress")) != NULL) {
+        int level = COMPRESS_DEFAULT_LEVEL;
+        
+        if (*value != '\0' && (!safe_atoi(value, &level) || level < 1 || 
+                                level > COMPRESS_MAX_LEVEL)) {
+            log_message(LOG_ERROR, "Invalid --compress '%s' (expected 1..%d)", 
+                       value, COMPRESS_MAX_LEVEL);
+            return 0;
+        }
+        options.compress_level = level;
+        return 1;
+    }
     
-    fprintf(report, "Performance Metrics:\n");
-    fprintf(report, "  Elapsed time:           %.2f seconds\n", elapsed);
-    fprintf(report, "  Processing rate:        %.0f records/second\n", rate);
-    fprintf(report, "  Total bytes written:    %lld bytes\n\n", stats.bytes_written);
+    if ((value = option_value(arg, "--verify")) != NULL && *value != '\0') {
+        secure_strncpy(options.verify_file, value, MAX_PATH_LEN);
+        return 1;
+    }
     
-    fprintf(report, "Configuration:\n");
-    fprintf(report, "  Email validation:       %s\n", 
-            validation_rules.validate_email ? "Enabled" : "Disabled");
-    fprintf(report, "  Phone validation:       %s\n", 
-            validation_rules.validate_phone ? "Enabled" : "Disabled");
-    fprintf(report, "  Date validation:        %s\n", 
-            validation_rules.validate_date ? "Enabled" : "Disabled");
-    fprintf(report, "  State validation:       %s\n", 
-            validation_rules.validate_state ? "Enabled" : "Disabled");
-    fprintf(report, "  Zip validation:         %s\n", 
-            validation_rules.validate_zip ? "Enabled" : "Disabled");
-    fprintf(report, "  Strict mode:            %s\n\n", 
-            validation_rules.strict_mode ? "Enabled" : "Disabled");
+    if ((value = option_value(arg, "--no-header")) != NULL) {
+        options.no_header = 1;
+        return 1;
+    }
     
-    fclose(report);
+    if ((value = option_value(arg, "--domain-ids")) != NULL) {
+        options.domain_ids = 1;
+        return 1;
+    }
     
-    log_message(LOG_INFO, "Summary report saved to: conversion_summary.txt");
-    return 1;
+    log_message(LOG_ERROR, "Unknown option: %s", arg);
+    return 0;
 }
 
 /*
@@ -1110,18 +7986,23 @@ int save_summary_report(const char *input_file, const char *output_file) {
 int main(int argc, char *argv[]) {
     FILE *csv_file = NULL;
     FILE *binary_file = NULL;
-    char line[MAX_LINE];
+    static StagedRecord staged[DATE_BATCH];
     Customer *write_buffer = NULL;
+    unsigned int write_domain_ids[WRITE_BUFFER_SIZE];
+    static PackedCustomer write_packed[WRITE_BUFFER_SIZE];
     int buffer_count = 0;
     int line_number = 0;
     int ret_code = 0;
     int checkpoint_records = 0;
+    int checkpoint_written = 0;
     int total_estimate = 0;
+    InputReader reader = {0};
     
     char input_file[MAX_PATH_LEN] = "data_full\\customers.csv";
     char output_file[MAX_PATH_LEN] = "data\\customers.binary";
     char validation_file[MAX_PATH_LEN] = "";
     char output_dir[MAX_PATH_LEN];
+    int positional = 0;
     
     /* Initialize */
     init_globals();
@@ -1134,16 +8015,115 @@ int main(int argc, char *argv[]) {
     printf("Platform: Windows\n");
     printf("\n");
     
-    /* Parse command-line arguments */
-    if (argc > 1) {
-        secure_strncpy(input_file, argv[1], MAX_PATH_LEN);
+    /* Parse command-line arguments: --options anywhere, then positional paths */
+    {
+        for (int i = 1; i < argc; i++) {
+            if (strncmp(argv[i], "--", 2) == 0) {
+                if (!parse_option(argv[i])) {
+                    cleanup_globals();
+                    return 1;
+                }
+                continue;
+            }
+            
+            switch (positional++) {
+                case 0: secure_strncpy(input_file, argv[i], MAX_PATH_LEN); break;
+                case 1: secure_strncpy(output_file, argv[i], MAX_PATH_LEN); break;
+                case 2: secure_strncpy(validation_file, argv[i], MAX_PATH_LEN); break;
+                default:
+                    log_message(LOG_WARNING, "Ignoring extra argument: %s", argv[i]);
+                    break;
+            }
+        }
+    }
+    
+    /* Decoder mode: render an existing error sidecar and exit */
+    if (options.decode_errors) {
+        int decoded = decode_error_sidecar(options.error_sidecar_file, 
+                                           positional > 0 ? input_file : NULL);
+        cleanup_globals();
+        return decoded ? 0 : 1;
+    }
+    
+    /* Integrity check mode: verify an existing output file and exit */
+    if (strlen(options.verify_file) > 0) {
+        int verified = verify_binary_file(options.verify_file);
+        cleanup_globals();
+        return verified ? 0 : 1;
+    }
+    
+    if (options.columnar && options.compact) {
+        log_message(LOG_ERROR, "--columnar and --compact are alternative block layouts");
+        cleanup_globals();
+        return 1;
+    }
+    if ((options.columnar || options.compact || options.compress_level) && 
+        options.block_size == 0) {
+        options.block_size = BLOCK_DEFAULT_SIZE;
     }
-    if (argc > 2) {
-        secure_strncpy(output_file, argv[2], MAX_PATH_LEN);
+    if (options.compress_threads < 0) {
+        options.compress_threads = cpu_count() - 1;
+        if (options.compress_threads > 8) options.compress_threads = 8;
+        if (options.compress_threads < 1) options.compress_threads = 1;
     }
-    if (argc > 3) {
-        secure_strncpy(validation_file, argv[3], MAX_PATH_LEN);
+    if (options.no_header && (options.block_size > 0 || options.packed)) {
+        log_message(LOG_ERROR, "Block and packed layouts need the file header (drop --no-header)");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.packed && options.transactions_mode) {
+        log_message(LOG_ERROR, "--packed applies to customer records only");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.arrow && (options.block_size > 0 || options.packed || options.no_header ||
+                          options.duplicate_policy == DUP_POLICY_KEEP_LAST)) {
+        log_message(LOG_ERROR, "--arrow writes its own file layout (no --blocks, --packed, "
+                   "--no-header or --dedup=keep-last)");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.transactions_mode && options.duplicate_policy != DUP_POLICY_OFF) {
+        log_message(LOG_ERROR, "--dedup checks customer IDs and cannot be combined with --transactions");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.shard_by == SHARD_BY_RANGE && options.shard_count == 0) {
+        options.shard_count = options.shard_bound_count + 1;
+    }
+    if (options.shard_by == SHARD_BY_RANGE && options.shard_count != options.shard_bound_count + 1) {
+        log_message(LOG_ERROR, "--shards=%d does not match %d range bounds (%d shards)", 
+                   options.shard_count, options.shard_bound_count, options.shard_bound_count + 1);
+        cleanup_globals();
+        return 1;
+    }
+    if ((options.shard_by == SHARD_BY_HASH || options.shard_by == SHARD_BY_STATE) && 
+        options.shard_count == 0) {
+        log_message(LOG_ERROR, "--shard-by=%s needs --shards=N", 
+                   options.shard_by == SHARD_BY_STATE ? "state" : "hash");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.shard_by == SHARD_BY_STATE && options.transactions_mode) {
+        log_message(LOG_ERROR, "--shard-by=state needs customer records (transactions have no state)");
+        cleanup_globals();
+        return 1;
+    }
+    if (options.shard_count > 0 && (options.block_size > 0 || options.arrow || 
+                                    options.domain_ids || 
+                                    options.duplicate_policy == DUP_POLICY_KEEP_LAST)) {
+        log_message(LOG_ERROR, "--shards writes plain record files (no --blocks, --columnar, "
+                   "--compact, --compress, --arrow, --domain-ids or --dedup=keep-last)");
+        cleanup_globals();
+        return 1;
     }
+    if (options.sort_by_id && options.domain_ids) {
+        log_message(LOG_ERROR, "--domain-ids follows input order and cannot be combined with --sort-by");
+        cleanup_globals();
+        return 1;
+    }
+    
+    open_error_sidecar(options.error_sidecar_file);
     
     /* Load validation rules */
     if (strlen(validation_file) > 0) {
@@ -1171,8 +8151,8 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    /* Check for checkpoint */
-    checkpoint_records = load_checkpoint();
+    /* Check for checkpoint (only runs whose state it fully describes) */
+    checkpoint_records = checkpoint_supported() ? load_checkpoint(&checkpoint_written) : 0;
     if (checkpoint_records > 0) {
         char response[10];
         printf("Resume from checkpoint at record %d? (y/n): ", checkpoint_records);
@@ -1194,8 +8174,8 @@ int main(int argc, char *argv[]) {
     
     log_message(LOG_INFO, "Opening input file: %s", input_file);
     
-    /* Open input CSV file */
-    csv_file = fopen(input_file, "r");
+    /* Open input CSV file (binary mode so line lengths are byte offsets) */
+    csv_file = fopen(input_file, "rb");
     if (csv_file == NULL) {
         log_message(LOG_ERROR, "Could not open input file '%s': %s", 
                    input_file, strerror(errno));
@@ -1216,13 +8196,87 @@ int main(int argc, char *argv[]) {
         log_message(LOG_INFO, "Estimated records: ~%d", total_estimate);
     }
     
-    log_message(LOG_INFO, "Creating output file: %s", output_file);
+    /* Sharded output: records go to OUTPUT.shardNN, OUTPUT itself is not written */
+    if (options.shard_count > 0) {
+        log_message(LOG_INFO, "Creating output shards: %s.shard00..%02d", 
+                   output_file, options.shard_count - 1);
+        if (!shard_writer_open(output_file, output_record_size())) {
+            fclose(csv_file);
+            free(write_buffer);
+            cleanup_globals();
+            return 1;
+        }
+    } else {
+        log_message(LOG_INFO, "Creating output file: %s", output_file);
+        
+        /* Resume appends to the records kept from the interrupted run */
+        if (checkpoint_records > 0) {
+            binary_file = open_resumed_output(output_file, checkpoint_written);
+            if (binary_file == NULL) {
+                fclose(csv_file);
+                free(write_buffer);
+                cleanup_globals();
+                return 1;
+            }
+            stats.successful_records = checkpoint_written;
+        } else {
+            /* Open output binary file */
+            binary_file = fopen(output_file, "wb");
+            if (binary_file == NULL) {
+                log_message(LOG_ERROR, "Could not create output file '%s': %s", 
+                           output_file, strerror(errno));
+                fclose(csv_file);
+                free(write_buffer);
+                cleanup_globals();
+                return 1;
+            }
+        }
+        
+        /* Header first; its record count is filled in when the file is closed */
+        if ((options.arrow && !arrow_writer_open(binary_file, output_record_size())) ||
+            (!options.arrow && !options.no_header && checkpoint_records == 0 && 
+             !write_file_header(binary_file, output_record_size())) ||
+            (options.block_size > 0 && !block_writer_open(binary_file, output_record_size()))) {
+            fclose(binary_file);
+            fclose(csv_file);
+            free(write_buffer);
+            cleanup_globals();
+            return 1;
+        }
+    }
+    
+    /* Sorted output collects runs in front of whichever writer is open */
+    if (options.sort_by_id && !sort_open(output_file, output_record_size())) {
+        if (binary_file != NULL) fclose(binary_file);
+        fclose(csv_file);
+        free(write_buffer);
+        cleanup_globals();
+        return 1;
+    }
+    
+    /* Email domain ID column, one uint32 per output record */
+    if (options.domain_ids && !options.transactions_mode) {
+        char ids_file[MAX_PATH_LEN + sizeof(".domain_ids")];
+        snprintf(ids_file, sizeof(ids_file), "%s.domain_ids", output_file);
+        domain_id_file = fopen(ids_file, "wb");
+        if (domain_id_file == NULL) {
+            log_message(LOG_ERROR, "Could not create domain ID file '%s': %s", 
+                       ids_file, strerror(errno));
+            fclose(binary_file);
+            fclose(csv_file);
+            free(write_buffer);
+            cleanup_globals();
+            return 1;
+        }
+    }
     
-    /* Open output binary file */
-    binary_file = fopen(output_file, "wb");
-    if (binary_file == NULL) {
-        log_message(LOG_ERROR, "Could not create output file '%s': %s", 
-                   output_file, strerror(errno));
+    /* Chunked input; rejects and orphans are written from its chunks */
+    if (!input_reader_open(&reader, csv_file) ||
+        (!options.transactions_mode && strlen(options.rejects_file) > 0 && 
+         !open_rejects_file(options.rejects_file))) {
+        log_message(LOG_ERROR, "Failed to set up input reader");
+        input_reader_close(&reader);
+        if (binary_file != NULL) fclose(binary_file);
         fclose(csv_file);
         free(write_buffer);
         cleanup_globals();
@@ -1233,96 +8287,177 @@ int main(int argc, char *argv[]) {
     log_message(LOG_INFO, "Starting conversion...");
     printf("\n");
     
-    /* Read and process CSV file line by line */
-    while (fgets(line, sizeof(line), csv_file) != NULL) {
-        Customer customer;
+    /* From here on log output is formatted and written by the logging thread */
+    log_start();
+    
+    /* Transactions have their own loop with referential checks */
+    if (options.transactions_mode) {
+        ret_code = convert_transactions(&reader, binary_file, total_estimate);
+    }
+    
+    /*
+     * Read and process CSV file line by line. Up to DATE_BATCH parsed records
+     * are staged so their dates can be decoded in one batch before each one
+     * is validated and buffered in input order.
+     */
+    while (!options.transactions_mode && ret_code == 0) {
+        int staged_count = 0;
+        int processed_before = stats.processed_records;
         
-        line_number++;
-        stats.total_lines++;
+        const char *raw;
+        size_t raw_len;
         
-        /* Check for line truncation */
-        {
-            size_t len = strlen(line);
-            if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
-                log_message(LOG_WARNING, "Line %d exceeds maximum length, may be truncated", 
-                           line_number);
-                
-                /* Skip rest of line */
-                int c;
-                while ((c = fgetc(csv_file)) != '\n' && c != EOF);
+        /* Refill the input chunk only between batches (staged rows point into it) */
+        while (staged_count < DATE_BATCH && 
+               (raw = input_reader_next_line(&reader, &raw_len, staged_count == 0)) != NULL) {
+            StagedRecord *record = &staged[staged_count];
+            char *line = record->line;
+            size_t copy_len = (raw_len < MAX_LINE - 1) ? raw_len : MAX_LINE - 1;
+            
+            line_number++;
+            stats.total_lines++;
+            record->byte_offset = current_record_offset = input_reader_offset(&reader, raw);
+            record->raw = raw;
+            record->raw_len = raw_len;
+            
+            /* Working copy for the parser, which edits it in place */
+            memcpy(line, raw, copy_len);
+            line[copy_len] = '\0';
+            
+            /* Check for line truncation */
+            if (raw_len > MAX_LINE - 1) {
+                log_event(LOG_WARNING, LOG_EVT_LINE_TOO_LONG, line_number, 0);
             }
-        }
-        
-        /* Skip header line */
-        if (line_number == 1 && strstr(line, "customer_id") != NULL) {
-            log_message(LOG_INFO, "Skipping header line");
-            continue;
-        }
-        
-        /* Skip empty lines */
-        if (strlen(trim_whitespace(line)) == 0) {
-            continue;
-        }
-        
-        /* Skip if resuming and not at checkpoint yet */
-        if (checkpoint_records > 0 && stats.processed_records < checkpoint_records) {
+            
+            /* Skip header line (the rejects file keeps it) */
+            if (line_number == 1 && strstr(line, "customer_id") != NULL) {
+                log_message(LOG_INFO, "Skipping header line");
+                if (rejects_file != NULL) fwrite(raw, 1, raw_len, rejects_file);
+                continue;
+            }
+            
+            /* Skip empty lines */
+            if (strlen(trim_whitespace(line)) == 0) {
+                continue;
+            }
+            
+            /* Skip if resuming and not at checkpoint yet */
+            if (checkpoint_records > 0 && stats.processed_records < checkpoint_records) {
+                stats.processed_records++;
+                continue;
+            }
+            
             stats.processed_records++;
-            continue;
+            record->processed_records = stats.processed_records;
+            
+            record->line_number = line_number;
+            staged_count++;
+            
+            /* Parse CSV line (failures keep their slot so rejects stay in line order) */
+            record->parse_failed = !parse_csv_line(line, &record->customer, line_number);
+            if (record->parse_failed) continue;
+            
+            /* Canonicalize the phone now so output and checks see one format */
+            record->derived.phone_valid = (unsigned char)normalize_phone(
+                record->customer.phone, &record->derived.phone_number);
+            if (!record->derived.phone_valid) record->derived.phone_number = 0;
+            
+            /* Lowercase the email and intern its domain */
+            record->derived.email_valid = (unsigned char)normalize_email(
+                record->customer.email, &record->derived.domain_id);
         }
         
-        stats.processed_records++;
+        if (staged_count == 0) break;
         
-        /* Parse CSV line */
-        if (!parse_csv_line(line, &customer, line_number)) {
-            stats.failed_records++;
-            continue;
-        }
+        /* Decode all staged registration dates at once */
+        decode_staged_dates(staged, staged_count);
         
-        /* Validate customer data */
-        if (!validate_customer(&customer, line_number)) {
-            stats.failed_records++;
-            if (validation_rules.strict_mode) {
-                log_message(LOG_WARNING, "Line %d: Record failed validation (strict mode)", 
-                           line_number);
+        for (int i = 0; i < staged_count; i++) {
+            StagedRecord *record = &staged[i];
+            int valid;
+            
+            current_record_offset = record->byte_offset;
+            
+            if (record->parse_failed) {
+                stats.failed_records++;
+                reject_record(record->raw, record->raw_len);
                 continue;
             }
-        }
-        
-        /* Add to write buffer */
-        write_buffer[buffer_count++] = customer;
-        
-        /* Flush buffer when full */
-        if (buffer_count >= WRITE_BUFFER_SIZE) {
-            if (!write_batch(binary_file, write_buffer, buffer_count)) {
-                log_message(LOG_ERROR, "Failed to write batch at record %d", 
-                           stats.successful_records);
-                ret_code = 1;
-                break;
+            
+            /* Validate customer data */
+            valid = validate_sampled(&record->customer, &record->derived, record->line_number);
+            if (!valid) {
+                stats.failed_records++;
+                if (validation_rules.strict_mode) {
+                    log_event(LOG_WARNING, LOG_EVT_RECORD_REJECTED, record->line_number, 0);
+                    reject_record(record->raw, record->raw_len);
+                    continue;
+                }
             }
             
-            stats.successful_records += buffer_count;
-            buffer_count = 0;
+            /* Packed output must give back the text it was given */
+            if (options.packed) {
+                int field = pack_customer(&record->customer, &record->derived, &record->packed);
+                
+                if (field >= 0) {
+                    if (valid) stats.failed_records++;
+                    stats.packed_rejects++;
+                    log_event(LOG_WARNING, LOG_EVT_NOT_PACKABLE, record->line_number, field);
+                    reject_record(record->raw, record->raw_len);
+                    continue;
+                }
+            }
             
-            /* Periodic file flush for safety */
-            if (stats.successful_records % FLUSH_INTERVAL == 0) {
-                fflush(binary_file);
+            /* Duplicate customer_id check */
+            if (!check_duplicate(record, write_buffer, write_domain_ids, write_packed, 
+                                 buffer_count)) {
+                if (options.duplicate_policy == DUP_POLICY_REJECT) {
+                    reject_record(record->raw, record->raw_len);
+                }
+                continue;
             }
             
-            /* Save checkpoint */
-            if (stats.successful_records % CHECKPOINT_INTERVAL == 0) {
-                save_checkpoint(stats.successful_records);
+            /* Add to write buffer */
+            write_domain_ids[buffer_count] = record->derived.domain_id;
+            if (options.packed) write_packed[buffer_count] = record->packed;
+            write_buffer[buffer_count++] = record->customer;
+            
+            /* Flush buffer when full */
+            if (buffer_count >= WRITE_BUFFER_SIZE) {
+                if (!write_batch(binary_file, write_buffer, write_packed, write_domain_ids, buffer_count)) {
+                    log_message(LOG_ERROR, "Failed to write batch at record %d", 
+                               stats.successful_records);
+                    ret_code = 1;
+                    break;
+                }
+                
+                stats.successful_records += buffer_count;
+                buffer_count = 0;
+                
+                /* Periodic file flush for safety (shards write whole buffers) */
+                if (binary_file != NULL && stats.successful_records % FLUSH_INTERVAL == 0) {
+                    fflush(binary_file);
+                }
+                
+                /* Save checkpoint once the records it counts are on disk */
+                if (checkpoint_supported() && stats.successful_records % CHECKPOINT_INTERVAL == 0 &&
+                    fflush(binary_file) == 0) {
+                    save_checkpoint(record->processed_records, stats.successful_records);
+                }
             }
         }
         
-        /* Display progress */
-        if (stats.processed_records % PROGRESS_INTERVAL == 0) {
+        /* Batch boundary: one clock read, then progress */
+        clock_tick();
+        if (stats.processed_records / PROGRESS_INTERVAL != 
+            processed_before / PROGRESS_INTERVAL) {
             print_progress(stats.processed_records, total_estimate);
         }
     }
     
     /* Write remaining records in buffer */
     if (buffer_count > 0 && ret_code == 0) {
-        if (!write_batch(binary_file, write_buffer, buffer_count)) {
+        if (!write_batch(binary_file, write_buffer, write_packed, write_domain_ids, buffer_count)) {
             log_message(LOG_ERROR, "Failed to write final batch");
             ret_code = 1;
         } else {
@@ -1330,18 +8465,56 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    /* Sorted output: merge the runs into the writer */
+    if (ret_code == 0 && !sort_finish(binary_file)) {
+        log_message(LOG_ERROR, "Failed to write sorted output");
+        ret_code = 1;
+    }
+    
+    /* Write out queued log events before the final report */
+    log_stop();
+    
     /* Final progress update */
+    clock_tick();
     print_progress(stats.processed_records, total_estimate);
     printf("\n");
     
-    /* Close files */
+    /* Close files (rejects first: they point into the reader's chunk) */
+    close_rejects_file();
+    input_reader_close(&reader);
     fclose(csv_file);
-    fflush(binary_file);
-    fclose(binary_file);
+    if (!block_writer_close(binary_file) || !arrow_writer_close(binary_file) || 
+        !shard_writer_close()) {
+        ret_code = 1;
+    }
+    if (binary_file != NULL) {
+        if (!options.arrow && !options.no_header && 
+            !finalize_file_header(binary_file, stats.successful_records)) {
+            ret_code = 1;
+        }
+        fflush(binary_file);
+        fclose(binary_file);
+    }
+    close_error_sidecar();
+    if (domain_id_file != NULL) {
+        fclose(domain_id_file);
+        domain_id_file = NULL;
+    }
     
     /* Free resources */
     free(write_buffer);
     
+    /* keep-last: patch records whose later duplicates arrived after a flush */
+    if (ret_code == 0 && !apply_pending_replacements(output_file)) {
+        ret_code = 1;
+    }
+    
+    if (options.domain_ids && !options.transactions_mode) {
+        char dictionary_file[MAX_PATH_LEN + sizeof(".domains.csv")];
+        snprintf(dictionary_file, sizeof(dictionary_file), "%s.domains.csv", output_file);
+        if (!write_domain_dictionary(dictionary_file)) ret_code = 1;
+    }
+    
     /* Remove checkpoint file on successful completion */
     if (ret_code == 0 && stats.failed_records == 0) {
         remove(".conversion_checkpoint");
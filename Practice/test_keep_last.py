@@ -0,0 +1,113 @@
+"""
+Keep-Last Duplicate Check for customer_convert_v2 --dedup=keep-last
+===================================================================
+
+Converts customers with many repeated customer IDs spread far apart, so
+most earlier copies are already on disk when their duplicate arrives, and
+checks every output record against a last-wins reference model. Runs the
+flat, block, sorted and packed layouts.
+
+Usage:
+    python test_keep_last.py [path-to-converter]
+
+The converter defaults to ./customer_convert_v2 (.exe on Windows) or the
+CONVERTER environment variable.
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+from binary_file_reader_flexible import (BLOCK_HEADER_FORMAT, BinaryFileHeader, block_payload,
+                                         read_block_index)
+
+
+HERE = Path(__file__).resolve().parent
+DEFAULT_CONVERTER = HERE / ('customer_convert_v2.exe' if os.name == 'nt' else 'customer_convert_v2')
+CONVERTER = os.environ.get('CONVERTER', str(DEFAULT_CONVERTER))
+
+ROWS = 60000
+MAX_ID = 200000
+
+LAYOUTS = {
+    'flat': [],
+    'blocks': ['--blocks=64K'],
+    'sorted': ['--sort-by=customer_id'],
+    'packed': ['--packed'],
+}
+
+
+class KeepLastTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.work = tempfile.TemporaryDirectory()
+        cls.csv_path = Path(cls.work.name) / 'dups.csv'
+
+        # The email carries the arrival index, so each record says which copy it is
+        rng = random.Random(28)
+        cls.expected = {}
+        with open(cls.csv_path, 'w', newline='') as f:
+            f.write('customer_id,first_name,last_name,email,phone,city,state,zip_code,'
+                    'registration_date\n')
+            for row in range(ROWS):
+                customer_id = rng.randint(1, MAX_ID)
+                email = f'row{row}@email.com'
+                f.write(f'{customer_id},Kenneth,Davis,{email},225-959-5506,San Diego,OH,'
+                        f'28289,2022-07-29\n')
+                cls.expected[customer_id] = email
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.work.cleanup()
+
+    def convert(self, name, extra):
+        out_path = Path(self.work.name) / f'{name}.bin'
+        result = subprocess.run(
+            [CONVERTER, str(self.csv_path), str(out_path), '--dedup=keep-last'] + extra,
+            cwd=self.work.name, stdin=subprocess.DEVNULL, capture_output=True, text=True)
+        self.assertEqual(result.returncode, 0, result.stdout + result.stderr)
+        return out_path
+
+    def read_customers(self, out_path):
+        header = BinaryFileHeader.read(out_path)
+        self.assertIsNotNone(header)
+        layout = struct.Struct(header.format_string)
+        if header.blocked:
+            data = b''
+            with open(out_path, 'rb') as f:
+                for entry in read_block_index(out_path):
+                    f.seek(entry.offset + struct.calcsize(BLOCK_HEADER_FORMAT))
+                    data += block_payload(header, f.read(entry.stored_size))
+        else:
+            with open(out_path, 'rb') as f:
+                f.seek(header.header_size)
+                data = f.read()
+        self.assertEqual(len(data), header.record_count * layout.size)
+
+        customers = {}
+        for offset in range(0, len(data), layout.size):
+            fields = layout.unpack_from(data, offset)
+            self.assertNotIn(fields[0], customers, f'customer_id {fields[0]} written twice')
+            customers[fields[0]] = fields[3].split(b'\0', 1)[0].decode()
+        return customers
+
+    def test_last_copy_wins_in_every_layout(self):
+        for name, extra in LAYOUTS.items():
+            with self.subTest(layout=name):
+                customers = self.read_customers(self.convert(name, extra))
+                self.assertEqual(set(customers), set(self.expected))
+                wrong = [cid for cid, email in customers.items() if email != self.expected[cid]]
+                self.assertEqual(len(wrong), 0, f'{len(wrong)} IDs kept an earlier copy, '
+                                 f'e.g. {wrong[:5]}')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and not sys.argv[1].startswith('-'):
+        CONVERTER = sys.argv.pop(1)
+    unittest.main()
@@ -0,0 +1,79 @@
+"""
+Sort Stability Check for customer_convert_v2 --sort-by
+======================================================
+
+Converts transactions with many repeated customer IDs under a small
+--sort-memory, so the external sort spills more runs than one merge pass
+can take, and checks that equal IDs keep their input (transaction_id)
+order.
+
+Usage:
+    python test_sort_stability.py [path-to-converter]
+
+The converter defaults to ./customer_convert_v2 (.exe on Windows) or the
+CONVERTER environment variable.
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+from binary_file_reader_flexible import BinaryFileHeader
+
+
+HERE = Path(__file__).resolve().parent
+DEFAULT_CONVERTER = HERE / ('customer_convert_v2.exe' if os.name == 'nt' else 'customer_convert_v2')
+CONVERTER = os.environ.get('CONVERTER', str(DEFAULT_CONVERTER))
+
+TRANSACTIONS = 250000
+CUSTOMERS = 50
+
+
+class SortStabilityTest(unittest.TestCase):
+
+    def test_ties_keep_input_order_across_merge_passes(self):
+        with tempfile.TemporaryDirectory() as work:
+            work = Path(work)
+            csv_path = work / 'ties.csv'
+            out_path = work / 'ties.bin'
+
+            rng = random.Random(5)
+            with open(csv_path, 'w', newline='') as f:
+                f.write('transaction_id,customer_id,product_id,location_id,transaction_date,'
+                        'quantity,unit_price,total_amount,payment_method\n')
+                for txn_id in range(1, TRANSACTIONS + 1):
+                    f.write(f'{txn_id},{rng.randint(1, CUSTOMERS)},61,47,2022-01-01,'
+                            f'2,39.99,79.98,PayPal\n')
+
+            result = subprocess.run(
+                [CONVERTER, str(csv_path), str(out_path), '--transactions',
+                 '--sort-by=customer_id', '--sort-memory=1M'],
+                cwd=work, stdin=subprocess.DEVNULL, capture_output=True, text=True)
+            self.assertEqual(result.returncode, 0, result.stdout + result.stderr)
+            self.assertRegex(result.stdout, r'Sorted by customer_id: +\d+ runs, [2-9]\d* merge passes')
+
+            header = BinaryFileHeader.read(out_path)
+            self.assertIsNotNone(header)
+            self.assertEqual(header.record_count, TRANSACTIONS)
+
+            with open(out_path, 'rb') as f:
+                f.seek(header.header_size)
+                data = f.read()
+
+            previous = (-1, -1)
+            for offset in range(0, len(data), header.record_size):
+                txn_id, customer_id = struct.unpack_from('<ii', data, offset)
+                self.assertLess(previous, (customer_id, txn_id),
+                                f'record {offset // header.record_size} out of order')
+                previous = (customer_id, txn_id)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and not sys.argv[1].startswith('-'):
+        CONVERTER = sys.argv.pop(1)
+    unittest.main()